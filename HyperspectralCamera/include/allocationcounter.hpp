@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Replaces every form of the global operator new and delete with versions counting the heap allocations of the binary,
+// to check that steady state processing does not allocate.
+// The replacements are definitions, include this in exactly one translation unit of a binary and only when counting is wanted,
+// every allocation of the binary then pays for an atomic increment.
+
+// ----- AllocationCounter -----
+
+std::atomic<uint64_t> heap_allocations(0);
+
+uint64_t heapAllocations() {
+    return heap_allocations.load(std::memory_order_relaxed);
+}
+
+static void* countedAllocate(size_t size) noexcept {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+static void* countedAllocate(size_t size, std::align_val_t alignment) noexcept {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    auto align = static_cast<size_t>(alignment);
+    // aligned_alloc needs a multiple of the alignment
+    size = (size == 0 ? 1 : size + align - 1) / align * align;
+
+#ifdef _WIN32
+    return _aligned_malloc(size, align);
+#else
+    return std::aligned_alloc(align, size);
+#endif
+}
+
+static void countedFree(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+static void countedFree(void* pointer, std::align_val_t) noexcept {
+#ifdef _WIN32
+    _aligned_free(pointer);
+#else
+    std::free(pointer);
+#endif
+}
+
+void* operator new(size_t size) {
+    if (auto pointer = countedAllocate(size)) {
+        return pointer;
+    }
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    if (auto pointer = countedAllocate(size, alignment)) {
+        return pointer;
+    }
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAllocate(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    countedFree(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t alignment) noexcept {
+    countedFree(pointer, alignment);
+}
+
+void operator delete[](void* pointer, std::align_val_t alignment) noexcept {
+    countedFree(pointer, alignment);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t alignment) noexcept {
+    countedFree(pointer, alignment);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t alignment) noexcept {
+    countedFree(pointer, alignment);
+}
+
+void operator delete(void* pointer, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    countedFree(pointer, alignment);
+}
+
+void operator delete[](void* pointer, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    countedFree(pointer, alignment);
+}
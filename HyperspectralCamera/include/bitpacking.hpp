@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// ----- BitPacking -----
+
+// 10-bit packed samples, 4 samples in 5 bytes, least significant bits first
+class BitPacking {
+public:
+    static size_t packedSize(size_t samples);
+
+    // Only the lower 10 bits of every sample are stored
+    static void pack10(const uint16_t* input, size_t samples, uint8_t* output);
+    static void unpack10(const uint8_t* input, size_t samples, uint16_t* output);
+    // Samples first_sample to first_sample + samples of a packed buffer, e.g. a cropped line of a packed frame
+    static void unpack10(const uint8_t* input, size_t first_sample, size_t samples, uint16_t* output);
+};
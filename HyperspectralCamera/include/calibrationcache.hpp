@@ -0,0 +1,43 @@
+#pragma once
+
+#include "sensor.hpp"
+
+#include <cstdint>
+#include <string>
+
+// ----- CalibrationCacheKey -----
+
+// Identifies the calibration XML a cache was created from
+struct CalibrationCacheKey {
+    uint64_t hash = 0;
+    int64_t modification_time = 0;
+    uint64_t size = 0;
+
+    bool operator==(const CalibrationCacheKey& other) const { return hash == other.hash && modification_time == other.modification_time && size == other.size; }
+    // Same modification time and size, the hash is not compared
+    bool sameFile(const CalibrationCacheKey& other) const { return modification_time == other.modification_time && size == other.size; }
+};
+
+// ----- CalibrationCache -----
+
+// Versioned binary copy of a parsed Sensor stored next to the calibration XML ("calibration.xml.cache").
+// The cache is used while the modification time and size of the XML match. Only if they differ is the XML hashed,
+// a matching hash keeps the cache, e.g. for a copied XML, otherwise the XML is parsed again and the cache rewritten.
+class CalibrationCache {
+public:
+    static std::string cacheFilename(const std::string& xml_file);
+
+    // Throws std::runtime_error if the XML cannot be read
+    static CalibrationCacheKey key(const std::string& xml_file);
+    // Same without the hash, the XML is not read
+    static CalibrationCacheKey fileKey(const std::string& xml_file);
+
+    // Returns false if there is no cache, it is stale or it was written by another version
+    static bool load(Sensor& sensor, const std::string& xml_file);
+    // Throws std::runtime_error if the cache cannot be written
+    static void save(const Sensor& sensor, const std::string& xml_file);
+
+    // Loads the cache, or parses the XML and writes the cache
+    // Returns false if the XML cannot be parsed, failing to write the cache is only reported
+    static bool loadOrParse(Sensor& sensor, const std::string& xml_file);
+};
@@ -12,15 +12,54 @@
 #define PIXEL_BYTE_SIZE sizeof(uint16_t)
 #define PIXEL_BIT_SIZE sizeof(uint16_t) * CHAR_BIT
 
+// Must match the values in the .cl files
+#define KERNEL_VECTOR_WIDTH 8
+#define KERNEL_MAX_NUMBER_OF_BANDS 64
+
 // ----- ----- ----- ----- ---
 // ----- ---- Enums ------ ---
 // ----- ----- ----- ----- ---
 
-// ----- ArrayParseState-----
+// ----- Backend -----
+
+enum class Backend {
+    CPU = 0,
+    OPENCL_CPU = 1,
+    OPENCL_GPU = 2
+};
+
+
+// ----- Interleave -----
+
+// ENVI cube file layouts
+enum class Interleave {
+    BSQ = 0,
+    BIL = 1,
+    BIP = 2
+};
+
+
+// ----- PixelFormat -----
+
+// Storage of 10-bit samples, see BitPacking
+enum class PixelFormat {
+    RAW16 = 0,
+    PACKED10 = 1
+};
+
+
+// ----- BackpressurePolicy -----
 
-enum class ArrayParseState {
-    WAITING_FOR_COMMA,
-    WAITING_FOR_SPACE
+// What Pipeline does when correction falls behind acquisition
+enum class BackpressurePolicy {
+    // Acquisition waits for a free slot, frames queue up in the camera and the lag grows
+    BLOCK = 0,
+    // Frames acquired while every slot is in use are discarded, queued frames are kept
+    DROP_NEWEST = 1,
+    // Correction skips to the newest acquired frame and discards the older ones
+    DROP_OLDEST = 2,
+    // Only every nth acquired frame is corrected, the others are discarded right after acquisition
+    EVERY_NTH = 3
 };
 
 
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "sensor.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ----- CubeCodec -----
+
+// Lossless compression of cubes in the Handler layout (band interleaved by pixel).
+// Every sample is predicted from the previous band of the same pixel plus the band difference of
+// the neighbouring pixel, residuals are Rice coded with a parameter chosen per block of samples.
+// The cube is split into tiles of whole spatial lines that are coded independently and in parallel.
+class CubeCodec {
+    unsigned int spatial_width_;
+    unsigned int spatial_height_;
+    unsigned int number_of_bands_;
+    unsigned int tile_lines_;
+    unsigned int threads_;
+
+public:
+    // threads of 0 uses one thread per hardware thread
+    CubeCodec(const Sensor& sensor, unsigned int tile_lines = 16, unsigned int threads = 0);
+
+    unsigned int numberOfTiles() const;
+
+    // Upper bound of the size of one encoded cube
+    size_t maxEncodedSize() const;
+
+    // Appends one encoded cube to output
+    void encode(const uint16_t* cube, std::vector<uint8_t>& output) const;
+
+    // Decodes one cube from input, returns the number of bytes used
+    // Throws std::runtime_error on corrupted data
+    size_t decode(const uint8_t* input, size_t size, uint16_t* cube) const;
+
+    // Single block of lines x width pixels with bands samples each, band interleaved by pixel
+    static void encodeBlock(const uint16_t* block, size_t width, size_t lines, size_t bands, std::vector<uint8_t>& output);
+    static void decodeBlock(const uint8_t* input, size_t size, size_t width, size_t lines, size_t bands, uint16_t* block);
+    static size_t maxEncodedBlockSize(size_t samples);
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "mappedfile.hpp"
+#include "sensor.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// ----- CubeContainerLayout -----
+
+// Chunk shape, edge chunks are cut at the cube border
+struct CubeContainerLayout {
+    unsigned int tile_width = 64;
+    unsigned int tile_height = 64;
+    unsigned int band_group = 8;
+    // Chunks are stored with CubeCodec block coding unless that does not make them smaller
+    bool compressed = true;
+};
+
+// ----- CubeContainerWriter -----
+
+// Multi-frame cube file split into chunks of spatial tile x band group.
+// Chunks are appended frame by frame, the chunk index and frame count are written on close, so a
+// reader only touches the chunks a band, region or frame needs.
+class CubeContainerWriter {
+    std::string filename_;
+    unsigned int spatial_width_;
+    unsigned int spatial_height_;
+    unsigned int number_of_bands_;
+    CubeContainerLayout layout_;
+
+    std::ofstream file_;
+    uint64_t file_offset_;
+    uint64_t frames_written_;
+    bool closed_;
+
+    // Offset and size of every chunk written so far
+    std::vector<uint64_t> index_;
+
+    std::vector<uint16_t> chunk_;
+    std::vector<uint8_t> encoded_;
+
+    void writeData(const void* data, size_t size);
+
+public:
+    // Throws std::runtime_error if the file cannot be created or the layout is empty
+    CubeContainerWriter(const std::string& filename, const Sensor& sensor, const CubeContainerLayout& layout = {});
+    // Closes if still open, errors are lost
+    ~CubeContainerWriter();
+
+    CubeContainerWriter(const CubeContainerWriter&) = delete;
+    CubeContainerWriter& operator=(const CubeContainerWriter&) = delete;
+
+    // cube as produced by Handler, band interleaved by pixel
+    void writeFrame(const uint16_t* cube);
+
+    // Writes the chunk index, the file is unreadable until then
+    void close();
+
+    uint64_t framesWritten() const { return frames_written_; }
+};
+
+// ----- CubeContainerReader -----
+
+// Random access to a file written by CubeContainerWriter through a memory mapping
+// Outputs are band interleaved by pixel and resized as needed
+class CubeContainerReader {
+    MappedFile file_;
+    unsigned int spatial_width_;
+    unsigned int spatial_height_;
+    unsigned int number_of_bands_;
+    CubeContainerLayout layout_;
+    uint64_t number_of_frames_;
+
+    const uint8_t* chunks_;
+    std::vector<uint64_t> index_;
+
+    unsigned int tilesX() const;
+    unsigned int tilesY() const;
+    unsigned int bandGroups() const;
+
+    // Decodes one chunk into chunk, tile_width x tile_height pixels with the bands of the group
+    void readChunk(uint64_t frame, unsigned int group, unsigned int tile_x, unsigned int tile_y, std::vector<uint16_t>& chunk) const;
+
+public:
+    // Throws std::runtime_error if the file is not a closed cube container
+    CubeContainerReader(const std::string& filename);
+
+    // Getters
+    uint64_t numberOfFrames() const { return number_of_frames_; }
+    unsigned int spatialWidth() const { return spatial_width_; }
+    unsigned int spatialHeight() const { return spatial_height_; }
+    unsigned int numberOfBands() const { return number_of_bands_; }
+    const CubeContainerLayout& layout() const { return layout_; }
+
+    // Region of width x height pixels at (x, y) with number_of_bands bands starting at first_band
+    // Throws std::runtime_error if the region is outside of the cube or a chunk is corrupted
+    void readRegion(uint64_t frame, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int first_band, unsigned int number_of_bands, std::vector<uint16_t>& output) const;
+
+    void readFrame(uint64_t frame, std::vector<uint16_t>& cube) const;
+    // Spatial image of one band
+    void readBand(uint64_t frame, unsigned int band, std::vector<uint16_t>& image) const;
+    // Every band of a region
+    void readSpectra(uint64_t frame, unsigned int x, unsigned int y, unsigned int width, unsigned int height, std::vector<uint16_t>& spectra) const;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "sensor.hpp"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// ----- EnviWriter -----
+
+// Streams a cube into an ENVI data file one spatial line at a time and writes the .hdr header on close
+class EnviWriter {
+    std::string filename_;
+    Sensor sensor_;
+    Interleave interleave_;
+
+    std::ofstream file_;
+    unsigned int lines_written_;
+
+    // One line reordered for BIL / BSQ
+    std::vector<uint16_t> line_buffer_;
+
+public:
+    // Throws std::runtime_error if the data file cannot be created
+    EnviWriter(const std::string& filename, const Sensor& sensor, Interleave interleave);
+
+    // line is one spatial line of a cube as produced by Handler, band interleaved by pixel
+    void writeLine(const uint16_t* line);
+    void writeCube(const uint16_t* cube);
+
+    // Writes the header next to the data file, throws if not every line was written
+    void close();
+
+    unsigned int linesWritten() const { return lines_written_; }
+
+    // "cube.img" -> "cube.hdr"
+    static std::string headerFilename(const std::string& filename);
+
+    // Header of a data file holding lines spatial lines, e.g. several cubes recorded one after another
+    static void writeHeader(const std::string& filename, const Sensor& sensor, Interleave interleave, uint64_t lines);
+};
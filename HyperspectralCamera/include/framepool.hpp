@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// ----- FramePoolStats -----
+
+struct FramePoolStats {
+    // Buffers allocated by the pool, stops growing once enough buffers circulate
+    uint64_t allocations = 0;
+    uint64_t acquisitions = 0;
+    // Handed out and not yet returned
+    size_t outstanding = 0;
+};
+
+// ----- FramePoolState -----
+
+// Shared by a pool and its buffers, so buffers may outlive the pool
+struct FramePoolState {
+    std::mutex mutex;
+    size_t buffer_size;
+    std::vector<std::vector<uint16_t>> free;
+    FramePoolStats stats;
+};
+
+// ----- FrameBuffer -----
+
+// Move-only handle of a frame sized buffer, the buffer goes back to its pool when the handle is destroyed.
+// A handle created from a vector has no pool and frees its vector as usual.
+class FrameBuffer {
+    std::vector<uint16_t> data_;
+    std::shared_ptr<FramePoolState> pool_;
+
+public:
+    FrameBuffer() = default;
+    FrameBuffer(std::vector<uint16_t>&& data);
+    FrameBuffer(std::vector<uint16_t>&& data, std::shared_ptr<FramePoolState> pool);
+    ~FrameBuffer();
+
+    FrameBuffer(FrameBuffer&& other) noexcept;
+    FrameBuffer& operator=(FrameBuffer&& other) noexcept;
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+    uint16_t* data() { return data_.data(); }
+    const uint16_t* data() const { return data_.data(); }
+    size_t size() const { return data_.size(); }
+    bool pooled() const { return pool_ != nullptr; }
+    std::vector<uint16_t>& vector() { return data_; }
+
+    // Returns the buffer to its pool now, the handle is empty afterwards
+    void release();
+};
+
+// ----- FramePool -----
+
+// Recycles buffers of buffer_size samples, e.g. frames handed from the live loop to ImageWriter.
+// A buffer is only allocated when all buffers are in use, so once enough of them circulate
+// acquiring and returning buffers performs no heap allocation. Thread-safe.
+class FramePool {
+    std::shared_ptr<FramePoolState> state_;
+
+public:
+    // preallocate buffers are allocated up front
+    FramePool(size_t buffer_size, size_t preallocate = 0);
+
+    // Contents are left from the previous user
+    FrameBuffer acquire();
+
+    size_t bufferSize() const { return state_->buffer_size; }
+    FramePoolStats stats() const;
+};
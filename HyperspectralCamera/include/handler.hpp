@@ -3,78 +3,222 @@
 #include <CL/cl.hpp>
 
 #include "image.hpp"
+#include "openclcontext.hpp"
 #include "sensor.hpp"
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 class Sensor;
 
+// Time spent in each stage of Handler::process in seconds
+struct ProcessingTimes {
+    double offset_correction = 0;
+    double converttocube_reflection_correction = 0;
+    double spectral_correction = 0;
+};
+
+// ----- HandlerCalibration -----
+
+// Calibration a frame is processed with, never changed once published by Handler.
+// Setters publish a changed copy, frames already being processed finish with the copy they started with.
+struct HandlerCalibration {
+    Image dark_reference_object;
+    Image dark_reference_white;
+    Image white_reference;
+    unsigned int exposure_time_object = 0;
+    unsigned int exposure_time_white_reference = 0;
+
+    // Index of the Sensor correction matrix used by spectral correction
+    size_t correction_matrix = 0;
+
+    // Device buffers of the references above, only created once OpenCL is initialized
+    cl::Buffer dark_reference_object_buffer;
+    cl::Buffer dark_reference_white_buffer;
+    cl::Buffer white_reference_buffer;
+};
+
+// ----- Handler -----
+
+// Processing methods are const and reentrant, one Handler processes frames on any number of threads at once.
+// Calibration is read from an immutable HandlerCalibration taken at the start of every call,
+// OpenCL kernels and scratch images are kept per calling thread.
 class Handler {
+    // Device buffers of process on OpenCL backends, allocated once and reused for every frame
+    struct DeviceBuffers {
+        // Raw sensor frame, or the packed frame
+        cl::Buffer frame;
+        // Unpacked active area of a packed frame
+        cl::Buffer active_area;
+        cl::Buffer cube;
+        cl::Buffer spectral_correction;
+    };
+
+    // Execution state of one thread
+    struct ThreadContext {
+        // Created on the first OpenCL call of the thread
+        std::unique_ptr<OpenCLKernels> kernels;
+        // In-order queue of the thread, commands of other threads never wait behind it
+        std::unique_ptr<cl::CommandQueue> queue;
+        // Created on the first frame processed on an OpenCL backend
+        std::unique_ptr<DeviceBuffers> buffers;
+        // Output of the C++ spectral correction in process, swapped with the processed cube
+        Image spectral_correction_output;
+    };
+
+    // Contexts of the threads using the Handler, shared with the threads so each can release its context when it ends
+    struct ThreadContexts {
+        std::mutex mutex;
+        std::unordered_map<std::thread::id, std::unique_ptr<ThreadContext>> contexts;
+    };
+
     Sensor sensor_;
+    Backend backend_;
+    DeviceFission fission_;
+
+    // Replaced as a whole by the setters and OpenCL initialization, read and written with std::atomic_load / std::atomic_store
+    mutable std::shared_ptr<const HandlerCalibration> calibration_;
+    // Serializes the setters and OpenCL initialization, so no change is lost
+    mutable std::mutex calibration_mutex_;
+
+    // Work-group sizes used by process on OpenCL backends, 0 leaves the choice to the runtime
+    std::atomic<unsigned int> cube_workgroup_;
+    std::atomic<unsigned int> spectral_workgroup_1_;
+    std::atomic<unsigned int> spectral_workgroup_2_;
+    std::atomic<bool> vector_kernels_;
 
-    Image dark_reference_object_;
-    Image dark_reference_white_;
-    Image white_reference_;
-    cl::Buffer coefficients_buffer_;
-    cl::Buffer dark_reference_object_buffer_;
-    cl::Buffer dark_reference_white_buffer_;
-    cl::Buffer white_reference_buffer_;
-    unsigned int exposure_time_object_;
-    unsigned int exposure_time_white_reference_;
-
-    // Attributes for OpenCL
-    std::vector<cl::Device> devices_;
-    cl::Device device_;
-    cl::Context context_;
-    cl::CommandQueue queue_;
-    cl::Program::Sources convert_to_cube_and_reflection_correction_source_;
-    cl::Program::Sources spectral_correction_source_;
-    cl::Program::Sources offset_correction_source_;
-    cl::Program::Sources get_one_band_and_colourmap_source_;
-    cl::Program convert_to_cube_and_reflection_correction_program_;
-    cl::Program spectral_correction_program_;
-    cl::Program offset_correction_program_;
-    cl::Program get_one_band_and_colourmap_program_;
-    cl::Kernel convert_to_cube_and_reflection_correction_kernel_;
-    cl::Kernel spectral_correction_kernel_;
-    cl::Kernel offset_correction_kernel_;
-    cl::Kernel get_one_band_and_colourmap_kernel_;
-
-    void updateWhiteReferenceBuffer();
-    void updateDarkReferenceObjectBuffer();
-    void updateDarkReferenceWhiteBuffer();
+    // Attributes for OpenCL, initialized on first use
+    mutable std::once_flag opencl_once_;
+    mutable std::unique_ptr<OpenCLContext> opencl_;
+
+    std::shared_ptr<ThreadContexts> contexts_;
+
+    OpenCLContext& opencl() const;
+    ThreadContext& context() const;
+    OpenCLKernels& kernels() const;
+    cl::CommandQueue& queue() const;
+    DeviceBuffers& buffers() const;
+    bool useVectorKernels() const;
+
+    // Publishes a changed copy of the calibration
+    void updateCalibration(const std::function<void(HandlerCalibration&)>& update);
+    // Called with calibration_mutex_ held
+    void createReferenceBuffers(HandlerCalibration& calibration) const;
+
+    // C++ stages after offset correction, shared by process and processPacked
+    void processActiveArea(const HandlerCalibration& calibration, Image& image, ProcessingTimes* times, double offset_correction_time) const;
+    // Every stage of process and processPacked on the OpenCL device, the frame is uploaded once and the cube read back once
+    void processOpenCL(const HandlerCalibration& calibration, const void* input, PixelFormat format, Image& image, ProcessingTimes* times) const;
+
+    // Kernels reading input at (input_offset_x, input_offset_y) with row pitch input_width, waited for by the caller
+    void enqueueConvertToCubeAndReflectionCorrectionVector(const HandlerCalibration& calibration, const cl::Buffer& input_buffer, unsigned int input_width, unsigned int input_offset_x, unsigned int input_offset_y, const cl::Buffer& cube_buffer) const;
+    void enqueueConvertToCubeAndReflectionCorrectionLocal(const HandlerCalibration& calibration, const cl::Buffer& input_buffer, unsigned int input_width, unsigned int input_offset_x, unsigned int input_offset_y, const cl::Buffer& cube_buffer, unsigned int workgroup) const;
+    void enqueueSpectralCorrection(const HandlerCalibration& calibration, const cl::Buffer& input_buffer, const cl::Buffer& output_buffer, unsigned int workgroup_1, unsigned int workgroup_2) const;
 
 public:
     // Constructor
+    // OpenCL is only initialized for OpenCL backends, or on the first call of an OpenCL method
+    // fission leaves compute units of a CPU OpenCL device to the host
     Handler(const Sensor& sensor,
             const Image& dark_reference_object,
             const Image& dark_reference_white,
             const Image& white_reference,
             unsigned int exposure_time_object,
-            unsigned int exposure_time_white_reference);
+            unsigned int exposure_time_white_reference,
+            Backend backend = Backend::CPU,
+            const DeviceFission& fission = {});
 
     // Getters
     Sensor getSensor() const { return sensor_; };
+    Backend backend() const { return backend_; }
+    size_t correctionMatrix() const { return calibration()->correction_matrix; }
+    // Calibration the next frame is processed with
+    std::shared_ptr<const HandlerCalibration> calibration() const;
+    // Copy of the calibration with other references, e.g. for one of several cameras sharing the handler, see process
+    // Device buffers are created if OpenCL is initialized, which it always is on OpenCL backends
+    std::shared_ptr<const HandlerCalibration> makeCalibration(const Image& dark_reference_object,
+                                                              const Image& dark_reference_white,
+                                                              const Image& white_reference,
+                                                              unsigned int exposure_time_object,
+                                                              unsigned int exposure_time_white_reference) const;
 
-    // Setters
+    // Setters, thread-safe, they take effect from the next frame on
     void setWhiteReference(const Image& white_reference);
     void setDarkReferenceObject(const Image& dark_reference_object);
     void setDarkReferenceWhite(const Image& dark_reference_white);
+    void setWorkgroups(unsigned int cube_workgroup, unsigned int spectral_workgroup_1, unsigned int spectral_workgroup_2);
+    // The vector kernels are used on CPU devices unless disabled, e.g. to compare them with the scalar ones
+    void setVectorKernels(bool enabled) { vector_kernels_ = enabled; }
+    // Selects the correction matrix of the following frames, all matrices are uploaded once so nothing is copied
+    // Throws std::runtime_error if the sensor has no such matrix
+    void setCorrectionMatrix(size_t index);
+    void setCorrectionMatrix(const std::string& name);
+
+    // Backend-neutral front end, every stage runs on the backend selected in the constructor
+    // Offset correction, conversion to cube with reflection correction and spectral correction of raw data
+    // On OpenCL backends the cube kernels read the active area straight from the uploaded sensor frame,
+    // the raw data of image is only copied out of it for references and snapshots
+    void process(const uint16_t* input, Image& image, ProcessingTimes* times = nullptr) const;
+    // Same for a 10-bit packed frame, unpacking is fused with offset correction
+    void processPacked(const uint8_t* input, Image& image, ProcessingTimes* times = nullptr) const;
+    // Same with calibration instead of the handler's own, which is left unchanged
+    void process(const HandlerCalibration& calibration, const uint16_t* input, Image& image, ProcessingTimes* times = nullptr) const;
+    void processPacked(const HandlerCalibration& calibration, const uint8_t* input, Image& image, ProcessingTimes* times = nullptr) const;
+    // Retrieve one band with colourmap - Cube data used!
+    void colourmap(std::vector<uint16_t>& output, const Image& image, unsigned int band_index) const;
 
     // Offset correction from raw data
-    void offsetOpenCL(uint16_t* input, Image& output);
-    void offset(uint16_t* input, Image& output);
+    void offsetOpenCL(const uint16_t* input, Image& output) const;
+    void offset(const uint16_t* input, Image& output) const;
+
+    // Offset correction from a 10-bit packed frame (BitPacking layout), only the active area is unpacked
+    void offsetPackedOpenCL(const uint8_t* input, Image& output) const;
+    void offsetPacked(const uint8_t* input, Image& output) const;
+
+    // Offset correction as a rectangular buffer copy of the active area, no kernel is launched
+    void offsetCopyOpenCL(const uint16_t* input, Image& output) const;
 
     // Converts raw image data to cube image data and performs relfection correction
-    void convertToCubeAndReflectionCorrection(Image& image);
-    void convertToCubeAndReflectionCorrectionOpenCL(Image& image);
+    void convertToCubeAndReflectionCorrection(Image& image) const;
+    void convertToCubeAndReflectionCorrectionOpenCL(Image& image) const;
+
+    // Same as convertToCubeAndReflectionCorrectionOpenCL, but every work-group stages a strip of workgroup
+    // macro-pixels in local memory so that both reading raw data and writing the cube are coalesced
+    void convertToCubeAndReflectionCorrectionLocalOpenCL(Image& image, unsigned int workgroup) const;
+
+    // Same as above, but reads the active area straight from the raw sensor frame, so offset correction is not needed
+    void convertToCubeAndReflectionCorrectionLocalOpenCL(const uint16_t* input, Image& image, unsigned int workgroup) const;
 
     // Spectral correction - Cube data used!
-    void spectralCorrection(Image& output, const Image& input);
-    void spectralCorrectionOpenCL(Image& image, unsigned int workgroup_1, unsigned int workgroup_2);
+    void spectralCorrection(Image& output, const Image& input) const;
+    // Workgroup sizes of 0 leave the choice to the runtime
+    void spectralCorrectionOpenCL(Image& image, unsigned int workgroup_1, unsigned int workgroup_2) const;
+
+    // Spectral correction with several correction matrices in one pass over input, outputs[i] is corrected with matrices[i]
+    // Outputs are resized to the cube size
+    void spectralCorrectionMultiple(std::vector<Image>& outputs, const Image& input, const std::vector<size_t>& matrices) const;
+    void spectralCorrectionMultipleOpenCL(std::vector<Image>& outputs, const Image& input, const std::vector<size_t>& matrices) const;
 
     // Retrieve one band - Cube data used!
     // band_index is a value from <0, numberOfBands - 1>
-    void getOneBandAndColourmap(std::vector<uint16_t>& output, const Image& input, unsigned int band_index);
-    void getOneBandAndColourmapOpenCL(std::vector<uint16_t>& output, const Image& input, unsigned int band_index);
+    void getOneBandAndColourmap(std::vector<uint16_t>& output, const Image& input, unsigned int band_index) const;
+    void getOneBandAndColourmapOpenCL(std::vector<uint16_t>& output, const Image& input, unsigned int band_index) const;
+
+    // Row ranges of the C++ stages, e.g. for TileScheduler
+    // They only write their rows of output, so disjoint ranges may run on several threads at once
+    // Pass the same calibration for every row range of a frame
+    // Outputs must already have their full size, arguments are not checked
+    // Offset correction rows are rows of the active area
+    void offsetRows(const uint16_t* input, Image& output, size_t first_row, size_t rows) const;
+    void offsetPackedRows(const uint8_t* input, Image& output, size_t first_row, size_t rows) const;
+    // Other rows are rows of macro-pixels, i.e. spatial rows of the cube
+    void convertToCubeAndReflectionCorrectionRows(const HandlerCalibration& calibration, Image& image, size_t first_row, size_t rows) const;
+    void spectralCorrectionRows(const HandlerCalibration& calibration, Image& output, const Image& input, size_t first_row, size_t rows) const;
+    void getOneBandAndColourmapRows(std::vector<uint16_t>& output, const Image& input, unsigned int band_index, size_t first_row, size_t rows) const;
 };
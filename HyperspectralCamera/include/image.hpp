@@ -1,8 +1,12 @@
 #pragma once
 
+#include "common.hpp"
+
+#include <memory>
 #include <string>
 #include <vector>
 
+class MappedFile;
 class Sensor;
 
 class Image {
@@ -24,12 +28,23 @@ class Image {
     std::vector<uint16_t> data_raw_;
     std::vector<uint16_t> data_cube_;
 
+    // Read-only raw data mapped from a file, shared between copies
+    // Copied into data_raw_ on first write access
+    std::shared_ptr<const MappedFile> mapped_raw_;
+
+    Image(const Sensor& sensor, size_t raw_size);
+
+    void unmap();
+
 public:
     Image();
     Image(const Sensor& sensor);
     Image(const Sensor& sensor, const std::string& filePath);
     Image(const Sensor& sensor, const std::vector<uint16_t>& data);
 
+    // Raw data backed by a mapped file of exactly active area size, cube data is allocated on first use
+    Image(const Sensor& sensor, std::shared_ptr<const MappedFile> file);
+
     size_t getArrayIndex(size_t x, size_t y) const;
 
     uint16_t pixel(size_t x, size_t y) const;
@@ -42,13 +57,19 @@ public:
     uint16_t& mutablePixelCube(size_t i);
 
     size_t size() const;
+    bool isMapped() const;
+
+    // Raw data of both owned and mapped images
+    const uint16_t* rawData() const;
 
+    // Throws for mapped images, use rawData instead
     const std::vector<uint16_t>& data() const;
     std::vector<uint16_t>& mutableData();
 
     const std::vector<uint16_t>& cube() const;
     std::vector<uint16_t>& mutableCube();
 
-    void saveWithoutChecking(const std::string& filename) const;
-    void save(const std::string& filename) const;
+    // Files are loaded as either 16-bit or 10-bit packed samples depending on their size
+    void saveWithoutChecking(const std::string& filename, PixelFormat format = PixelFormat::RAW16) const;
+    void save(const std::string& filename, PixelFormat format = PixelFormat::RAW16) const;
 };
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "framepool.hpp"
+#include "sensor.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ----- WriteResult -----
+
+struct WriteResult {
+    std::string filename;
+    bool success;
+    std::string message;
+};
+
+// ----- ImageWriter -----
+
+// Writes frame buffers to disk on a background thread so that the capture loop never waits for the disk
+class ImageWriter {
+    struct Job {
+        std::string filename;
+        FrameBuffer data;
+        bool overwrite;
+        PixelFormat format;
+
+        // Set for cubes written as ENVI files
+        std::shared_ptr<const Sensor> sensor;
+        Interleave interleave;
+    };
+
+    size_t capacity_;
+    bool stop_;
+
+    std::deque<Job> jobs_;
+    std::deque<WriteResult> results_;
+    mutable std::mutex mutex_;
+    std::condition_variable job_added_;
+    std::condition_variable job_done_;
+    size_t jobs_in_progress_;
+
+    std::thread thread_;
+
+    void run();
+    bool push(const std::string& filename, FrameBuffer& data, bool overwrite, PixelFormat format, std::shared_ptr<const Sensor> sensor, Interleave interleave);
+
+    static WriteResult writeFile(const Job& job);
+    static WriteResult writeEnviFile(const Job& job);
+
+public:
+    // capacity is the number of buffers that can wait for the disk at once
+    ImageWriter(size_t capacity);
+    // Writes all queued buffers before returning
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    // Takes ownership of data and returns immediately
+    // Returns false and leaves data untouched if the queue is full
+    // Existing files are kept unless overwrite is set, PACKED10 packs the samples on the writer thread
+    // An existing file is replaced as a whole, a MappedFile of it keeps its old contents
+    bool write(const std::string& filename, std::vector<uint16_t>&& data, bool overwrite = true, PixelFormat format = PixelFormat::RAW16);
+    // Pooled buffers go back to their pool once written
+    bool write(const std::string& filename, FrameBuffer&& data, bool overwrite = true, PixelFormat format = PixelFormat::RAW16);
+
+    // Same as write, but cube is streamed into an ENVI data file with interleave and a header is written next to it
+    bool writeCube(const std::string& filename, const Sensor& sensor, std::vector<uint16_t>&& cube, Interleave interleave, bool overwrite = true);
+    bool writeCube(const std::string& filename, const Sensor& sensor, FrameBuffer&& cube, Interleave interleave, bool overwrite = true);
+
+    // Retrieves the result of one finished write, returns false if there is none
+    bool pollResult(WriteResult& result);
+
+    // Blocks until every queued buffer is written
+    void flush();
+
+    size_t pending() const;
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+// ----- MappedFile -----
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+// The file must not be written in place while it is mapped, replace it instead like ImageWriter does
+class MappedFile {
+    const void* data_;
+    size_t size_;
+
+#ifdef _WIN32
+    void* file_handle_;
+    void* mapping_handle_;
+#endif
+
+public:
+    // Throws std::runtime_error if the file cannot be opened or mapped
+    MappedFile(const std::string& filepath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Getters
+    const void* data() const { return data_; }
+    size_t size() const { return size_; }
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "handler.hpp"
+#include "pipeline.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ----- CameraStats -----
+
+struct CameraStats {
+    uint64_t frames_acquired = 0;
+    uint64_t frames_processed = 0;
+    // Acquired while every slot of the camera was busy, only with drop_when_full
+    uint64_t frames_dropped = 0;
+    double processing_seconds = 0;
+};
+
+// ----- MultiCameraStats -----
+
+struct MultiCameraStats {
+    std::vector<CameraStats> cameras;
+    unsigned int workers = 0;
+    // Since MultiCamera was created
+    double seconds = 0;
+
+    uint64_t framesProcessed() const;
+    // Of all cameras together
+    double framesPerSecond() const { return seconds > 0 ? framesProcessed() / seconds : 0; }
+};
+
+// ----- CameraInput -----
+
+// One frame source of MultiCamera
+struct CameraInput {
+    std::string name;
+    // Calibration with the references of this camera, see Handler::makeCalibration
+    std::shared_ptr<const HandlerCalibration> calibration;
+    // Fills frame.raw, returns false when there are no more frames, called on the camera's own thread
+    Pipeline::AcquireFunction acquire;
+    PixelFormat format = PixelFormat::RAW16;
+};
+
+// ----- MultiCamera -----
+
+// Processes the frames of several cameras of one sensor type in one process.
+// The sensor, the OpenCL context with its programs and the correction matrices are shared through one Handler,
+// every camera only brings its own references. Each camera is acquired on its own thread into its own slots,
+// a pool of workers processes the frames. Workers serve the cameras round-robin with at most one frame per camera at a time,
+// so no camera starves the others, frames of a camera stay in order, and throughput grows with the cameras until every worker is busy.
+class MultiCamera {
+public:
+    // Called by the worker that processed frame, concurrently for different cameras but one frame at a time per camera, in acquisition order
+    // The frame is reused once this returns
+    using FrameFunction = std::function<void(size_t camera, PipelineFrame& frame)>;
+
+private:
+    struct Camera {
+        CameraInput input;
+        // The last frame is a spare, frames dropped right after acquisition are acquired into it
+        std::vector<std::unique_ptr<PipelineFrame>> frames;
+        std::vector<size_t> free;
+        // Acquired, oldest first
+        std::deque<size_t> ready;
+        bool processing = false;
+        bool acquisition_done = false;
+        CameraStats stats;
+        std::thread thread;
+    };
+
+    const Handler& handler_;
+    FrameFunction on_frame_;
+    bool drop_when_full_;
+
+    std::vector<std::unique_ptr<Camera>> cameras_;
+    std::vector<std::thread> workers_;
+
+    // Guards the queues and stats of every camera, only held to move slot indices
+    mutable std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable slot_freed_;
+    std::condition_variable frame_done_;
+    // Camera the round-robin search starts at
+    size_t next_camera_;
+    bool stop_;
+    std::exception_ptr error_;
+
+    std::chrono::steady_clock::time_point start_;
+
+    void runAcquisition(size_t index);
+    void runWorker();
+    // Called with mutex_ held
+    bool takeFrame(size_t& camera, size_t& slot);
+    bool acquisitionDone() const;
+    void fail(std::exception_ptr error);
+
+public:
+    // frame_size is the size of PipelineFrame::raw, every camera gets slots frames
+    // With drop_when_full acquisition never waits, frames acquired while every slot of their camera is busy are discarded, e.g. for live cameras
+    // workers of 0 uses every hardware thread
+    // Throws std::runtime_error without cameras, if a camera has no calibration or slots is 0
+    MultiCamera(const Handler& handler, size_t frame_size, std::vector<CameraInput> cameras, FrameFunction on_frame,
+                unsigned int workers = 0, size_t slots = 2, bool drop_when_full = false);
+    // Stops the cameras
+    ~MultiCamera();
+
+    MultiCamera(const MultiCamera&) = delete;
+    MultiCamera& operator=(const MultiCamera&) = delete;
+
+    // Waits until every camera ran out of frames and every frame was processed
+    // Rethrows the first exception of an acquisition, processing or on_frame
+    void wait();
+
+    // Stops acquisition and waits for every thread, frames not processed yet are discarded
+    void stop();
+
+    size_t cameras() const { return cameras_.size(); }
+    unsigned int workers() const { return static_cast<unsigned int>(workers_.size()); }
+    const std::string& name(size_t camera) const { return cameras_.at(camera)->input.name; }
+    MultiCameraStats stats() const;
+};
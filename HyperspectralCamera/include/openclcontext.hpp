@@ -0,0 +1,83 @@
+#pragma once
+
+#include <CL/cl.hpp>
+
+#include "sensor.hpp"
+
+#include <vector>
+
+// ----- DeviceFission -----
+
+// Partitioning of a CPU OpenCL device into one sub-device that leaves some compute units to the host.
+// Every kernel runs on the whole sub-device, so the stages of a frame still use all of its compute units.
+// Ignored on GPU devices and on CPU devices that cannot be partitioned by counts.
+struct DeviceFission {
+    bool enabled = false;
+    // Compute units left to the host, e.g. for the XIMEA acquisition thread
+    unsigned int reserved_compute_units = 0;
+};
+
+// ----- OpenCLKernels -----
+
+// Kernels of the Handler stages. Arguments are set on every call, so a set of kernels must only be used by one thread at a time,
+// every thread processing frames creates its own with OpenCLContext::createKernels.
+struct OpenCLKernels {
+    cl::Kernel convert_to_cube_and_reflection_correction;
+    cl::Kernel convert_to_cube_and_reflection_correction_local;
+    cl::Kernel convert_to_cube_and_reflection_correction_vector;
+    cl::Kernel spectral_correction;
+    cl::Kernel spectral_correction_vector;
+    cl::Kernel spectral_correction_multiple;
+    cl::Kernel offset_correction;
+    cl::Kernel offset_correction_packed;
+    cl::Kernel get_one_band_and_colourmap;
+};
+
+// ----- OpenCLContext -----
+
+// Device, programs and buffers shared by the OpenCL backends of Handler.
+// Created only when an OpenCL backend is requested, read-only afterwards, so it may be used by several threads at once.
+class OpenCLContext {
+    Sensor sensor_;
+
+    cl::Device device_;
+    // device_, or its sub-device if it is partitioned
+    cl::Device compute_device_;
+    cl::Context context_;
+    bool cpu_device_;
+
+    cl::Program convert_to_cube_and_reflection_correction_program_;
+    cl::Program spectral_correction_program_;
+    cl::Program offset_correction_program_;
+    cl::Program get_one_band_and_colourmap_program_;
+
+    // One device buffer per correction matrix, and all of them back to back for SpectralCorrectionMultiple
+    std::vector<cl::Buffer> correction_matrix_buffers_;
+    cl::Buffer correction_matrices_buffer_;
+
+    // Leaves compute_device_ unchanged if the device cannot be partitioned
+    void createSubDevice(const DeviceFission& fission);
+    cl::Program buildProgram(const std::string& file, const std::string& name) const;
+    cl::Kernel createKernel(const cl::Program& program, const std::string& name) const;
+
+public:
+    // Selects the first device of device_type over all platforms,
+    // if allow_fallback is set and no such device exists any CPU device is used instead
+    OpenCLContext(const Sensor& sensor, cl_device_type device_type, bool allow_fallback, const DeviceFission& fission = {});
+
+    // Getters
+    const cl::Device& device() const { return device_; }
+    const cl::Context& context() const { return context_; }
+    bool isCpuDevice() const { return cpu_device_; }
+    // Buffer of Sensor::correctionMatrix(index)
+    const cl::Buffer& correctionMatrixBuffer(size_t index) const { return correction_matrix_buffers_.at(index); }
+    const cl::Buffer& correctionMatricesBuffer() const { return correction_matrices_buffer_; }
+
+    // Explicitly vectorized kernels are preferred on CPU devices
+    bool useVectorKernels() const { return cpu_device_ && sensor_.numberOfBands() <= KERNEL_MAX_NUMBER_OF_BANDS; }
+
+    // New kernels of the built programs, programs are only built once
+    OpenCLKernels createKernels() const;
+    // New in-order queue on the device, every thread processing frames uses its own, so frames of different threads do not wait for each other
+    cl::CommandQueue createQueue() const;
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "handler.hpp"
+#include "image.hpp"
+#include "sensor.hpp"
+#include "spscring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ----- PipelineFrame -----
+
+// Slot passed from stage to stage, allocated once when the pipeline is created
+struct PipelineFrame {
+    // Sensor frame as acquired, frame_size bytes
+    std::vector<uint8_t> raw;
+    // Corrected frame
+    Image image;
+    // Colourmapped band for presentation
+    std::vector<uint16_t> pixels;
+
+    // Acquisition order, starting at 0, gaps are dropped frames
+    uint64_t sequence = 0;
+    std::chrono::steady_clock::time_point acquired_at;
+    ProcessingTimes times;
+    double colourmap_time = 0;
+
+    // Set by asynchronous processing once the frame is done, see Pipeline frames_in_flight
+    std::atomic<bool> processed = false;
+};
+
+// ----- PipelineStats -----
+
+struct PipelineStats {
+    uint64_t frames_acquired = 0;
+    uint64_t frames_processed = 0;
+    uint64_t frames_presented = 0;
+    // Acquired frames discarded by the backpressure policy
+    uint64_t frames_dropped = 0;
+
+    // Frames waiting for correction / presentation, approximate while running
+    size_t acquired_queue_depth = 0;
+    size_t processed_queue_depth = 0;
+    size_t max_acquired_queue_depth = 0;
+
+    // From the end of acquisition to presentation
+    double latency_seconds = 0;
+    double max_latency_seconds = 0;
+
+    // Busy time of each stage, time spent waiting for a slot is not included
+    double acquisition_seconds = 0;
+    double processing_seconds = 0;
+    double presentation_seconds = 0;
+    // Since the pipeline was created
+    double seconds = 0;
+
+    double framesPerSecond() const { return seconds > 0 ? frames_presented / seconds : 0; }
+    double averageLatency() const { return frames_presented > 0 ? latency_seconds / frames_presented : 0; }
+};
+
+// ----- Pipeline -----
+
+// Runs acquisition and correction on dedicated threads, presentation on the thread calling present.
+// Stages are connected by lock-free single-producer / single-consumer rings of slot indices,
+// every slot travels free -> acquired -> processed -> free, so frames are never copied or allocated.
+// With at least one slot per stage the throughput is limited by the slowest stage instead of the sum of the stages.
+// When correction falls behind, the backpressure policy decides which frames are discarded,
+// with any policy but BLOCK acquisition never waits, so the camera is drained and the lag stays bounded by the slots.
+class Pipeline {
+public:
+    // Fills frame.raw, returns false when there are no more frames
+    using AcquireFunction = std::function<bool(PipelineFrame& frame)>;
+    using ProcessFunction = std::function<void(PipelineFrame& frame)>;
+    using Command = std::function<void()>;
+
+private:
+    // The last frame is a spare, frames discarded right after acquisition are acquired into it
+    std::vector<std::unique_ptr<PipelineFrame>> frames_;
+    size_t spare_slot_;
+
+    BackpressurePolicy policy_;
+    unsigned int every_nth_;
+    size_t frames_in_flight_;
+
+    // Every ring can hold every slot, so pushing never fails
+    SpscRing<size_t> free_;
+    SpscRing<size_t> acquired_;
+    SpscRing<size_t> processed_;
+
+    // BackpressurePolicy::DROP_OLDEST passes frames through a single slot mailbox instead of acquired_,
+    // acquisition swaps in the newest frame and takes back the one correction did not get to
+    std::atomic<size_t> latest_;
+
+    AcquireFunction acquire_;
+    ProcessFunction process_;
+
+    std::atomic<bool> stop_;
+    std::atomic<bool> acquisition_done_;
+    std::atomic<bool> processing_done_;
+
+    // Run by the processing thread between two frames
+    std::mutex commands_mutex_;
+    std::vector<Command> commands_;
+    std::atomic<bool> commands_pending_;
+
+    // First exception of a stage thread, rethrown by present
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+
+    // Each counter is written by one stage only
+    std::atomic<uint64_t> frames_acquired_;
+    std::atomic<uint64_t> frames_processed_;
+    std::atomic<uint64_t> frames_presented_;
+    std::atomic<uint64_t> frames_dropped_;
+    std::atomic<size_t> max_acquired_queue_depth_;
+    std::atomic<uint64_t> latency_ns_;
+    std::atomic<uint64_t> max_latency_ns_;
+    std::atomic<uint64_t> acquisition_ns_;
+    std::atomic<uint64_t> processing_ns_;
+    std::atomic<uint64_t> presentation_ns_;
+    std::chrono::steady_clock::time_point start_;
+
+    // Slot held by the caller of present
+    bool presenting_;
+    size_t presented_slot_;
+    std::chrono::steady_clock::time_point presented_at_;
+
+    std::thread acquisition_thread_;
+    std::thread processing_thread_;
+
+    void runAcquisition();
+    void runProcessing();
+    bool takeAcquired(size_t& slot);
+    void runCommands();
+    void fail(std::exception_ptr error);
+
+public:
+    // frame_size is the size of PipelineFrame::raw, slots are shared by all stages
+    // every_nth is only used by BackpressurePolicy::EVERY_NTH
+    // With more than 1 frame in flight process only starts processing, e.g. with TileScheduler::submit,
+    // and the frame is handed on once its processed flag is set, frames stay in acquisition order
+    // Throws std::runtime_error if there are fewer than 2 slots, every_nth is 0 or frames_in_flight is 0
+    Pipeline(const Sensor& sensor, size_t frame_size, size_t slots, AcquireFunction acquire, ProcessFunction process,
+             BackpressurePolicy policy = BackpressurePolicy::BLOCK, unsigned int every_nth = 1, size_t frames_in_flight = 1);
+    // Stops the pipeline
+    ~Pipeline();
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // Waits up to timeout for the next processed frame, nullptr on timeout or once finished
+    // The frame stays valid until the next call, then its slot is handed back to acquisition
+    // Rethrows the exception of a failed stage
+    PipelineFrame* present(std::chrono::milliseconds timeout);
+
+    // Acquisition has ended and every frame was presented
+    bool finished() const;
+
+    // Runs command on the processing thread before the next frame is processed, e.g. to change Handler settings
+    // The frame returned by the last present is not overwritten before the commands posted while presenting it ran,
+    // so they may read it without copying
+    void runBetweenFrames(Command command);
+
+    // Stops acquisition and waits for both threads, frames still in flight are discarded
+    // Commands that did not run yet are run by the caller
+    void stop();
+
+    PipelineStats stats() const;
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ----- RecorderStats -----
+
+struct RecorderStats {
+    uint64_t frames_recorded = 0;
+    uint64_t frames_dropped = 0;
+    uint64_t bytes_written = 0;
+    double seconds = 0;
+
+    double megabytesPerSecond() const { return seconds > 0 ? bytes_written / seconds / (1024 * 1024) : 0; }
+};
+
+// ----- Recorder -----
+
+// Appends frames to one file at camera rate.
+// Frames are copied into a preallocated ring of aligned chunks, full chunks are written with unbuffered
+// I/O (O_DIRECT / FILE_FLAG_NO_BUFFERING) by several writer threads, so several writes are in flight.
+// When the ring is full the frame is dropped instead of blocking the caller.
+class Recorder {
+    enum class ChunkState {
+        FREE,
+        FILLING,
+        QUEUED
+    };
+
+    struct Chunk {
+        char* data;
+        uint64_t file_offset;
+        size_t size;
+        ChunkState state;
+    };
+
+    std::string filename_;
+    PixelFormat format_;
+    size_t frame_samples_;
+    // Stored bytes per frame
+    size_t frame_size_;
+    size_t chunk_size_;
+
+    // Packed frame before it is copied into the ring
+    std::vector<uint8_t> packed_frame_;
+
+#ifdef _WIN32
+    void* file_;
+#else
+    int file_;
+#endif
+
+    std::vector<Chunk> chunks_;
+    std::deque<size_t> queue_;
+    std::vector<std::thread> writers_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable chunk_queued_;
+    bool stop_;
+    bool error_;
+
+    // Producer side, only touched by record
+    size_t current_chunk_;
+    size_t current_fill_;
+    uint64_t next_file_offset_;
+    uint64_t recorded_size_;
+
+    RecorderStats stats_;
+    std::chrono::steady_clock::time_point start_;
+
+    bool append(const void* frame, size_t size, bool pack);
+    void queueChunk(size_t chunk_index);
+    void runWriter();
+    bool writeChunk(const Chunk& chunk);
+
+public:
+    // frame_size is in bytes, ring_size is rounded up to whole chunks and must hold at least two frames
+    // PACKED10 treats frames as 16-bit samples and stores them 10-bit packed
+    // Throws std::runtime_error if the file cannot be created
+    Recorder(const std::string& filename, size_t frame_size, size_t ring_size, unsigned int writes_in_flight, PixelFormat format = PixelFormat::RAW16);
+    // Stops if still recording
+    ~Recorder();
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    // Copies one frame of frame_size bytes into the ring, never blocks
+    // Packed frames take 5 / 8 of the ring and disk bandwidth
+    // Returns false if the frame was dropped because the disk does not keep up
+    bool record(const void* frame);
+    // Variable sized frame of at most frame_size bytes stored as is, e.g. an encoded cube
+    bool record(const void* data, size_t size);
+
+    // Writes the remaining data, waits for every write and trims the file to the recorded data
+    RecorderStats stop();
+
+    RecorderStats stats() const;
+    bool isRecording() const;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "mappedfile.hpp"
+#include "sensor.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ----- ReplaySource -----
+
+// Streams recorded raw sensor frames (sensor width x height, same layout as the XIMEA buffer) in place of the camera.
+// path is either one file of frames stored back to back, e.g. a raw recording of Recorder,
+// or a directory whose .raw files are replayed in name order.
+// Files are memory mapped, 16-bit frames are handed out without copying.
+class ReplaySource {
+    std::vector<std::string> files_;
+    PixelFormat format_;
+    size_t frame_samples_;
+    // Stored bytes per frame
+    size_t frame_size_;
+    double frame_rate_;
+    bool loop_;
+
+    std::unique_ptr<MappedFile> file_;
+    size_t file_index_;
+    size_t frame_index_;
+    size_t frames_in_file_;
+
+    // Unpacked PACKED10 frame
+    std::vector<uint16_t> unpacked_;
+
+    uint64_t frames_delivered_;
+    std::chrono::steady_clock::time_point start_;
+
+    void openFile(size_t file_index);
+
+public:
+    // frame_rate of 0 replays as fast as the caller consumes frames
+    // loop restarts at the first frame after the last one
+    // Throws std::runtime_error if path does not exist or holds no frames
+    ReplaySource(const std::string& path, const Sensor& sensor, PixelFormat format = PixelFormat::RAW16, double frame_rate = 0, bool loop = false);
+
+    // Next frame, valid until the following call, nullptr after the last frame
+    // With a frame rate, waits until the frame is due
+    // Throws std::runtime_error if a file is not a whole number of frames
+    const uint16_t* next();
+
+    uint64_t framesDelivered() const { return frames_delivered_; }
+    // Since the first frame
+    double seconds() const;
+    double framesPerSecond() const;
+};
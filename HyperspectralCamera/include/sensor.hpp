@@ -2,8 +2,15 @@
 
 #include "common.hpp"
 
+#include <string>
 #include <vector>
 
+// Named bands x bands matrix of the calibration file
+struct CorrectionMatrix {
+    std::string name;
+    std::vector<float> coefficients;
+};
+
 class Sensor {
     // Attributes
     LayoutType layout_type_;
@@ -23,6 +30,10 @@ class Sensor {
     unsigned int number_of_bands_;
     std::vector<float> coefficients_;
 
+    // Every correction matrix of the calibration file, coefficients_ is a copy of the default one
+    std::vector<CorrectionMatrix> correction_matrices_;
+    size_t default_correction_matrix_;
+
 public:
     Sensor();
 
@@ -41,6 +52,15 @@ public:
     unsigned int spatialHeight() const { return spatial_height_; }
     unsigned int numberOfBands() const { return number_of_bands_; }
     const std::vector<float>& coefficients() const { return coefficients_; }
+    const std::vector<CorrectionMatrix>& correctionMatrices() const { return correction_matrices_; }
+    size_t defaultCorrectionMatrix() const { return default_correction_matrix_; }
+
+    // A sensor without named matrices has one, its coefficients
+    size_t numberOfCorrectionMatrices() const { return correction_matrices_.empty() ? 1 : correction_matrices_.size(); }
+    // Throws std::runtime_error if index is out of range
+    const std::vector<float>& correctionMatrix(size_t index) const;
+    // Throws std::runtime_error if there is no matrix called name
+    size_t correctionMatrixIndex(const std::string& name) const;
 
     // Setters
     void setLayoutType(LayoutType layout_type) { layout_type_ = layout_type; }
@@ -57,4 +77,6 @@ public:
     void setSpatialHeight(unsigned int spatial_height) { spatial_height_ = spatial_height; }
     void setNumberOfBands(unsigned int number_of_bands) { number_of_bands_ = number_of_bands; }
     std::vector<float>& mutableCoefficients() { return coefficients_; }
+    std::vector<CorrectionMatrix>& mutableCorrectionMatrices() { return correction_matrices_; }
+    void setDefaultCorrectionMatrix(size_t index) { default_correction_matrix_ = index; }
 };
\ No newline at end of file
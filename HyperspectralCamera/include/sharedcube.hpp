@@ -0,0 +1,74 @@
+#pragma once
+
+#include "sensor.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define SHARED_CUBE_MAGIC 0x42554353
+#define SHARED_CUBE_VERSION 1
+
+// ----- SharedCubeHeader -----
+
+// Start of the shared memory, followed by the BIP cube of the latest frame
+struct SharedCubeHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t spatial_width;
+    uint32_t spatial_height;
+    uint32_t number_of_bands;
+    uint32_t reserved;
+    // Odd while a frame is being written, the frames published so far are sequence / 2
+    std::atomic<uint64_t> sequence;
+    uint64_t frame_number;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "SharedCube needs a lock-free sequence to share it between processes");
+
+// ----- SharedCube -----
+
+// Latest corrected cube in named shared memory, so other processes on the node can consume frames without files.
+// One process publishes, any number of processes read. Readers never block the publisher,
+// a read that overlaps a publish is detected through the sequence and retried.
+class SharedCube {
+    std::string name_;
+    bool owner_;
+    SharedCubeHeader* header_;
+    uint16_t* cube_;
+    size_t cube_size_;
+    size_t size_;
+
+#ifdef _WIN32
+    void* mapping_handle_;
+#endif
+
+    void map(bool create);
+    void unmap();
+
+public:
+    // Creates the shared memory name sized for the cube of sensor, it is removed again on destruction
+    // Throws std::runtime_error if it cannot be created
+    SharedCube(const std::string& name, const Sensor& sensor);
+    // Opens the shared memory name created by another SharedCube, read only
+    // Throws std::runtime_error if it does not exist or is not a shared cube
+    SharedCube(const std::string& name);
+    ~SharedCube();
+
+    SharedCube(const SharedCube&) = delete;
+    SharedCube& operator=(const SharedCube&) = delete;
+
+    // cube holds spatial width x spatial height x bands samples
+    // Throws std::runtime_error if the shared memory was opened read only
+    void publish(const uint16_t* cube, uint64_t frame_number);
+
+    // Copies the latest cube, returns false if nothing was published yet
+    bool read(std::vector<uint16_t>& cube, uint64_t* frame_number = nullptr) const;
+
+    uint64_t framesPublished() const { return header_->sequence.load(std::memory_order_acquire) / 2; }
+    size_t cubeSize() const { return cube_size_; }
+    unsigned int spatialWidth() const { return header_->spatial_width; }
+    unsigned int spatialHeight() const { return header_->spatial_height; }
+    unsigned int numberOfBands() const { return header_->number_of_bands; }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+// Keeps the producer and consumer indices on separate cache lines
+#define SPSC_CACHE_LINE_SIZE 64
+
+// ----- SpscRing -----
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Indices only grow, the slot of an index is index & mask, so a full ring needs no extra empty slot.
+// Each side keeps a cached copy of the other side's index and only reloads it when the ring looks full / empty.
+template <typename T>
+class SpscRing {
+    std::vector<T> slots_;
+    size_t mask_;
+
+    // Consumer side
+    alignas(SPSC_CACHE_LINE_SIZE) std::atomic<size_t> head_;
+    size_t cached_tail_;
+
+    // Producer side
+    alignas(SPSC_CACHE_LINE_SIZE) std::atomic<size_t> tail_;
+    size_t cached_head_;
+
+public:
+    // capacity is rounded up to a power of two
+    // Throws std::runtime_error if capacity is 0
+    explicit SpscRing(size_t capacity)
+        : head_(0)
+        , cached_tail_(0)
+        , tail_(0)
+        , cached_head_(0) {
+        if (capacity == 0) {
+            throw std::runtime_error("SpscRing capacity must not be 0");
+        }
+
+        size_t size = 1;
+
+        while (size < capacity) {
+            size <<= 1;
+        }
+
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    size_t capacity() const { return slots_.size(); }
+
+    // Only exact while neither side is running
+    size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+
+    // Producer only, returns false if the ring is full
+    bool tryPush(const T& value) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail - cached_head_ == slots_.size()) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+
+            if (tail - cached_head_ == slots_.size()) {
+                return false;
+            }
+        }
+
+        slots_[tail & mask_] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Consumer only, returns false if the ring is empty
+    bool tryPop(T& value) {
+        auto head = head_.load(std::memory_order_relaxed);
+
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+
+            if (head == cached_tail_) {
+                return false;
+            }
+        }
+
+        value = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+};
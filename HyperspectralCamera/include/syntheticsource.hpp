@@ -0,0 +1,83 @@
+#pragma once
+
+#include "image.hpp"
+#include "sensor.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// ----- SyntheticGeometry -----
+
+// Mosaic sensor layout, the sensor is the active area plus offset_x / offset_y on every side
+struct SyntheticGeometry {
+    unsigned int pattern_width;
+    unsigned int pattern_height;
+    unsigned int spatial_width;
+    unsigned int spatial_height;
+    unsigned int offset_x = 0;
+    unsigned int offset_y = 0;
+};
+
+// ----- SyntheticOptions -----
+
+struct SyntheticOptions {
+    // Levels of the references, in sensor digital numbers
+    uint16_t dark_level = 64;
+    uint16_t white_level = 960;
+    // Standard deviation of the noise added to every pixel of a frame
+    double noise = 4;
+    // Pixels stuck at the maximum value, the same in every frame
+    double hot_pixel_fraction = 0.0005;
+    // Distinct noisy frames, handed out in turn so that generating frames costs nothing while measuring
+    size_t variants = 4;
+    // 0 generates frames as fast as the caller consumes them
+    double frame_rate = 0;
+    // 0 never runs out of frames
+    uint64_t frames = 0;
+    unsigned int seed = 1;
+};
+
+// ----- SyntheticSource -----
+
+// Generates raw sensor frames (sensor width x height, 16-bit) of a mosaic sensor in place of the camera,
+// e.g. to measure the throughput of geometries, band counts and sensor sizes there is no camera for.
+// Every spatial pixel has a smooth spectrum whose peak moves across the image and whose brightness falls towards the bottom,
+// so the corrected cube of a noise-free frame with an identity correction matrix is reflectance() * PIXEL_MAX.
+class SyntheticSource {
+    Sensor sensor_;
+    SyntheticOptions options_;
+
+    std::vector<std::vector<uint16_t>> frames_;
+    size_t frame_index_;
+
+    uint64_t frames_delivered_;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    // Throws std::runtime_error if the sensor is not a mosaic of at least one band, the active area does not fit the sensor
+    // or the white level is not above the dark level
+    SyntheticSource(const Sensor& sensor, const SyntheticOptions& options = SyntheticOptions());
+
+    // 10-bit mosaic sensor of geometry with an identity correction matrix
+    static Sensor makeSensor(const SyntheticGeometry& geometry);
+
+    // Reflectance of band at spatial pixel (x, y), 0 to 1
+    double reflectance(unsigned int x, unsigned int y, unsigned int band) const;
+
+    // Active area references matching the generated frames
+    Image darkReference() const;
+    Image whiteReference() const;
+
+    const Sensor& sensor() const { return sensor_; }
+    size_t frameSize() const;
+
+    // Next frame, valid until the frame is handed out again variants calls later, nullptr after the last frame
+    // With a frame rate, waits until the frame is due
+    const uint16_t* next();
+
+    uint64_t framesDelivered() const { return frames_delivered_; }
+    // Since the first frame
+    double seconds() const;
+    double framesPerSecond() const;
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "handler.hpp"
+#include "image.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ----- TileSchedulerStats -----
+
+struct TileSchedulerStats {
+    uint64_t frames = 0;
+    uint64_t tasks = 0;
+    // Tasks a worker took from another worker's queue
+    uint64_t steals = 0;
+
+    // Time workers spent running tasks and since the scheduler was created
+    double busy_seconds = 0;
+    double seconds = 0;
+    unsigned int workers = 0;
+
+    // Share of the workers' time spent running tasks, 0 to 1
+    double utilization() const { return seconds > 0 && workers > 0 ? busy_seconds / (seconds * workers) : 0; }
+};
+
+// ----- TileScheduler -----
+
+// Runs the C++ stages of Handler on a pool of workers, with several frames in flight at once.
+// Every frame is split into tiles of tile_rows macro-pixel rows, the unit of work is one stage of one tile:
+// offset correction, conversion to cube with reflection correction, spectral correction and colourmap.
+// A finished task queues the next stage of its tile at the front of its worker's queue, so a tile stays in that worker's cache.
+// Every worker takes tasks from the front of its own queue, frames in submission order, idle workers steal from the back of the others,
+// i.e. tiles of the next frame, so no worker waits at a frame boundary while another still has tiles.
+class TileScheduler {
+public:
+    // Called once per frame by the worker that finished its last task, also when a task failed
+    using DoneFunction = std::function<void()>;
+
+private:
+    enum class TileStage {
+        OFFSET_CORRECTION = 0,
+        CONVERT_TO_CUBE_AND_REFLECTION_CORRECTION = 1,
+        SPECTRAL_CORRECTION = 2,
+        COLOURMAP = 3
+    };
+
+    struct FrameState {
+        const void* input = nullptr;
+        PixelFormat format = PixelFormat::RAW16;
+        Image* image = nullptr;
+        // Output of spectral correction, swapped into image when the frame is done
+        Image spectral;
+        std::vector<uint16_t>* pixels = nullptr;
+        unsigned int band = 0;
+        // Every tile of a frame uses the calibration of its submission
+        std::shared_ptr<const HandlerCalibration> calibration;
+        DoneFunction done;
+        std::atomic<size_t> remaining_tiles;
+    };
+
+    struct Task {
+        size_t frame;
+        size_t tile;
+        TileStage stage;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+        std::atomic<uint64_t> busy_ns;
+        std::atomic<uint64_t> tasks_run;
+        std::atomic<uint64_t> steals;
+    };
+
+    const Handler& handler_;
+    Sensor sensor_;
+    unsigned int tile_rows_;
+    size_t tiles_;
+
+    std::vector<std::unique_ptr<FrameState>> frames_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    // Free frame states, taken by submit
+    std::mutex frames_mutex_;
+    std::condition_variable frame_freed_;
+    std::vector<size_t> free_frames_;
+    size_t next_worker_;
+
+    // Sleeping workers wait for queued tasks
+    std::mutex sleep_mutex_;
+    std::condition_variable work_available_;
+    std::atomic<size_t> queued_;
+    std::atomic<bool> stop_;
+
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+
+    std::atomic<uint64_t> frames_done_;
+    std::chrono::steady_clock::time_point start_;
+
+    void runWorker(size_t index);
+    bool takeTask(size_t index, Task& task);
+    // next_stage tasks are run next by the worker, other tasks queue behind its tiles
+    void push(size_t worker, const Task& task, bool next_stage);
+    void run(size_t worker, const Task& task);
+    void finishTile(size_t frame);
+    void rethrow();
+
+public:
+    // workers of 0 uses every hardware thread, frames_in_flight frames are processed at once
+    // Throws std::runtime_error if tile_rows or frames_in_flight is 0
+    TileScheduler(const Handler& handler, unsigned int workers, unsigned int tile_rows, size_t frames_in_flight);
+    // Waits for the submitted frames
+    ~TileScheduler();
+
+    TileScheduler(const TileScheduler&) = delete;
+    TileScheduler& operator=(const TileScheduler&) = delete;
+
+    // Processes input (sensor frame of format) into image like Handler::process, then colourmaps band into pixels unless pixels is nullptr
+    // input, image and pixels must stay valid until done was called
+    // Waits while frames_in_flight frames are in flight
+    // Rethrows the first exception of a task
+    void submit(const void* input, PixelFormat format, Image& image, std::vector<uint16_t>* pixels, unsigned int band, DoneFunction done);
+
+    // Waits until every submitted frame is done, rethrows the first exception of a task
+    void wait();
+
+    unsigned int workers() const { return static_cast<unsigned int>(workers_.size()); }
+    size_t tiles() const { return tiles_; }
+    TileSchedulerStats stats() const;
+};
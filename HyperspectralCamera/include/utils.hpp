@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <string_view>
 #include <vector>
 
 // ----- Class forwards -----
@@ -13,9 +14,12 @@ enum class LayoutType;
 class Utils {
 public:
     static LayoutType getLayoutType(const std::string& layout_type_text);
+    static std::string getLayoutTypeText(LayoutType layout_type);
     static bool getBool(const std::string& bool_text);
-    static bool isCharValid(char c);
-    static bool parseFloatArray(std::vector<float>& output, const std::string& array_text);
+    // Appends the numbers of array_text, separated by whitespace and / or a single ',' or ';'
+    // Nothing but the output is allocated, array_text can point straight into the XML buffer
+    // On failure error_offset is set to the byte offset of the error within array_text
+    static bool parseFloatArray(std::vector<float>& output, std::string_view array_text, size_t* error_offset = nullptr);
     static bool doesFileExist(const std::string& filepath);
     static std::string getTimeStamp();
 };
@@ -0,0 +1,106 @@
+#include "bitpacking.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// SSSE3 is assumed on every x64 host running MSVC builds
+#if defined(__SSSE3__) || (defined(_MSC_VER) && defined(_M_X64))
+#define BIT_PACKING_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#define PACKED_BITS 10
+#define PACKED_MASK 0x3FF
+
+namespace {
+    // Generic path for the samples the SIMD loop leaves over
+    // A 10-bit sample starts at an even bit, so it always spans at most two bytes
+    void packScalar(const uint16_t* input, size_t first, size_t samples, uint8_t* output) {
+        for (size_t i = first; i < samples; i++) {
+            auto bit = i * PACKED_BITS;
+            auto value = static_cast<uint32_t>(input[i] & PACKED_MASK) << (bit % 8);
+            auto byte = output + bit / 8;
+
+            byte[0] |= static_cast<uint8_t>(value);
+            byte[1] |= static_cast<uint8_t>(value >> 8);
+        }
+    }
+
+    uint16_t unpackSample(const uint8_t* input, size_t index) {
+        auto bit = index * PACKED_BITS;
+        auto byte = input + bit / 8;
+        uint32_t value = byte[0] | (static_cast<uint32_t>(byte[1]) << 8);
+
+        return static_cast<uint16_t>((value >> (bit % 8)) & PACKED_MASK);
+    }
+
+    void unpackScalar(const uint8_t* input, size_t first, size_t samples, uint16_t* output) {
+        for (size_t i = first; i < samples; i++) {
+            output[i] = unpackSample(input, i);
+        }
+    }
+}
+
+size_t BitPacking::packedSize(size_t samples) {
+    return (samples * PACKED_BITS + 7) / 8;
+}
+
+void BitPacking::pack10(const uint16_t* input, size_t samples, uint8_t* output) {
+    size_t i = 0;
+
+#ifdef BIT_PACKING_SSSE3
+    // 8 samples into 10 bytes per iteration
+    // Samples are shifted into place within their 16-bit lane, then low and high bytes are gathered and merged
+    const auto mask = _mm_set1_epi16(PACKED_MASK);
+    const auto shift = _mm_setr_epi16(1, 4, 16, 64, 1, 4, 16, 64);
+    const auto low_bytes = _mm_setr_epi8(0, 2, 4, 6, -1, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1);
+    const auto high_bytes = _mm_setr_epi8(-1, 1, 3, 5, 7, -1, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1);
+
+    for (; i + 8 <= samples; i += 8) {
+        auto values = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i)), mask);
+        values = _mm_mullo_epi16(values, shift);
+
+        auto packed = _mm_or_si128(_mm_shuffle_epi8(values, low_bytes), _mm_shuffle_epi8(values, high_bytes));
+
+        alignas(16) uint8_t bytes[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(bytes), packed);
+        std::memcpy(output + i / 8 * PACKED_BITS, bytes, PACKED_BITS);
+    }
+#endif
+
+    // Remaining samples are ORed into a cleared tail
+    std::memset(output + i / 8 * PACKED_BITS, 0, packedSize(samples) - i / 8 * PACKED_BITS);
+    packScalar(input, i, samples, output);
+}
+
+void BitPacking::unpack10(const uint8_t* input, size_t samples, uint16_t* output) {
+    size_t i = 0;
+
+#ifdef BIT_PACKING_SSSE3
+    // 8 samples from 10 bytes per iteration, 16 bytes are loaded so the last group is left to the scalar path
+    // Every lane gets the two bytes holding its sample, the sample is moved to the top of the lane and shifted down
+    const auto spread = _mm_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9);
+    const auto shift = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+    const auto packed_size = packedSize(samples);
+
+    for (; i + 8 <= samples && i / 8 * PACKED_BITS + 16 <= packed_size; i += 8) {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i / 8 * PACKED_BITS));
+        auto values = _mm_mullo_epi16(_mm_shuffle_epi8(bytes, spread), shift);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_srli_epi16(values, 16 - PACKED_BITS));
+    }
+#endif
+
+    unpackScalar(input, i, samples, output);
+}
+
+void BitPacking::unpack10(const uint8_t* input, size_t first_sample, size_t samples, uint16_t* output) {
+    // Every 4 samples start on a byte boundary, unpack up to the next one and continue from there
+    size_t head = std::min(samples, (4 - first_sample % 4) % 4);
+
+    for (size_t i = 0; i < head; i++) {
+        output[i] = unpackSample(input, first_sample + i);
+    }
+
+    unpack10(input + (first_sample + head) / 4 * 5, samples - head, output + head);
+}
@@ -0,0 +1,292 @@
+#include "calibrationcache.hpp"
+
+#include "mappedfile.hpp"
+#include "xmlparser.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+// Increment whenever the layout below or the contents of Sensor change
+#define CALIBRATION_CACHE_VERSION 2
+
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+namespace {
+    const char cache_magic[4] = { 'H', 'S', 'C', 'B' };
+
+    struct CacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t hash;
+        int64_t modification_time;
+        uint64_t size;
+
+        // Geometry in the order of the Sensor attributes
+        uint32_t layout_type;
+        uint32_t bpp;
+        uint32_t sensor_width;
+        uint32_t sensor_height;
+        uint32_t offset_x;
+        uint32_t offset_y;
+        uint32_t active_area_width;
+        uint32_t active_area_height;
+        uint32_t pattern_width;
+        uint32_t pattern_height;
+        uint32_t spatial_width;
+        uint32_t spatial_height;
+        uint32_t number_of_bands;
+
+        // Followed by the coefficients
+        uint32_t number_of_coefficients;
+
+        // Followed by every correction matrix as name length, name, number of coefficients and coefficients
+        uint32_t number_of_correction_matrices;
+        uint32_t default_correction_matrix;
+    };
+
+    // Reads a uint32_t at offset, false if it does not fit in size
+    bool readUint32(const std::vector<char>& buffer, size_t& offset, uint32_t& value) {
+        if (buffer.size() - offset < sizeof(value)) {
+            return false;
+        }
+
+        std::memcpy(&value, buffer.data() + offset, sizeof(value));
+        offset += sizeof(value);
+
+        return true;
+    }
+
+    bool readFloats(const std::vector<char>& buffer, size_t& offset, std::vector<float>& values, uint32_t count) {
+        if ((buffer.size() - offset) / sizeof(float) < count) {
+            return false;
+        }
+
+        values.resize(count);
+        std::memcpy(values.data(), buffer.data() + offset, sizeof(float) * values.size());
+        offset += sizeof(float) * values.size();
+
+        return true;
+    }
+
+    void writeUint32(std::ofstream& file, uint32_t value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+}
+
+// ----- CalibrationCache -----
+
+std::string CalibrationCache::cacheFilename(const std::string& xml_file) {
+    return xml_file + ".cache";
+}
+
+CalibrationCacheKey CalibrationCache::key(const std::string& xml_file) {
+    auto key = fileKey(xml_file);
+
+    // FNV-1a over the whole file
+    MappedFile file(xml_file);
+    auto data = static_cast<const uint8_t*>(file.data());
+
+    key.hash = FNV_OFFSET_BASIS;
+
+    for (size_t i = 0; i < file.size(); i++) {
+        key.hash = (key.hash ^ data[i]) * FNV_PRIME;
+    }
+
+    return key;
+}
+
+CalibrationCacheKey CalibrationCache::fileKey(const std::string& xml_file) {
+    CalibrationCacheKey key;
+    std::error_code error;
+
+    key.size = std::filesystem::file_size(xml_file, error);
+
+    if (!error) {
+        key.modification_time = std::filesystem::last_write_time(xml_file, error).time_since_epoch().count();
+    }
+
+    if (error) {
+        throw std::runtime_error("CalibrationCache failed to read \"" + xml_file + "\"");
+    }
+
+    return key;
+}
+
+bool CalibrationCache::load(Sensor& sensor, const std::string& xml_file) {
+    auto filename = cacheFilename(xml_file);
+    std::error_code error;
+    auto size = std::filesystem::file_size(filename, error);
+
+    if (error || size < sizeof(CacheHeader)) {
+        return false;
+    }
+
+    // Whole cache in one read
+    std::vector<char> buffer(size);
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+
+    if (!file.read(buffer.data(), buffer.size())) {
+        return false;
+    }
+
+    CacheHeader header;
+    std::memcpy(&header, buffer.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, cache_magic, sizeof(header.magic)) != 0 || header.version != CALIBRATION_CACHE_VERSION) {
+        return false;
+    }
+
+    CalibrationCacheKey cached_key;
+    cached_key.hash = header.hash;
+    cached_key.modification_time = header.modification_time;
+    cached_key.size = header.size;
+
+    // An XML with another modification time is only hashed if its size is unchanged, the cache is then refreshed below
+    auto refresh = false;
+
+    // Without a readable XML the cache cannot be validated
+    try {
+        auto file_key = fileKey(xml_file);
+
+        if (!cached_key.sameFile(file_key)) {
+            if (cached_key.size != file_key.size || cached_key.hash != key(xml_file).hash) {
+                return false;
+            }
+
+            refresh = true;
+        }
+    }
+    catch (const std::runtime_error&) {
+        return false;
+    }
+
+    // Everything is read into a copy, so a truncated cache leaves sensor untouched
+    size_t offset = sizeof(header);
+    std::vector<float> coefficients;
+
+    // Every matrix takes at least its name length and number of coefficients
+    if (!readFloats(buffer, offset, coefficients, header.number_of_coefficients) || (buffer.size() - offset) / (2 * sizeof(uint32_t)) < header.number_of_correction_matrices) {
+        return false;
+    }
+
+    std::vector<CorrectionMatrix> correction_matrices(header.number_of_correction_matrices);
+
+    for (auto& matrix : correction_matrices) {
+        uint32_t name_length, number_of_coefficients;
+
+        if (!readUint32(buffer, offset, name_length) || buffer.size() - offset < name_length) {
+            return false;
+        }
+
+        matrix.name.assign(buffer.data() + offset, name_length);
+        offset += name_length;
+
+        if (!readUint32(buffer, offset, number_of_coefficients) || !readFloats(buffer, offset, matrix.coefficients, number_of_coefficients)) {
+            return false;
+        }
+    }
+
+    if (offset != buffer.size() || (!correction_matrices.empty() && header.default_correction_matrix >= correction_matrices.size())) {
+        return false;
+    }
+
+    sensor.setLayoutType(static_cast<LayoutType>(header.layout_type));
+    sensor.setBpp(header.bpp);
+    sensor.setSensorWidth(header.sensor_width);
+    sensor.setSensorHeight(header.sensor_height);
+    sensor.setOffsetX(header.offset_x);
+    sensor.setOffsetY(header.offset_y);
+    sensor.setActiveAreaWidth(header.active_area_width);
+    sensor.setActiveAreaHeight(header.active_area_height);
+    sensor.setPatternWidth(header.pattern_width);
+    sensor.setPatternHeight(header.pattern_height);
+    sensor.setSpatialWidth(header.spatial_width);
+    sensor.setSpatialHeight(header.spatial_height);
+    sensor.setNumberOfBands(header.number_of_bands);
+    sensor.mutableCoefficients() = std::move(coefficients);
+    sensor.mutableCorrectionMatrices() = std::move(correction_matrices);
+    sensor.setDefaultCorrectionMatrix(header.default_correction_matrix);
+
+    // Stores the new modification time, so the next load does not hash the XML again
+    if (refresh) {
+        try {
+            save(sensor, xml_file);
+        }
+        catch (const std::runtime_error& e) {
+            std::cerr << "Calibration cache not refreshed: " << e.what() << '\n';
+        }
+    }
+
+    return true;
+}
+
+void CalibrationCache::save(const Sensor& sensor, const std::string& xml_file) {
+    auto key = CalibrationCache::key(xml_file);
+
+    CacheHeader header = {};
+    std::memcpy(header.magic, cache_magic, sizeof(header.magic));
+    header.version = CALIBRATION_CACHE_VERSION;
+    header.hash = key.hash;
+    header.modification_time = key.modification_time;
+    header.size = key.size;
+
+    header.layout_type = static_cast<uint32_t>(sensor.layoutType());
+    header.bpp = sensor.bpp();
+    header.sensor_width = sensor.sensorWidth();
+    header.sensor_height = sensor.sensorHeight();
+    header.offset_x = sensor.offsetX();
+    header.offset_y = sensor.offsetY();
+    header.active_area_width = sensor.activeAreaWidth();
+    header.active_area_height = sensor.activeAreaHeight();
+    header.pattern_width = sensor.patternWidth();
+    header.pattern_height = sensor.patternHeight();
+    header.spatial_width = sensor.spatialWidth();
+    header.spatial_height = sensor.spatialHeight();
+    header.number_of_bands = sensor.numberOfBands();
+    header.number_of_coefficients = static_cast<uint32_t>(sensor.coefficients().size());
+    header.number_of_correction_matrices = static_cast<uint32_t>(sensor.correctionMatrices().size());
+    header.default_correction_matrix = static_cast<uint32_t>(sensor.defaultCorrectionMatrix());
+
+    auto filename = cacheFilename(xml_file);
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(sensor.coefficients().data()), sizeof(float) * sensor.coefficients().size());
+
+    for (const auto& matrix : sensor.correctionMatrices()) {
+        writeUint32(file, static_cast<uint32_t>(matrix.name.size()));
+        file.write(matrix.name.data(), matrix.name.size());
+        writeUint32(file, static_cast<uint32_t>(matrix.coefficients.size()));
+        file.write(reinterpret_cast<const char*>(matrix.coefficients.data()), sizeof(float) * matrix.coefficients.size());
+    }
+
+    file.close();
+
+    if (file.fail()) {
+        throw std::runtime_error("CalibrationCache failed to write file \"" + filename + "\"");
+    }
+}
+
+bool CalibrationCache::loadOrParse(Sensor& sensor, const std::string& xml_file) {
+    if (load(sensor, xml_file)) {
+        return true;
+    }
+
+    if (!XmlParser::ParseSensorCalibrationFileCamera(sensor, xml_file)) {
+        return false;
+    }
+
+    try {
+        save(sensor, xml_file);
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Calibration cache not written: " << e.what() << '\n';
+    }
+
+    return true;
+}
@@ -0,0 +1,346 @@
+#include "cubecodec.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+// Residuals sharing one Rice parameter
+#define RICE_BLOCK_SIZE 32
+#define RICE_PARAMETER_BITS 4
+#define RICE_MAX_PARAMETER 15
+// Quotients from this value on are replaced by the raw residual
+#define RICE_ESCAPE 16
+// Zigzag coded difference of two 16-bit samples
+#define RESIDUAL_BITS 17
+
+namespace {
+    // Bits are stored least significant first
+    class BitWriter {
+        std::vector<uint8_t>& output_;
+        uint64_t buffer_;
+        unsigned int bits_;
+
+    public:
+        BitWriter(std::vector<uint8_t>& output)
+            : output_(output)
+            , buffer_(0)
+            , bits_(0) {}
+
+        // value must fit into bits, at most 32 bits
+        void write(uint32_t value, unsigned int bits) {
+            buffer_ |= static_cast<uint64_t>(value) << bits_;
+            bits_ += bits;
+
+            while (bits_ >= 8) {
+                output_.push_back(static_cast<uint8_t>(buffer_));
+                buffer_ >>= 8;
+                bits_ -= 8;
+            }
+        }
+
+        void flush() {
+            if (bits_ != 0) {
+                output_.push_back(static_cast<uint8_t>(buffer_));
+                buffer_ = 0;
+                bits_ = 0;
+            }
+        }
+    };
+
+    class BitReader {
+        const uint8_t* input_;
+        size_t size_;
+        size_t position_;
+        uint64_t buffer_;
+        unsigned int bits_;
+
+    public:
+        BitReader(const uint8_t* input, size_t size)
+            : input_(input)
+            , size_(size)
+            , position_(0)
+            , buffer_(0)
+            , bits_(0) {}
+
+        uint32_t read(unsigned int bits) {
+            // Past the end zeros are read, checked by overrun
+            while (bits_ < bits) {
+                uint64_t byte = position_ < size_ ? input_[position_] : 0;
+                buffer_ |= byte << bits_;
+                bits_ += 8;
+                position_++;
+            }
+
+            auto value = static_cast<uint32_t>(buffer_ & ((uint64_t(1) << bits) - 1));
+            buffer_ >>= bits;
+            bits_ -= bits;
+
+            return value;
+        }
+
+        bool overrun() const { return position_ > size_; }
+    };
+
+    uint32_t zigzag(int32_t value) {
+        return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    }
+
+    int32_t unzigzag(uint32_t value) {
+        return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+    }
+
+    // Previous band of the same pixel corrected by the band difference of the neighbouring pixel
+    // neighbour is the pixel on the left, or above for the first pixel of a line, nullptr for the first pixel of a block
+    int32_t predict(const uint16_t* pixel, const uint16_t* neighbour, size_t band) {
+        if (neighbour == nullptr) {
+            return band == 0 ? 0 : pixel[band - 1];
+        }
+
+        if (band == 0) {
+            return neighbour[0];
+        }
+
+        int32_t prediction = pixel[band - 1] + neighbour[band] - neighbour[band - 1];
+
+        return std::min(std::max(prediction, 0), SHORT_MAX);
+    }
+
+    const uint16_t* neighbourOf(const uint16_t* pixel, size_t x, size_t y, size_t width, size_t bands) {
+        if (x != 0) {
+            return pixel - bands;
+        }
+
+        if (y != 0) {
+            return pixel - width * bands;
+        }
+
+        return nullptr;
+    }
+
+    void writeRiceBlock(BitWriter& writer, const uint32_t* residuals, size_t count) {
+        uint64_t sum = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            sum += residuals[i];
+        }
+
+        // Parameter close to log2 of the mean residual
+        unsigned int parameter = 0;
+
+        while (parameter < RICE_MAX_PARAMETER && (static_cast<uint64_t>(count) << (parameter + 1)) <= sum) {
+            parameter++;
+        }
+
+        writer.write(parameter, RICE_PARAMETER_BITS);
+
+        for (size_t i = 0; i < count; i++) {
+            auto quotient = residuals[i] >> parameter;
+
+            if (quotient < RICE_ESCAPE) {
+                // quotient ones terminated by a zero
+                writer.write((1u << quotient) - 1, quotient + 1);
+                writer.write(residuals[i] & ((1u << parameter) - 1), parameter);
+            }
+            else {
+                writer.write((1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+                writer.write(residuals[i], RESIDUAL_BITS);
+            }
+        }
+    }
+
+    uint32_t readRice(BitReader& reader, unsigned int parameter) {
+        uint32_t quotient = 0;
+
+        while (quotient < RICE_ESCAPE && reader.read(1) != 0) {
+            quotient++;
+        }
+
+        if (quotient == RICE_ESCAPE) {
+            return reader.read(RESIDUAL_BITS);
+        }
+
+        return (quotient << parameter) | reader.read(parameter);
+    }
+
+    void writeUint32(std::vector<uint8_t>& output, uint32_t value) {
+        uint8_t bytes[4] = { static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24) };
+        output.insert(output.end(), bytes, bytes + 4);
+    }
+
+    uint32_t readUint32(const uint8_t* input) {
+        return input[0] | (input[1] << 8) | (input[2] << 16) | (static_cast<uint32_t>(input[3]) << 24);
+    }
+}
+
+// ----- CubeCodec -----
+
+CubeCodec::CubeCodec(const Sensor& sensor, unsigned int tile_lines, unsigned int threads)
+    : spatial_width_(sensor.spatialWidth())
+    , spatial_height_(sensor.spatialHeight())
+    , number_of_bands_(sensor.numberOfBands())
+    , tile_lines_(tile_lines)
+    , threads_(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+    if (tile_lines_ == 0) {
+        throw std::runtime_error("CubeCodec tile lines must be at least 1");
+    }
+}
+
+unsigned int CubeCodec::numberOfTiles() const {
+    return (spatial_height_ + tile_lines_ - 1) / tile_lines_;
+}
+
+size_t CubeCodec::maxEncodedSize() const {
+    size_t size = sizeof(uint32_t) * (1 + numberOfTiles());
+
+    for (unsigned int tile = 0; tile < numberOfTiles(); tile++) {
+        auto lines = std::min(tile_lines_, spatial_height_ - tile * tile_lines_);
+        size += maxEncodedBlockSize(static_cast<size_t>(spatial_width_) * lines * number_of_bands_);
+    }
+
+    return size;
+}
+
+void CubeCodec::encode(const uint16_t* cube, std::vector<uint8_t>& output) const {
+    const auto number_of_tiles = numberOfTiles();
+    const size_t line_size = static_cast<size_t>(spatial_width_) * number_of_bands_;
+    const auto threads = std::min(threads_, number_of_tiles);
+
+    std::vector<std::vector<uint8_t>> tiles(number_of_tiles);
+    std::vector<std::future<void>> workers;
+
+    // Tiles are independent, every worker takes every threads-th tile
+    for (unsigned int worker = 0; worker < threads; worker++) {
+        workers.push_back(std::async(std::launch::async, [&, worker]() {
+            for (auto tile = worker; tile < number_of_tiles; tile += threads) {
+                auto first_line = tile * tile_lines_;
+                auto lines = std::min(tile_lines_, spatial_height_ - first_line);
+
+                tiles[tile].reserve(maxEncodedBlockSize(line_size * lines));
+                encodeBlock(cube + first_line * line_size, spatial_width_, lines, number_of_bands_, tiles[tile]);
+            }
+        }));
+    }
+
+    for (auto& worker : workers) {
+        worker.get();
+    }
+
+    // Number of tiles, size of every tile, tile data
+    writeUint32(output, number_of_tiles);
+
+    for (const auto& tile : tiles) {
+        writeUint32(output, static_cast<uint32_t>(tile.size()));
+    }
+
+    for (const auto& tile : tiles) {
+        output.insert(output.end(), tile.begin(), tile.end());
+    }
+}
+
+size_t CubeCodec::decode(const uint8_t* input, size_t size, uint16_t* cube) const {
+    const auto number_of_tiles = numberOfTiles();
+    const size_t line_size = static_cast<size_t>(spatial_width_) * number_of_bands_;
+    const size_t header_size = sizeof(uint32_t) * (1 + number_of_tiles);
+
+    if (size < header_size || readUint32(input) != number_of_tiles) {
+        throw std::runtime_error("CubeCodec invalid cube header");
+    }
+
+    std::vector<size_t> offsets(number_of_tiles + 1);
+    offsets[0] = header_size;
+
+    for (unsigned int tile = 0; tile < number_of_tiles; tile++) {
+        offsets[tile + 1] = offsets[tile] + readUint32(input + sizeof(uint32_t) * (1 + tile));
+    }
+
+    if (offsets.back() > size) {
+        throw std::runtime_error("CubeCodec cube truncated, expected " + std::to_string(offsets.back()) + " bytes but was " + std::to_string(size));
+    }
+
+    const auto threads = std::min(threads_, number_of_tiles);
+    std::vector<std::future<void>> workers;
+
+    for (unsigned int worker = 0; worker < threads; worker++) {
+        workers.push_back(std::async(std::launch::async, [&, worker]() {
+            for (auto tile = worker; tile < number_of_tiles; tile += threads) {
+                auto first_line = tile * tile_lines_;
+                auto lines = std::min(tile_lines_, spatial_height_ - first_line);
+
+                decodeBlock(input + offsets[tile], offsets[tile + 1] - offsets[tile], spatial_width_, lines, number_of_bands_, cube + first_line * line_size);
+            }
+        }));
+    }
+
+    for (auto& worker : workers) {
+        worker.get();
+    }
+
+    return offsets.back();
+}
+
+void CubeCodec::encodeBlock(const uint16_t* block, size_t width, size_t lines, size_t bands, std::vector<uint8_t>& output) {
+    BitWriter writer(output);
+    uint32_t residuals[RICE_BLOCK_SIZE];
+    size_t count = 0;
+
+    for (size_t y = 0; y < lines; y++) {
+        for (size_t x = 0; x < width; x++) {
+            auto pixel = block + (y * width + x) * bands;
+            auto neighbour = neighbourOf(pixel, x, y, width, bands);
+
+            for (size_t band = 0; band < bands; band++) {
+                residuals[count++] = zigzag(pixel[band] - predict(pixel, neighbour, band));
+
+                if (count == RICE_BLOCK_SIZE) {
+                    writeRiceBlock(writer, residuals, count);
+                    count = 0;
+                }
+            }
+        }
+    }
+
+    if (count != 0) {
+        writeRiceBlock(writer, residuals, count);
+    }
+
+    writer.flush();
+}
+
+void CubeCodec::decodeBlock(const uint8_t* input, size_t size, size_t width, size_t lines, size_t bands, uint16_t* block) {
+    BitReader reader(input, size);
+    unsigned int parameter = 0;
+    size_t count = 0;
+
+    for (size_t y = 0; y < lines; y++) {
+        for (size_t x = 0; x < width; x++) {
+            auto pixel = block + (y * width + x) * bands;
+            auto neighbour = neighbourOf(pixel, x, y, width, bands);
+
+            for (size_t band = 0; band < bands; band++) {
+                if (count++ % RICE_BLOCK_SIZE == 0) {
+                    parameter = reader.read(RICE_PARAMETER_BITS);
+                }
+
+                auto value = predict(pixel, neighbour, band) + unzigzag(readRice(reader, parameter));
+
+                if (value < 0 || value > SHORT_MAX) {
+                    throw std::runtime_error("CubeCodec corrupted block");
+                }
+
+                pixel[band] = static_cast<uint16_t>(value);
+            }
+        }
+    }
+
+    if (reader.overrun()) {
+        throw std::runtime_error("CubeCodec block truncated");
+    }
+}
+
+size_t CubeCodec::maxEncodedBlockSize(size_t samples) {
+    auto blocks = (samples + RICE_BLOCK_SIZE - 1) / RICE_BLOCK_SIZE;
+
+    return (samples * (RICE_ESCAPE + RESIDUAL_BITS) + blocks * RICE_PARAMETER_BITS + 7) / 8;
+}
@@ -0,0 +1,331 @@
+#include "cubecontainer.hpp"
+
+#include "cubecodec.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#define CUBE_CONTAINER_VERSION 1
+
+namespace {
+    const char header_magic[4] = { 'H', 'S', 'C', 'C' };
+    const char footer_magic[4] = { 'H', 'S', 'C', 'I' };
+
+    struct ContainerHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t spatial_width;
+        uint32_t spatial_height;
+        uint32_t number_of_bands;
+        uint32_t tile_width;
+        uint32_t tile_height;
+        uint32_t band_group;
+        uint32_t compressed;
+        uint32_t reserved;
+    };
+
+    // Follows the index at the end of the file
+    struct ContainerFooter {
+        uint64_t index_offset;
+        uint64_t number_of_frames;
+        uint32_t reserved;
+        char magic[4];
+    };
+
+    unsigned int divideRoundUp(unsigned int value, unsigned int divisor) {
+        return (value + divisor - 1) / divisor;
+    }
+
+    // Size of the tile or band group starting at first, cut at the border
+    unsigned int extent(unsigned int first, unsigned int size, unsigned int total) {
+        return std::min(size, total - first);
+    }
+}
+
+// ----- CubeContainerWriter -----
+
+CubeContainerWriter::CubeContainerWriter(const std::string& filename, const Sensor& sensor, const CubeContainerLayout& layout)
+    : filename_(filename)
+    , spatial_width_(sensor.spatialWidth())
+    , spatial_height_(sensor.spatialHeight())
+    , number_of_bands_(sensor.numberOfBands())
+    , layout_(layout)
+    , file_offset_(0)
+    , frames_written_(0)
+    , closed_(false) {
+    if (layout_.tile_width == 0 || layout_.tile_height == 0 || layout_.band_group == 0) {
+        throw std::runtime_error("CubeContainerWriter tile and band group sizes must be at least 1");
+    }
+
+    file_.open(filename_, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (file_.fail()) {
+        throw std::runtime_error("CubeContainerWriter failed to open file \"" + filename_ + "\"");
+    }
+
+    ContainerHeader header = {};
+    std::memcpy(header.magic, header_magic, sizeof(header.magic));
+    header.version = CUBE_CONTAINER_VERSION;
+    header.spatial_width = spatial_width_;
+    header.spatial_height = spatial_height_;
+    header.number_of_bands = number_of_bands_;
+    header.tile_width = layout_.tile_width;
+    header.tile_height = layout_.tile_height;
+    header.band_group = layout_.band_group;
+    header.compressed = layout_.compressed ? 1 : 0;
+
+    writeData(&header, sizeof(header));
+
+    chunk_.resize(static_cast<size_t>(layout_.tile_width) * layout_.tile_height * layout_.band_group);
+}
+
+CubeContainerWriter::~CubeContainerWriter() {
+    try {
+        close();
+    }
+    catch (const std::runtime_error&) {
+    }
+}
+
+void CubeContainerWriter::writeFrame(const uint16_t* cube) {
+    if (closed_) {
+        throw std::runtime_error("CubeContainerWriter file \"" + filename_ + "\" already closed");
+    }
+
+    for (unsigned int first_band = 0; first_band < number_of_bands_; first_band += layout_.band_group) {
+        auto bands = extent(first_band, layout_.band_group, number_of_bands_);
+
+        for (unsigned int tile_y = 0; tile_y < spatial_height_; tile_y += layout_.tile_height) {
+            auto height = extent(tile_y, layout_.tile_height, spatial_height_);
+
+            for (unsigned int tile_x = 0; tile_x < spatial_width_; tile_x += layout_.tile_width) {
+                auto width = extent(tile_x, layout_.tile_width, spatial_width_);
+
+                // Gather the bands of the group for every pixel of the tile
+                auto destination = chunk_.data();
+
+                for (unsigned int y = tile_y; y < tile_y + height; y++) {
+                    auto source = cube + (static_cast<size_t>(y) * spatial_width_ + tile_x) * number_of_bands_ + first_band;
+
+                    for (unsigned int x = 0; x < width; x++) {
+                        std::copy(source, source + bands, destination);
+                        source += number_of_bands_;
+                        destination += bands;
+                    }
+                }
+
+                const size_t raw_size = static_cast<size_t>(width) * height * bands * sizeof(uint16_t);
+                const void* data = chunk_.data();
+                size_t size = raw_size;
+
+                // Chunks that do not get smaller are stored raw, readers tell them apart by size
+                if (layout_.compressed) {
+                    encoded_.clear();
+                    CubeCodec::encodeBlock(chunk_.data(), width, height, bands, encoded_);
+
+                    if (encoded_.size() < raw_size) {
+                        data = encoded_.data();
+                        size = encoded_.size();
+                    }
+                }
+
+                index_.push_back(file_offset_);
+                index_.push_back(size);
+                writeData(data, size);
+            }
+        }
+    }
+
+    frames_written_++;
+}
+
+void CubeContainerWriter::close() {
+    if (closed_) {
+        return;
+    }
+
+    closed_ = true;
+
+    ContainerFooter footer = {};
+    footer.index_offset = file_offset_;
+    footer.number_of_frames = frames_written_;
+    std::memcpy(footer.magic, footer_magic, sizeof(footer.magic));
+
+    writeData(index_.data(), index_.size() * sizeof(uint64_t));
+    writeData(&footer, sizeof(footer));
+    file_.close();
+
+    if (file_.fail()) {
+        throw std::runtime_error("CubeContainerWriter failed to write file \"" + filename_ + "\"");
+    }
+}
+
+void CubeContainerWriter::writeData(const void* data, size_t size) {
+    file_.write(static_cast<const char*>(data), size);
+
+    if (file_.fail()) {
+        throw std::runtime_error("CubeContainerWriter failed to write file \"" + filename_ + "\"");
+    }
+
+    file_offset_ += size;
+}
+
+// ----- CubeContainerReader -----
+
+CubeContainerReader::CubeContainerReader(const std::string& filename)
+    : file_(filename) {
+    auto data = static_cast<const uint8_t*>(file_.data());
+    auto size = file_.size();
+
+    ContainerHeader header;
+    ContainerFooter footer;
+
+    if (size < sizeof(header) + sizeof(footer)) {
+        throw std::runtime_error("CubeContainerReader file \"" + filename + "\" is too small");
+    }
+
+    std::memcpy(&header, data, sizeof(header));
+    std::memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+
+    if (std::memcmp(header.magic, header_magic, sizeof(header.magic)) != 0 || header.version != CUBE_CONTAINER_VERSION) {
+        throw std::runtime_error("CubeContainerReader file \"" + filename + "\" is not a cube container");
+    }
+
+    if (std::memcmp(footer.magic, footer_magic, sizeof(footer.magic)) != 0) {
+        throw std::runtime_error("CubeContainerReader file \"" + filename + "\" was not closed");
+    }
+
+    if (header.tile_width == 0 || header.tile_height == 0 || header.band_group == 0) {
+        throw std::runtime_error("CubeContainerReader file \"" + filename + "\" has an empty chunk layout");
+    }
+
+    spatial_width_ = header.spatial_width;
+    spatial_height_ = header.spatial_height;
+    number_of_bands_ = header.number_of_bands;
+    layout_.tile_width = header.tile_width;
+    layout_.tile_height = header.tile_height;
+    layout_.band_group = header.band_group;
+    layout_.compressed = header.compressed != 0;
+    number_of_frames_ = footer.number_of_frames;
+
+    if (number_of_frames_ > size) {
+        throw std::runtime_error("CubeContainerReader file \"" + filename + "\" has a corrupted index");
+    }
+
+    // Offset and size per chunk
+    const uint64_t index_size = number_of_frames_ * tilesX() * tilesY() * bandGroups() * 2 * sizeof(uint64_t);
+
+    if (footer.index_offset < sizeof(header) || footer.index_offset + index_size + sizeof(footer) != size) {
+        throw std::runtime_error("CubeContainerReader file \"" + filename + "\" has a corrupted index");
+    }
+
+    index_.resize(index_size / sizeof(uint64_t));
+    std::memcpy(index_.data(), data + footer.index_offset, index_size);
+
+    for (size_t i = 0; i < index_.size(); i += 2) {
+        if (index_[i] < sizeof(header) || index_[i] + index_[i + 1] > footer.index_offset) {
+            throw std::runtime_error("CubeContainerReader file \"" + filename + "\" has a corrupted index");
+        }
+    }
+
+    chunks_ = data;
+}
+
+unsigned int CubeContainerReader::tilesX() const {
+    return divideRoundUp(spatial_width_, layout_.tile_width);
+}
+
+unsigned int CubeContainerReader::tilesY() const {
+    return divideRoundUp(spatial_height_, layout_.tile_height);
+}
+
+unsigned int CubeContainerReader::bandGroups() const {
+    return divideRoundUp(number_of_bands_, layout_.band_group);
+}
+
+void CubeContainerReader::readChunk(uint64_t frame, unsigned int group, unsigned int tile_x, unsigned int tile_y, std::vector<uint16_t>& chunk) const {
+    // Same order as written, frame, band group, tile line, tile
+    auto chunk_index = ((frame * bandGroups() + group) * tilesY() + tile_y) * tilesX() + tile_x;
+    auto offset = index_[chunk_index * 2];
+    auto size = index_[chunk_index * 2 + 1];
+
+    auto width = extent(tile_x * layout_.tile_width, layout_.tile_width, spatial_width_);
+    auto height = extent(tile_y * layout_.tile_height, layout_.tile_height, spatial_height_);
+    auto bands = extent(group * layout_.band_group, layout_.band_group, number_of_bands_);
+    const size_t samples = static_cast<size_t>(width) * height * bands;
+
+    chunk.resize(samples);
+
+    if (size == samples * sizeof(uint16_t)) {
+        std::memcpy(chunk.data(), chunks_ + offset, size);
+    }
+    else if (layout_.compressed && size < samples * sizeof(uint16_t)) {
+        CubeCodec::decodeBlock(chunks_ + offset, size, width, height, bands, chunk.data());
+    }
+    else {
+        throw std::runtime_error("CubeContainerReader chunk of frame " + std::to_string(frame) + " has an invalid size");
+    }
+}
+
+void CubeContainerReader::readRegion(uint64_t frame, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int first_band, unsigned int number_of_bands, std::vector<uint16_t>& output) const {
+    if (frame >= number_of_frames_) {
+        throw std::runtime_error("CubeContainerReader frame " + std::to_string(frame) + " out of range, file has " + std::to_string(number_of_frames_) + " frames");
+    }
+
+    if (static_cast<uint64_t>(x) + width > spatial_width_ || static_cast<uint64_t>(y) + height > spatial_height_ || static_cast<uint64_t>(first_band) + number_of_bands > number_of_bands_) {
+        throw std::runtime_error("CubeContainerReader region out of range");
+    }
+
+    output.resize(static_cast<size_t>(width) * height * number_of_bands);
+
+    if (output.empty()) {
+        return;
+    }
+
+    std::vector<uint16_t> chunk;
+
+    // Only the chunks overlapping the region are decoded
+    for (auto group = first_band / layout_.band_group; group <= (first_band + number_of_bands - 1) / layout_.band_group; group++) {
+        auto group_first_band = group * layout_.band_group;
+        auto group_bands = extent(group_first_band, layout_.band_group, number_of_bands_);
+        auto band_begin = std::max(first_band, group_first_band);
+        auto band_end = std::min(first_band + number_of_bands, group_first_band + group_bands);
+
+        for (auto tile_y = y / layout_.tile_height; tile_y <= (y + height - 1) / layout_.tile_height; tile_y++) {
+            for (auto tile_x = x / layout_.tile_width; tile_x <= (x + width - 1) / layout_.tile_width; tile_x++) {
+                readChunk(frame, group, tile_x, tile_y, chunk);
+
+                auto chunk_x = tile_x * layout_.tile_width;
+                auto chunk_y = tile_y * layout_.tile_height;
+                auto chunk_width = extent(chunk_x, layout_.tile_width, spatial_width_);
+
+                auto x_begin = std::max(x, chunk_x);
+                auto x_end = std::min(x + width, chunk_x + chunk_width);
+                auto y_begin = std::max(y, chunk_y);
+                auto y_end = std::min(y + height, chunk_y + layout_.tile_height);
+
+                for (auto pixel_y = y_begin; pixel_y < y_end; pixel_y++) {
+                    for (auto pixel_x = x_begin; pixel_x < x_end; pixel_x++) {
+                        auto source = chunk.data() + (static_cast<size_t>(pixel_y - chunk_y) * chunk_width + (pixel_x - chunk_x)) * group_bands + (band_begin - group_first_band);
+                        auto destination = output.data() + (static_cast<size_t>(pixel_y - y) * width + (pixel_x - x)) * number_of_bands + (band_begin - first_band);
+
+                        std::copy(source, source + (band_end - band_begin), destination);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void CubeContainerReader::readFrame(uint64_t frame, std::vector<uint16_t>& cube) const {
+    readRegion(frame, 0, 0, spatial_width_, spatial_height_, 0, number_of_bands_, cube);
+}
+
+void CubeContainerReader::readBand(uint64_t frame, unsigned int band, std::vector<uint16_t>& image) const {
+    readRegion(frame, 0, 0, spatial_width_, spatial_height_, band, 1, image);
+}
+
+void CubeContainerReader::readSpectra(uint64_t frame, unsigned int x, unsigned int y, unsigned int width, unsigned int height, std::vector<uint16_t>& spectra) const {
+    readRegion(frame, x, y, width, height, 0, number_of_bands_, spectra);
+}
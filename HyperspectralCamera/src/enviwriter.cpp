@@ -0,0 +1,142 @@
+#include "enviwriter.hpp"
+
+#include "utils.hpp"
+
+// ENVI data type of unsigned 16-bit integers
+#define ENVI_DATA_TYPE_UINT16 12
+
+EnviWriter::EnviWriter(const std::string& filename, const Sensor& sensor, Interleave interleave)
+    : filename_(filename)
+    , sensor_(sensor)
+    , interleave_(interleave)
+    , lines_written_(0) {
+    file_.open(filename_, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (file_.fail()) {
+        throw std::runtime_error("EnviWriter failed to open file \"" + filename_ + "\"");
+    }
+
+    if (interleave_ != Interleave::BIP) {
+        line_buffer_.resize(static_cast<uint64_t>(sensor_.spatialWidth()) * sensor_.numberOfBands());
+    }
+}
+
+void EnviWriter::writeLine(const uint16_t* line) {
+    if (lines_written_ >= sensor_.spatialHeight()) {
+        throw std::runtime_error("EnviWriter all " + std::to_string(sensor_.spatialHeight()) + " lines already written");
+    }
+
+    const uint64_t samples = sensor_.spatialWidth();
+    const uint64_t bands = sensor_.numberOfBands();
+    const uint64_t lines = sensor_.spatialHeight();
+
+    switch (interleave_) {
+    case Interleave::BIP:
+        // Same layout as the cube
+        file_.write(reinterpret_cast<const char*>(line), samples * bands * sizeof(uint16_t));
+        break;
+
+    case Interleave::BIL:
+        for (uint64_t band = 0; band < bands; band++) {
+            for (uint64_t x = 0; x < samples; x++) {
+                line_buffer_[band * samples + x] = line[x * bands + band];
+            }
+        }
+
+        file_.write(reinterpret_cast<const char*>(line_buffer_.data()), samples * bands * sizeof(uint16_t));
+        break;
+
+    case Interleave::BSQ:
+        // Every band of the line goes to its own plane
+        for (uint64_t band = 0; band < bands; band++) {
+            auto band_line = line_buffer_.data() + band * samples;
+
+            for (uint64_t x = 0; x < samples; x++) {
+                band_line[x] = line[x * bands + band];
+            }
+
+            file_.seekp((band * lines + lines_written_) * samples * sizeof(uint16_t));
+            file_.write(reinterpret_cast<const char*>(band_line), samples * sizeof(uint16_t));
+        }
+        break;
+    }
+
+    if (file_.fail()) {
+        throw std::runtime_error("EnviWriter failed to write file \"" + filename_ + "\"");
+    }
+
+    lines_written_++;
+}
+
+void EnviWriter::writeCube(const uint16_t* cube) {
+    const uint64_t line_size = static_cast<uint64_t>(sensor_.spatialWidth()) * sensor_.numberOfBands();
+
+    for (uint64_t y = lines_written_; y < sensor_.spatialHeight(); y++) {
+        writeLine(cube + y * line_size);
+    }
+}
+
+void EnviWriter::close() {
+    if (lines_written_ != sensor_.spatialHeight()) {
+        throw std::runtime_error("EnviWriter only " + std::to_string(lines_written_) + " of " + std::to_string(sensor_.spatialHeight()) + " lines written");
+    }
+
+    file_.close();
+
+    if (file_.fail()) {
+        throw std::runtime_error("EnviWriter failed to write file \"" + filename_ + "\"");
+    }
+
+    writeHeader(filename_, sensor_, interleave_, sensor_.spatialHeight());
+}
+
+void EnviWriter::writeHeader(const std::string& filename, const Sensor& sensor, Interleave interleave, uint64_t lines) {
+    auto header_filename = headerFilename(filename);
+    std::ofstream header(header_filename);
+
+    if (header.fail()) {
+        throw std::runtime_error("EnviWriter failed to open file \"" + header_filename + "\"");
+    }
+
+    const char* interleave_text[] = { "bsq", "bil", "bip" };
+
+    header << "ENVI\n";
+    header << "description = {Reflectance cube, spectrally corrected}\n";
+    header << "samples = " << sensor.spatialWidth() << '\n';
+    header << "lines = " << lines << '\n';
+    header << "bands = " << sensor.numberOfBands() << '\n';
+    header << "header offset = 0\n";
+    header << "file type = ENVI Standard\n";
+    header << "data type = " << ENVI_DATA_TYPE_UINT16 << '\n';
+    header << "interleave = " << interleave_text[static_cast<int>(interleave)] << '\n';
+    header << "byte order = 0\n";
+
+    // Sensor metadata from the calibration file
+    header << "layout type = " << Utils::getLayoutTypeText(sensor.layoutType()) << '\n';
+    header << "bits per pixel = " << sensor.bpp() << '\n';
+    header << "sensor width = " << sensor.sensorWidth() << '\n';
+    header << "sensor height = " << sensor.sensorHeight() << '\n';
+    header << "offset x = " << sensor.offsetX() << '\n';
+    header << "offset y = " << sensor.offsetY() << '\n';
+    header << "active area width = " << sensor.activeAreaWidth() << '\n';
+    header << "active area height = " << sensor.activeAreaHeight() << '\n';
+    header << "pattern width = " << sensor.patternWidth() << '\n';
+    header << "pattern height = " << sensor.patternHeight() << '\n';
+    header << "maximum value = " << PIXEL_MAX << '\n';
+
+    if (header.fail()) {
+        throw std::runtime_error("EnviWriter failed to write file \"" + header_filename + "\"");
+    }
+}
+
+std::string EnviWriter::headerFilename(const std::string& filename) {
+    auto extension = filename.find_last_of('.');
+    auto directory = filename.find_last_of("/\\");
+
+    // No extension to replace
+    if (extension == std::string::npos || (directory != std::string::npos && extension < directory)) {
+        return filename + ".hdr";
+    }
+
+    return filename.substr(0, extension) + ".hdr";
+}
@@ -0,0 +1,90 @@
+#include "framepool.hpp"
+
+// ----- FrameBuffer -----
+
+FrameBuffer::FrameBuffer(std::vector<uint16_t>&& data)
+    : data_(std::move(data)) {}
+
+FrameBuffer::FrameBuffer(std::vector<uint16_t>&& data, std::shared_ptr<FramePoolState> pool)
+    : data_(std::move(data))
+    , pool_(std::move(pool)) {}
+
+FrameBuffer::~FrameBuffer() {
+    release();
+}
+
+FrameBuffer::FrameBuffer(FrameBuffer&& other) noexcept
+    : data_(std::move(other.data_))
+    , pool_(std::move(other.pool_)) {}
+
+FrameBuffer& FrameBuffer::operator=(FrameBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        data_ = std::move(other.data_);
+        pool_ = std::move(other.pool_);
+    }
+
+    return *this;
+}
+
+void FrameBuffer::release() {
+    if (!pool_) {
+        data_ = std::vector<uint16_t>();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool_->mutex);
+
+        // The free list has room for every allocated buffer, so this never allocates
+        pool_->free.push_back(std::move(data_));
+        pool_->stats.outstanding--;
+    }
+
+    data_ = std::vector<uint16_t>();
+    pool_.reset();
+}
+
+// ----- FramePool -----
+
+FramePool::FramePool(size_t buffer_size, size_t preallocate)
+    : state_(std::make_shared<FramePoolState>()) {
+    state_->buffer_size = buffer_size;
+    state_->free.reserve(preallocate);
+
+    for (size_t i = 0; i < preallocate; i++) {
+        state_->free.emplace_back(buffer_size);
+        state_->stats.allocations++;
+    }
+}
+
+FrameBuffer FramePool::acquire() {
+    std::vector<uint16_t> data;
+
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->stats.acquisitions++;
+        state_->stats.outstanding++;
+
+        if (!state_->free.empty()) {
+            data = std::move(state_->free.back());
+            state_->free.pop_back();
+
+            return FrameBuffer(std::move(data), state_);
+        }
+
+        state_->stats.allocations++;
+        state_->free.reserve(state_->stats.allocations);
+    }
+
+    // Allocated outside of the lock
+    data.resize(state_->buffer_size);
+
+    return FrameBuffer(std::move(data), state_);
+}
+
+FramePoolStats FramePool::stats() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+
+    return state_->stats;
+}
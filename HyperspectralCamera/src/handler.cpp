@@ -1,7 +1,9 @@
 #include "handler.hpp"
 
-#include "filepaths.hpp"
+#include "bitpacking.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <fstream>
 #include <iostream>
@@ -11,197 +13,533 @@ Handler::Handler(const Sensor& sensor,
     const Image& dark_reference_white,
     const Image& white_reference,
     unsigned int exposure_time_object_ns,
-    unsigned int exposure_time_white_reference)
+    unsigned int exposure_time_white_reference,
+    Backend backend,
+    const DeviceFission& fission)
     : sensor_(sensor)
-    , dark_reference_object_(dark_reference_object)
-    , dark_reference_white_(dark_reference_white)
-    , white_reference_(white_reference)
-    , exposure_time_object_(exposure_time_object_ns)
-    , exposure_time_white_reference_(exposure_time_white_reference) {
-    std::ifstream convert_to_cube_and_reflection_correction_file(CONVERT_TO_CUBE_AND_REFLECTION_CORRECTION_FILE);
-    std::ifstream spectral_correction_file(SPECTRAL_CORRECTION_FILE);
-    std::ifstream offset_file(OFFSET_FILE);
-    std::ifstream get_one_band_and_colourmap_file(GET_ONE_BAND_AND_COLOURMAP);
+    , backend_(backend)
+    , fission_(fission)
+    , cube_workgroup_(64)
+    , spectral_workgroup_1_(0)
+    , spectral_workgroup_2_(0)
+    , vector_kernels_(true)
+    , contexts_(std::make_shared<ThreadContexts>()) {
+    auto calibration = std::make_shared<HandlerCalibration>();
+    calibration->dark_reference_object = dark_reference_object;
+    calibration->dark_reference_white = dark_reference_white;
+    calibration->white_reference = white_reference;
+    calibration->exposure_time_object = exposure_time_object_ns;
+    calibration->exposure_time_white_reference = exposure_time_white_reference;
+    calibration->correction_matrix = sensor.defaultCorrectionMatrix();
+    calibration_ = std::move(calibration);
+
+    // Initialize OpenCL only when an OpenCL backend is requested
+    if (backend_ != Backend::CPU) {
+        opencl();
+    }
+}
+
+OpenCLContext& Handler::opencl() const {
+    std::call_once(opencl_once_, [this] {
+        std::unique_ptr<OpenCLContext> opencl;
+
+        switch (backend_) {
+        case Backend::OPENCL_CPU:
+            opencl = std::make_unique<OpenCLContext>(sensor_, CL_DEVICE_TYPE_CPU, false, fission_);
+            break;
+        case Backend::OPENCL_GPU:
+            opencl = std::make_unique<OpenCLContext>(sensor_, CL_DEVICE_TYPE_GPU, false, fission_);
+            break;
+        default:
+            // OpenCL method called explicitly on a CPU backend, prefer GPU if there is one
+            opencl = std::make_unique<OpenCLContext>(sensor_, CL_DEVICE_TYPE_GPU, true, fission_);
+            break;
+        }
+
+        // The calibration is published again with device buffers of its references
+        std::lock_guard<std::mutex> lock(calibration_mutex_);
+        opencl_ = std::move(opencl);
+
+        auto calibration = std::make_shared<HandlerCalibration>(*std::atomic_load(&calibration_));
+        createReferenceBuffers(*calibration);
+        std::atomic_store(&calibration_, std::shared_ptr<const HandlerCalibration>(std::move(calibration)));
+    });
+
+    return *opencl_;
+}
+
+Handler::ThreadContext& Handler::context() const {
+    // Releases the contexts of a thread in every Handler still alive when the thread ends
+    struct Release {
+        std::vector<std::weak_ptr<ThreadContexts>> handlers;
+
+        ~Release() {
+            for (auto& handler : handlers) {
+                auto contexts = handler.lock();
+
+                if (!contexts) {
+                    continue;
+                }
+
+                // Destroyed after the lock is released
+                std::unique_ptr<ThreadContext> context;
+
+                {
+                    std::lock_guard<std::mutex> lock(contexts->mutex);
+                    auto it = contexts->contexts.find(std::this_thread::get_id());
+
+                    if (it != contexts->contexts.end()) {
+                        context = std::move(it->second);
+                        contexts->contexts.erase(it);
+                    }
+                }
+            }
+        }
+    };
 
-    std::string convert_to_cube_and_reflection_correction_source{ std::istreambuf_iterator<char>(convert_to_cube_and_reflection_correction_file), std::istreambuf_iterator<char>() };
-    std::string spectral_correction_source{ std::istreambuf_iterator<char>(spectral_correction_file), std::istreambuf_iterator<char>() };
-    std::string offset_correction_source{ std::istreambuf_iterator<char>(offset_file), std::istreambuf_iterator<char>() };
-    std::string get_one_band_and_colourmap_source{ std::istreambuf_iterator<char>(get_one_band_and_colourmap_file), std::istreambuf_iterator<char>() };
+    thread_local Release release;
 
-    std::vector<cl::Platform> platforms;
-    cl::Platform::get(&platforms);
+    std::lock_guard<std::mutex> lock(contexts_->mutex);
+    auto& context = contexts_->contexts[std::this_thread::get_id()];
 
-    auto platform = platforms.front();
-    platform.getDevices(CL_DEVICE_TYPE_GPU, &devices_);
+    if (!context) {
+        context = std::make_unique<ThreadContext>();
 
-    if (devices_.size() == 0) {
-        throw std::runtime_error("OpenCL 0 devices");
+        // Handlers destroyed in the meantime are forgotten
+        auto& handlers = release.handlers;
+        handlers.erase(std::remove_if(handlers.begin(), handlers.end(), [](const std::weak_ptr<ThreadContexts>& handler) { return handler.expired(); }), handlers.end());
+        handlers.push_back(contexts_);
     }
 
-    device_ = devices_.front();
-    context_ = cl::Context(device_);
+    // Only used by the calling thread from here on
+    return *context;
+}
 
-    convert_to_cube_and_reflection_correction_source_ = cl::Program::Sources({ std::make_pair(convert_to_cube_and_reflection_correction_source.c_str(), convert_to_cube_and_reflection_correction_source.size() + 1) });
-    spectral_correction_source_ = cl::Program::Sources({ std::make_pair(spectral_correction_source.c_str(), spectral_correction_source.size() + 1) });
-    offset_correction_source_ = cl::Program::Sources({ std::make_pair(offset_correction_source.c_str(), offset_correction_source.size() + 1) });
-    get_one_band_and_colourmap_source_ = cl::Program::Sources({ std::make_pair(get_one_band_and_colourmap_source.c_str(), get_one_band_and_colourmap_source.size() + 1) });
+OpenCLKernels& Handler::kernels() const {
+    auto& context = this->context();
 
-    convert_to_cube_and_reflection_correction_program_ = cl::Program(context_, convert_to_cube_and_reflection_correction_source_);
-    spectral_correction_program_ = cl::Program(context_, spectral_correction_source_);
-    offset_correction_program_ = cl::Program(context_, offset_correction_source_);
-    get_one_band_and_colourmap_program_ = cl::Program(context_, get_one_band_and_colourmap_source_);
+    if (!context.kernels) {
+        context.kernels = std::make_unique<OpenCLKernels>(opencl().createKernels());
+    }
 
-    // Initialize programs
-    auto error = convert_to_cube_and_reflection_correction_program_.build(devices_);
+    return *context.kernels;
+}
 
-    if (error != 0) {
-        throw std::runtime_error("OpenCL convert to cube and reflection correction program build error");
+cl::CommandQueue& Handler::queue() const {
+    auto& context = this->context();
+
+    if (!context.queue) {
+        context.queue = std::make_unique<cl::CommandQueue>(opencl().createQueue());
+    }
+
+    return *context.queue;
+}
+
+Handler::DeviceBuffers& Handler::buffers() const {
+    auto& context = this->context();
+
+    if (!context.buffers) {
+        auto& opencl = this->opencl();
+        auto frame_size = sizeof(uint16_t) * sensor_.sensorWidth() * sensor_.sensorHeight();
+        auto active_area_size = sizeof(uint16_t) * sensor_.activeAreaWidth() * sensor_.activeAreaHeight();
+        cl_int error;
+
+        auto buffers = std::make_unique<DeviceBuffers>();
+
+        // A packed frame is smaller than a raw one, so both fit into frame
+        buffers->frame = cl::Buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_HOST_WRITE_ONLY, frame_size, nullptr, &error);
+
+        if (error != 0) {
+            throw std::runtime_error("OpenCL frame buffer error");
+        }
+
+        buffers->active_area = cl::Buffer(opencl.context(), CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, active_area_size, nullptr, &error);
+
+        if (error != 0) {
+            throw std::runtime_error("OpenCL active area buffer error");
+        }
+
+        buffers->cube = cl::Buffer(opencl.context(), CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, active_area_size, nullptr, &error);
+
+        if (error != 0) {
+            throw std::runtime_error("OpenCL cube buffer error");
+        }
+
+        buffers->spectral_correction = cl::Buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, active_area_size, nullptr, &error);
+
+        if (error != 0) {
+            throw std::runtime_error("OpenCL spectral correction buffer error");
+        }
+
+        context.buffers = std::move(buffers);
+    }
+
+    return *context.buffers;
+}
+
+bool Handler::useVectorKernels() const {
+    return vector_kernels_ && opencl().useVectorKernels();
+}
+
+std::shared_ptr<const HandlerCalibration> Handler::calibration() const {
+    return std::atomic_load(&calibration_);
+}
+
+std::shared_ptr<const HandlerCalibration> Handler::makeCalibration(const Image& dark_reference_object,
+                                                                   const Image& dark_reference_white,
+                                                                   const Image& white_reference,
+                                                                   unsigned int exposure_time_object,
+                                                                   unsigned int exposure_time_white_reference) const {
+    std::lock_guard<std::mutex> lock(calibration_mutex_);
+
+    auto calibration = std::make_shared<HandlerCalibration>(*std::atomic_load(&calibration_));
+    calibration->dark_reference_object = dark_reference_object;
+    calibration->dark_reference_white = dark_reference_white;
+    calibration->white_reference = white_reference;
+    calibration->exposure_time_object = exposure_time_object;
+    calibration->exposure_time_white_reference = exposure_time_white_reference;
+    createReferenceBuffers(*calibration);
+
+    return calibration;
+}
+
+void Handler::updateCalibration(const std::function<void(HandlerCalibration&)>& update) {
+    std::lock_guard<std::mutex> lock(calibration_mutex_);
+
+    auto calibration = std::make_shared<HandlerCalibration>(*std::atomic_load(&calibration_));
+    update(*calibration);
+
+    // The copied buffers still point at the references of the previous calibration
+    createReferenceBuffers(*calibration);
+
+    std::atomic_store(&calibration_, std::shared_ptr<const HandlerCalibration>(std::move(calibration)));
+}
+
+void Handler::createReferenceBuffers(HandlerCalibration& calibration) const {
+    if (!opencl_) {
+        return;
     }
 
-    error = spectral_correction_program_.build();
+    cl_int error;
+
+    calibration.dark_reference_object_buffer = cl::Buffer(opencl_->context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * calibration.dark_reference_object.size(), (void*) calibration.dark_reference_object.rawData(), &error);
 
     if (error != 0) {
-        throw std::runtime_error("OpenCL spectral correction program build error");
+        throw std::runtime_error("OpenCL dark reference object buffer error");
     }
 
-    error = offset_correction_program_.build();
+    calibration.dark_reference_white_buffer = cl::Buffer(opencl_->context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * calibration.dark_reference_white.size(), (void*) calibration.dark_reference_white.rawData(), &error);
 
     if (error != 0) {
-        throw std::runtime_error("OpenCL offset correction program build error");
+        throw std::runtime_error("OpenCL dark reference white buffer error");
     }
 
-    error = get_one_band_and_colourmap_program_.build();
+    calibration.white_reference_buffer = cl::Buffer(opencl_->context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * calibration.white_reference.size(), (void*) calibration.white_reference.rawData(), &error);
 
     if (error != 0) {
-        throw std::runtime_error("OpenCL get one band and colourmap program build error");
+        throw std::runtime_error("OpenCL white reference buffer error");
     }
+}
 
-    // Initialize queue
-    queue_ = cl::CommandQueue(context_, device_);
+void Handler::setWhiteReference(const Image& white_reference) {
+    updateCalibration([&white_reference](HandlerCalibration& calibration) { calibration.white_reference = white_reference; });
+}
 
-    // Initialize kernels
-    convert_to_cube_and_reflection_correction_kernel_ = cl::Kernel(convert_to_cube_and_reflection_correction_program_, "ConvertToCubeAndReflectionCorrection", &error);
+void Handler::setDarkReferenceObject(const Image& dark_reference_object) {
+    updateCalibration([&dark_reference_object](HandlerCalibration& calibration) { calibration.dark_reference_object = dark_reference_object; });
+}
 
-    if (error != 0) {
-        throw std::runtime_error("OpenCL convert to cube and reflection correction kernel error");
+void Handler::setDarkReferenceWhite(const Image& dark_reference_white) {
+    updateCalibration([&dark_reference_white](HandlerCalibration& calibration) { calibration.dark_reference_white = dark_reference_white; });
+}
+
+void Handler::setWorkgroups(unsigned int cube_workgroup, unsigned int spectral_workgroup_1, unsigned int spectral_workgroup_2) {
+    cube_workgroup_ = cube_workgroup;
+    spectral_workgroup_1_ = spectral_workgroup_1;
+    spectral_workgroup_2_ = spectral_workgroup_2;
+}
+
+void Handler::setCorrectionMatrix(size_t index) {
+    if (index >= sensor_.numberOfCorrectionMatrices()) {
+        throw std::runtime_error("Handler::setCorrectionMatrix index " + std::to_string(index) + " out of range");
     }
 
-    spectral_correction_kernel_ = cl::Kernel(spectral_correction_program_, "SpectralCorrection", &error);
+    auto bands = sensor_.numberOfBands();
 
-    if (error != 0) {
-        throw std::runtime_error("OpenCL spectral correction kernel error");
+    if (sensor_.correctionMatrix(index).size() != bands * bands) {
+        throw std::runtime_error("Handler::setCorrectionMatrix matrix " + std::to_string(index) + " is not " + std::to_string(bands) + "x" + std::to_string(bands));
     }
 
-    offset_correction_kernel_ = cl::Kernel(offset_correction_program_, "OffsetCorrection", &error);
+    updateCalibration([index](HandlerCalibration& calibration) { calibration.correction_matrix = index; });
+}
 
-    if (error != 0) {
-        throw std::runtime_error("OpenCL offset correction kernel error");
+void Handler::setCorrectionMatrix(const std::string& name) {
+    setCorrectionMatrix(sensor_.correctionMatrixIndex(name));
+}
+
+void Handler::process(const uint16_t* input, Image& image, ProcessingTimes* times) const {
+    // The whole frame is processed with the calibration of its start
+    process(*calibration(), input, image, times);
+}
+
+void Handler::processPacked(const uint8_t* input, Image& image, ProcessingTimes* times) const {
+    processPacked(*calibration(), input, image, times);
+}
+
+void Handler::process(const HandlerCalibration& calibration, const uint16_t* input, Image& image, ProcessingTimes* times) const {
+    if (backend_ != Backend::CPU) {
+        processOpenCL(calibration, input, PixelFormat::RAW16, image, times);
+        return;
     }
 
-    get_one_band_and_colourmap_kernel_ = cl::Kernel(get_one_band_and_colourmap_program_, "GetOneBandAndColourmap", &error);
+    auto start = std::chrono::system_clock::now();
+    offset(input, image);
+    auto end = std::chrono::system_clock::now();
 
-    if (error != 0) {
-        throw std::runtime_error("OpenCL get one band and colourmap kernel error");
+    processActiveArea(calibration, image, times, std::chrono::duration<double>(end - start).count());
+}
+
+void Handler::processPacked(const HandlerCalibration& calibration, const uint8_t* input, Image& image, ProcessingTimes* times) const {
+    if (backend_ != Backend::CPU) {
+        processOpenCL(calibration, input, PixelFormat::PACKED10, image, times);
+        return;
     }
 
-    // Initialize buffers
-    coefficients_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(float) * sensor_.coefficients().size(), sensor_.mutableCoefficients().data(), &error);
+    auto start = std::chrono::system_clock::now();
+    offsetPacked(input, image);
+    auto end = std::chrono::system_clock::now();
 
-    if (error != 0) {
-        throw std::runtime_error("OpenCL coefficient buffer error");
+    processActiveArea(calibration, image, times, std::chrono::duration<double>(end - start).count());
+}
+
+void Handler::processActiveArea(const HandlerCalibration& calibration, Image& image, ProcessingTimes* times, double offset_correction_time) const {
+    auto cube_start = std::chrono::system_clock::now();
+    convertToCubeAndReflectionCorrectionRows(calibration, image, 0, sensor_.spatialHeight());
+    auto spectral_start = std::chrono::system_clock::now();
+
+    auto& output = context().spectral_correction_output;
+
+    if (output.size() != image.size()) {
+        output = Image(sensor_);
     }
 
-    updateDarkReferenceObjectBuffer();
-    updateDarkReferenceWhiteBuffer();
-    updateWhiteReferenceBuffer();
+    spectralCorrectionRows(calibration, output, image, 0, sensor_.spatialHeight());
+    image.mutableCube().swap(output.mutableCube());
+
+    auto end = std::chrono::system_clock::now();
+
+    if (times) {
+        times->offset_correction = offset_correction_time;
+        times->converttocube_reflection_correction = std::chrono::duration<double>(spectral_start - cube_start).count();
+        times->spectral_correction = std::chrono::duration<double>(end - spectral_start).count();
+    }
 }
 
-void Handler::updateWhiteReferenceBuffer() {
+void Handler::processOpenCL(const HandlerCalibration& calibration, const void* input, PixelFormat format, Image& image, ProcessingTimes* times) const {
+    // Resize output
+    image.mutableData().resize(static_cast<uint64_t>(sensor_.activeAreaWidth()) * sensor_.activeAreaHeight());
+
+    auto& buffers = this->buffers();
+    auto& queue = this->queue();
+    auto frame_samples = static_cast<size_t>(sensor_.sensorWidth()) * sensor_.sensorHeight();
     cl_int error;
 
-    white_reference_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * white_reference_.size(), white_reference_.mutableData().data(), &error);
+    auto start = std::chrono::system_clock::now();
+
+    // Raw frames are read by the cube kernels at the offset of the active area, packed frames are unpacked to active_area first
+    const cl::Buffer* cube_input = &buffers.frame;
+    unsigned int input_width = sensor_.sensorWidth();
+    unsigned int input_offset_x = sensor_.offsetX();
+    unsigned int input_offset_y = sensor_.offsetY();
+
+    if (format == PixelFormat::PACKED10) {
+        auto& kernel = kernels().offset_correction_packed;
+
+        error = queue.enqueueWriteBuffer(buffers.frame, CL_FALSE, 0, BitPacking::packedSize(frame_samples), input);
+
+        error = kernel.setArg(0, buffers.frame);
+        error = kernel.setArg(1, buffers.active_area);
+        error = kernel.setArg(2, sensor_.sensorWidth());
+        error = kernel.setArg(3, sensor_.offsetX());
+        error = kernel.setArg(4, sensor_.offsetY());
+
+        error = queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(sensor_.activeAreaWidth(), sensor_.activeAreaHeight()));
+        error = queue.enqueueReadBuffer(buffers.active_area, CL_TRUE, 0, sizeof(uint16_t) * image.size(), image.mutableData().data());
+
+        cube_input = &buffers.active_area;
+        input_width = sensor_.activeAreaWidth();
+        input_offset_x = 0;
+        input_offset_y = 0;
+    }
+    else {
+        error = queue.enqueueWriteBuffer(buffers.frame, CL_FALSE, 0, sizeof(uint16_t) * frame_samples, input);
+
+        // frame is write-only for the host, the active area is copied from input while the upload runs
+        offsetRows(static_cast<const uint16_t*>(input), image, 0, sensor_.activeAreaHeight());
+    }
 
     if (error != 0) {
-        throw std::runtime_error("OpenCL white reference buffer error");
+        throw std::runtime_error("OpenCL offset correction error");
     }
-}
 
-void Handler::updateDarkReferenceObjectBuffer() {
-    cl_int error;
+    auto cube_start = std::chrono::system_clock::now();
 
-    dark_reference_object_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * dark_reference_object_.size(), dark_reference_object_.mutableData().data(), &error);
+    if (useVectorKernels()) {
+        enqueueConvertToCubeAndReflectionCorrectionVector(calibration, *cube_input, input_width, input_offset_x, input_offset_y, buffers.cube);
+    }
+    else {
+        enqueueConvertToCubeAndReflectionCorrectionLocal(calibration, *cube_input, input_width, input_offset_x, input_offset_y, buffers.cube, cube_workgroup_);
+    }
+
+    // Waited for so that the time of every stage is measured
+    error = queue.finish();
 
     if (error != 0) {
-        throw std::runtime_error("OpenCL dark reference object buffer error");
+        throw std::runtime_error("OpenCL convert to cube and reflection correction error");
     }
-}
 
-void Handler::updateDarkReferenceWhiteBuffer() {
-    cl_int error;
+    auto spectral_start = std::chrono::system_clock::now();
 
-    dark_reference_white_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * dark_reference_white_.size(), dark_reference_white_.mutableData().data(), &error);
+    enqueueSpectralCorrection(calibration, buffers.cube, buffers.spectral_correction, spectral_workgroup_1_, spectral_workgroup_2_);
+    error = queue.enqueueReadBuffer(buffers.spectral_correction, CL_TRUE, 0, sizeof(uint16_t) * image.size(), image.mutableCube().data());
 
     if (error != 0) {
-        throw std::runtime_error("OpenCL dark reference white buffer error");
+        throw std::runtime_error("OpenCL spectral correction error");
+    }
+
+    auto end = std::chrono::system_clock::now();
+
+    if (times) {
+        times->offset_correction = std::chrono::duration<double>(cube_start - start).count();
+        times->converttocube_reflection_correction = std::chrono::duration<double>(spectral_start - cube_start).count();
+        times->spectral_correction = std::chrono::duration<double>(end - spectral_start).count();
     }
 }
 
-void Handler::setWhiteReference(const Image& white_reference) {
-    white_reference_ = white_reference;
-    updateWhiteReferenceBuffer();
+void Handler::colourmap(std::vector<uint16_t>& output, const Image& image, unsigned int band_index) const {
+    if (backend_ == Backend::CPU) {
+        getOneBandAndColourmap(output, image, band_index);
+    }
+    else {
+        getOneBandAndColourmapOpenCL(output, image, band_index);
+    }
 }
 
-void Handler::setDarkReferenceObject(const Image& dark_reference_object) {
-    dark_reference_object_ = dark_reference_object;
-    updateDarkReferenceObjectBuffer();
+void Handler::offsetOpenCL(const uint16_t* input, Image& output) const {
+    // Resize output
+    output.mutableData().resize(static_cast<uint64_t>(sensor_.activeAreaWidth()) * sensor_.activeAreaHeight());
+
+    auto& opencl = this->opencl();
+    auto& kernel = kernels().offset_correction;
+    cl_int error;
+
+    cl::Buffer input_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * sensor_.sensorWidth() * sensor_.sensorHeight(), (void*) input, &error);
+    cl::Buffer output_buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * output.size(), output.mutableData().data(), &error);
+
+    error = kernel.setArg(0, input_buffer);
+    error = kernel.setArg(1, output_buffer);
+    error = kernel.setArg(2, sensor_.offsetX());
+    error = kernel.setArg(3, sensor_.offsetY());
+    error = kernel.setArg(4, sensor_.activeAreaWidth());
+    error = kernel.setArg(5, sensor_.activeAreaHeight());
+
+    error = queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(sensor_.sensorWidth(), sensor_.sensorHeight()));
+    queue().enqueueMapBuffer(output_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * output.size(), {}, {}, &error);
 }
 
-void Handler::setDarkReferenceWhite(const Image& dark_reference_white) {
-    dark_reference_white_ = dark_reference_white;
-    updateDarkReferenceWhiteBuffer();
+void Handler::offsetPackedOpenCL(const uint8_t* input, Image& output) const {
+    // Resize output
+    output.mutableData().resize(static_cast<uint64_t>(sensor_.activeAreaWidth()) * sensor_.activeAreaHeight());
+
+    auto& opencl = this->opencl();
+    auto& kernel = kernels().offset_correction_packed;
+    cl_int error;
+
+    cl::Buffer input_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, BitPacking::packedSize(static_cast<size_t>(sensor_.sensorWidth()) * sensor_.sensorHeight()), (void*) input, &error);
+    cl::Buffer output_buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * output.size(), output.mutableData().data(), &error);
+
+    error = kernel.setArg(0, input_buffer);
+    error = kernel.setArg(1, output_buffer);
+    error = kernel.setArg(2, sensor_.sensorWidth());
+    error = kernel.setArg(3, sensor_.offsetX());
+    error = kernel.setArg(4, sensor_.offsetY());
+
+    // Launched over the active area only
+    error = queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(sensor_.activeAreaWidth(), sensor_.activeAreaHeight()));
+    queue().enqueueMapBuffer(output_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * output.size(), {}, {}, &error);
 }
 
-void Handler::offsetOpenCL(uint16_t* input, Image& output) {
+void Handler::offsetPacked(const uint8_t* input, Image& output) const {
     // Resize output
     output.mutableData().resize(static_cast<uint64_t>(sensor_.activeAreaWidth()) * sensor_.activeAreaHeight());
 
+    offsetPackedRows(input, output, 0, sensor_.activeAreaHeight());
+}
+
+void Handler::offsetPackedRows(const uint8_t* input, Image& output, size_t first_row, size_t rows) const {
+    auto data = output.mutableData().data();
+
+    // Every active line is unpacked straight from its first active pixel, the rest of the frame is never decoded
+    for (size_t y = first_row; y < first_row + rows; y++) {
+        auto first_sample = (y + sensor_.offsetY()) * sensor_.sensorWidth() + sensor_.offsetX();
+        BitPacking::unpack10(input, first_sample, sensor_.activeAreaWidth(), data + y * sensor_.activeAreaWidth());
+    }
+}
+
+void Handler::offsetCopyOpenCL(const uint16_t* input, Image& output) const {
+    // Resize output
+    output.mutableData().resize(static_cast<uint64_t>(sensor_.activeAreaWidth()) * sensor_.activeAreaHeight());
+
+    auto& opencl = this->opencl();
     cl_int error;
 
-    cl::Buffer input_buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * sensor_.sensorWidth() * sensor_.sensorHeight(), input, &error);
-    cl::Buffer output_buffer(context_, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * output.size(), output.mutableData().data(), &error);
+    cl::Buffer input_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * sensor_.sensorWidth() * sensor_.sensorHeight(), (void*) input, &error);
+    cl::Buffer output_buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * output.size(), output.mutableData().data(), &error);
 
-    error = offset_correction_kernel_.setArg(0, input_buffer);
-    error = offset_correction_kernel_.setArg(1, output_buffer);
-    error = offset_correction_kernel_.setArg(2, sensor_.offsetX());
-    error = offset_correction_kernel_.setArg(3, sensor_.offsetY());
-    error = offset_correction_kernel_.setArg(4, sensor_.activeAreaWidth());
-    error = offset_correction_kernel_.setArg(5, sensor_.activeAreaHeight());
+    // Origins and region are in bytes along x, rows along y
+    cl::size_t<3> input_origin;
+    input_origin[0] = sizeof(uint16_t) * sensor_.offsetX();
+    input_origin[1] = sensor_.offsetY();
+    input_origin[2] = 0;
 
-    error = queue_.enqueueNDRangeKernel(offset_correction_kernel_, cl::NullRange, cl::NDRange(sensor_.sensorWidth(), sensor_.sensorHeight()));
-    queue_.enqueueMapBuffer(output_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * output.size(), {}, {}, &error);
+    cl::size_t<3> output_origin;
+    output_origin[0] = 0;
+    output_origin[1] = 0;
+    output_origin[2] = 0;
+
+    cl::size_t<3> region;
+    region[0] = sizeof(uint16_t) * sensor_.activeAreaWidth();
+    region[1] = sensor_.activeAreaHeight();
+    region[2] = 1;
+
+    error = queue().enqueueCopyBufferRect(input_buffer, output_buffer, input_origin, output_origin, region, sizeof(uint16_t) * sensor_.sensorWidth(), 0, sizeof(uint16_t) * sensor_.activeAreaWidth(), 0);
+    queue().enqueueMapBuffer(output_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * output.size(), {}, {}, &error);
 }
 
-void Handler::offset(uint16_t* input, Image& output) {
+void Handler::offset(const uint16_t* input, Image& output) const {
     // Resize output
     output.mutableData().resize(static_cast<uint64_t>(sensor_.activeAreaWidth()) * sensor_.activeAreaHeight());
 
-    auto end_x = sensor_.offsetX() + sensor_.activeAreaWidth();
-    auto end_y = sensor_.offsetY() + sensor_.activeAreaHeight();
+    offsetRows(input, output, 0, sensor_.activeAreaHeight());
+}
 
-    for (size_t y = 0; y < sensor_.sensorHeight(); y++) {
-        for (size_t x = 0; x < sensor_.sensorWidth(); x++) {
-            if (x >= sensor_.offsetX() && x < end_x && y >= sensor_.offsetY() && y < end_y) {
-                auto i = (x - sensor_.offsetX()) + sensor_.activeAreaWidth() * (y - sensor_.offsetY());
-                output.mutablePixel(i) = input[x + sensor_.sensorWidth() * y];
-            }
-        }
+void Handler::offsetRows(const uint16_t* input, Image& output, size_t first_row, size_t rows) const {
+    auto data = output.mutableData().data();
+
+    // Active lines are contiguous in both frames
+    for (size_t y = first_row; y < first_row + rows; y++) {
+        auto line = input + (y + sensor_.offsetY()) * sensor_.sensorWidth() + sensor_.offsetX();
+        std::copy(line, line + sensor_.activeAreaWidth(), data + y * sensor_.activeAreaWidth());
     }
 }
 
-void Handler::convertToCubeAndReflectionCorrection(Image& image) {
+void Handler::convertToCubeAndReflectionCorrection(Image& image) const {
     // Resize not needed, it is done in Image constructor
+    convertToCubeAndReflectionCorrectionRows(*calibration(), image, 0, sensor_.spatialHeight());
+}
 
-    for (size_t y = 0; y < sensor_.spatialHeight(); y++) {
+void Handler::convertToCubeAndReflectionCorrectionRows(const HandlerCalibration& calibration, Image& image, size_t first_row, size_t rows) const {
+    for (size_t y = first_row; y < first_row + rows; y++) {
         for (size_t x = 0; x < sensor_.spatialWidth(); x++) {
             auto cube_width = sensor_.spatialWidth() * sensor_.numberOfBands();
             auto pixel_start = x * sensor_.numberOfBands() + y * cube_width;
@@ -210,15 +548,15 @@ void Handler::convertToCubeAndReflectionCorrection(Image& image) {
                 for (size_t band_x = 0; band_x < sensor_.patternWidth(); band_x++) {
                     size_t i = image.getArrayIndex(x * sensor_.patternWidth() + band_x, y * sensor_.patternHeight() + band_y);
 
-                    int object = image.pixel(i) - dark_reference_object_.pixel(i);
+                    int object = image.pixel(i) - calibration.dark_reference_object.pixel(i);
 
                     if (object < 0) {
                         object = 0;
                     }
 
-                    const int white = white_reference_.pixel(i) - dark_reference_white_.pixel(i);
+                    const int white = calibration.white_reference.pixel(i) - calibration.dark_reference_white.pixel(i);
                     const float object_time_ratio = static_cast<float>(object) / white;
-                    const float time_ratio = static_cast<float>(exposure_time_white_reference_) / exposure_time_object_;
+                    const float time_ratio = static_cast<float>(calibration.exposure_time_white_reference) / calibration.exposure_time_object;
                     const float v = object_time_ratio * time_ratio;
 
                     float result = v * PIXEL_MAX;
@@ -237,35 +575,133 @@ void Handler::convertToCubeAndReflectionCorrection(Image& image) {
     }
 }
 
-void Handler::convertToCubeAndReflectionCorrectionOpenCL(Image& image) {
+void Handler::convertToCubeAndReflectionCorrectionOpenCL(Image& image) const {
+    // OpenCL is initialized first, so the calibration has device buffers
+    auto& opencl = this->opencl();
+    auto calibration = this->calibration();
     cl_int error;
 
-    cl::Buffer cube_buffer(context_, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * image.size(), image.mutableCube().data(), &error);
-    cl::Buffer input_buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * image.size(), image.mutableData().data(), &error);
+    cl::Buffer cube_buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * image.size(), image.mutableCube().data(), &error);
+    cl::Buffer input_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * image.size(), (void*) image.rawData(), &error);
+
+    if (useVectorKernels()) {
+        enqueueConvertToCubeAndReflectionCorrectionVector(*calibration, input_buffer, sensor_.activeAreaWidth(), 0, 0, cube_buffer);
+        queue().enqueueMapBuffer(cube_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * image.size(), {}, {}, &error);
+        return;
+    }
+
+    auto& kernel = kernels().convert_to_cube_and_reflection_correction;
+
+    error = kernel.setArg(0, input_buffer);
+    error = kernel.setArg(1, cube_buffer);
+    error = kernel.setArg(2, sensor_.activeAreaWidth());
+    error = kernel.setArg(3, sensor_.patternWidth());
+    error = kernel.setArg(4, sensor_.patternHeight());
+    error = kernel.setArg(5, calibration->dark_reference_object_buffer);
+    error = kernel.setArg(6, calibration->dark_reference_white_buffer);
+    error = kernel.setArg(7, calibration->white_reference_buffer);
+    error = kernel.setArg(8, calibration->exposure_time_white_reference);
+    error = kernel.setArg(9, calibration->exposure_time_object);
+
+    error = queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(sensor_.spatialWidth(), sensor_.spatialHeight()));
+    queue().enqueueMapBuffer(cube_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * image.size(), {}, {}, &error);
+}
+
+void Handler::convertToCubeAndReflectionCorrectionLocalOpenCL(Image& image, unsigned int workgroup) const {
+    auto& opencl = this->opencl();
+    cl_int error;
+
+    cl::Buffer input_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * image.size(), (void*) image.rawData(), &error);
+    cl::Buffer cube_buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * image.size(), image.mutableCube().data(), &error);
+
+    enqueueConvertToCubeAndReflectionCorrectionLocal(*calibration(), input_buffer, sensor_.activeAreaWidth(), 0, 0, cube_buffer, workgroup);
+    queue().enqueueMapBuffer(cube_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * image.size(), {}, {}, &error);
+}
+
+void Handler::convertToCubeAndReflectionCorrectionLocalOpenCL(const uint16_t* input, Image& image, unsigned int workgroup) const {
+    auto& opencl = this->opencl();
+    cl_int error;
 
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(0, input_buffer);
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(1, cube_buffer);
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(2, sensor_.activeAreaWidth());
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(3, sensor_.patternWidth());
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(4, sensor_.patternHeight());
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(5, dark_reference_object_buffer_);
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(6, dark_reference_white_buffer_);
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(7, white_reference_buffer_);
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(8, exposure_time_white_reference_);
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(9, exposure_time_object_);
-    error = convert_to_cube_and_reflection_correction_kernel_.setArg(10, PIXEL_MAX);
+    cl::Buffer input_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * sensor_.sensorWidth() * sensor_.sensorHeight(), (void*) input, &error);
+    cl::Buffer cube_buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * image.size(), image.mutableCube().data(), &error);
 
-    error = queue_.enqueueNDRangeKernel(convert_to_cube_and_reflection_correction_kernel_, cl::NullRange, cl::NDRange(sensor_.spatialWidth(), sensor_.spatialHeight()));
-    queue_.enqueueMapBuffer(cube_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * image.size(), {}, {}, &error);
+    enqueueConvertToCubeAndReflectionCorrectionLocal(*calibration(), input_buffer, sensor_.sensorWidth(), sensor_.offsetX(), sensor_.offsetY(), cube_buffer, workgroup);
+    queue().enqueueMapBuffer(cube_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * image.size(), {}, {}, &error);
+}
+
+void Handler::enqueueConvertToCubeAndReflectionCorrectionVector(const HandlerCalibration& calibration, const cl::Buffer& input_buffer, unsigned int input_width, unsigned int input_offset_x, unsigned int input_offset_y, const cl::Buffer& cube_buffer) const {
+    auto& kernel = kernels().convert_to_cube_and_reflection_correction_vector;
+    cl_int error;
+
+    error = kernel.setArg(0, input_buffer);
+    error = kernel.setArg(1, cube_buffer);
+    error = kernel.setArg(2, input_width);
+    error = kernel.setArg(3, input_offset_x);
+    error = kernel.setArg(4, input_offset_y);
+    error = kernel.setArg(5, sensor_.activeAreaWidth());
+    error = kernel.setArg(6, sensor_.spatialWidth());
+    error = kernel.setArg(7, sensor_.patternWidth());
+    error = kernel.setArg(8, sensor_.patternHeight());
+    error = kernel.setArg(9, calibration.dark_reference_object_buffer);
+    error = kernel.setArg(10, calibration.dark_reference_white_buffer);
+    error = kernel.setArg(11, calibration.white_reference_buffer);
+    error = kernel.setArg(12, calibration.exposure_time_white_reference);
+    error = kernel.setArg(13, calibration.exposure_time_object);
+
+    // Every work-item handles KERNEL_VECTOR_WIDTH macro-pixels
+    auto global_width = (sensor_.spatialWidth() + KERNEL_VECTOR_WIDTH - 1) / KERNEL_VECTOR_WIDTH;
+
+    error = queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_width, sensor_.spatialHeight()));
+
+    if (error != 0) {
+        throw std::runtime_error("OpenCL convert to cube and reflection correction error");
+    }
+}
+
+void Handler::enqueueConvertToCubeAndReflectionCorrectionLocal(const HandlerCalibration& calibration, const cl::Buffer& input_buffer, unsigned int input_width, unsigned int input_offset_x, unsigned int input_offset_y, const cl::Buffer& cube_buffer, unsigned int workgroup) const {
+    auto& kernel = kernels().convert_to_cube_and_reflection_correction_local;
+    cl_int error;
+
+    error = kernel.setArg(0, input_buffer);
+    error = kernel.setArg(1, cube_buffer);
+    error = kernel.setArg(2, input_width);
+    error = kernel.setArg(3, input_offset_x);
+    error = kernel.setArg(4, input_offset_y);
+    error = kernel.setArg(5, sensor_.activeAreaWidth());
+    error = kernel.setArg(6, sensor_.spatialWidth());
+    error = kernel.setArg(7, sensor_.patternWidth());
+    error = kernel.setArg(8, sensor_.patternHeight());
+    error = kernel.setArg(9, calibration.dark_reference_object_buffer);
+    error = kernel.setArg(10, calibration.dark_reference_white_buffer);
+    error = kernel.setArg(11, calibration.white_reference_buffer);
+    error = kernel.setArg(12, calibration.exposure_time_white_reference);
+    error = kernel.setArg(13, calibration.exposure_time_object);
+    error = kernel.setArg(14, cl::Local(sizeof(uint16_t) * workgroup * sensor_.numberOfBands()));
+
+    // Round spatial width up to a multiple of workgroup, the kernel handles the narrower last strip
+    auto global_width = (sensor_.spatialWidth() + workgroup - 1) / workgroup * workgroup;
+
+    error = queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_width, sensor_.spatialHeight()), cl::NDRange(workgroup, 1));
+
+    if (error != 0) {
+        throw std::runtime_error("OpenCL convert to cube and reflection correction error");
+    }
 }
 
-void Handler::spectralCorrection(Image& output, const Image& input) {
+void Handler::spectralCorrection(Image& output, const Image& input) const {
     // check images are same size
     if (input.size() != output.size()) {
         throw std::runtime_error("Handler::spectralCorrection images are not the same size");
     }
 
-    for (size_t pixel_start = 0; pixel_start < input.size(); pixel_start += sensor_.numberOfBands()) {
+    spectralCorrectionRows(*calibration(), output, input, 0, sensor_.spatialHeight());
+}
+
+void Handler::spectralCorrectionRows(const HandlerCalibration& calibration, Image& output, const Image& input, size_t first_row, size_t rows) const {
+    auto& coefficients = sensor_.correctionMatrix(calibration.correction_matrix);
+    auto row_size = static_cast<size_t>(sensor_.spatialWidth()) * sensor_.numberOfBands();
+
+    for (size_t pixel_start = first_row * row_size; pixel_start < (first_row + rows) * row_size; pixel_start += sensor_.numberOfBands()) {
         for (size_t band = 0; band < sensor_.numberOfBands(); band++) {
             auto output_index = pixel_start + band;
             float result = 0;
@@ -273,7 +709,7 @@ void Handler::spectralCorrection(Image& output, const Image& input) {
             for (size_t i = 0; i < sensor_.numberOfBands(); i++) {
                 auto coefficient_index = sensor_.numberOfBands() * band + i;
                 auto input_index = pixel_start + i;
-                result += sensor_.coefficients()[coefficient_index] * input.pixelCube(input_index);
+                result += coefficients[coefficient_index] * input.pixelCube(input_index);
             }
 
             if (result > PIXEL_MAX) {
@@ -286,23 +722,149 @@ void Handler::spectralCorrection(Image& output, const Image& input) {
     }
 }
 
-void Handler::spectralCorrectionOpenCL(Image& image, unsigned int workgroup_1, unsigned int workgroup_2) {
+void Handler::spectralCorrectionOpenCL(Image& image, unsigned int workgroup_1, unsigned int workgroup_2) const {
+    auto& opencl = this->opencl();
+    cl_int error;
+
+    cl::Buffer output_buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * image.size(), image.mutableCube().data(), &error);
+    cl::Buffer input_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * image.size(), image.mutableCube().data(), &error);
+
+    enqueueSpectralCorrection(*calibration(), input_buffer, output_buffer, workgroup_1, workgroup_2);
+    queue().enqueueMapBuffer(output_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * image.size(), {}, {}, &error);
+}
+
+void Handler::enqueueSpectralCorrection(const HandlerCalibration& calibration, const cl::Buffer& input_buffer, const cl::Buffer& output_buffer, unsigned int workgroup_1, unsigned int workgroup_2) const {
+    auto& opencl = this->opencl();
     cl_int error;
 
-    cl::Buffer output_buffer(context_, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * image.size(), image.mutableCube().data(), &error);
-    cl::Buffer input_buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * image.size(), image.mutableCube().data(), &error);
+    if (useVectorKernels()) {
+        auto& kernel = kernels().spectral_correction_vector;
+        auto number_of_pixels = sensor_.spatialWidth() * sensor_.spatialHeight();
 
-    error = spectral_correction_kernel_.setArg(0, output_buffer);
-    error = spectral_correction_kernel_.setArg(1, input_buffer);
-    error = spectral_correction_kernel_.setArg(2, coefficients_buffer_);
-    error = spectral_correction_kernel_.setArg(3, sensor_.activeAreaWidth());
-    error = spectral_correction_kernel_.setArg(4, sensor_.numberOfBands());
+        error = kernel.setArg(0, output_buffer);
+        error = kernel.setArg(1, input_buffer);
+        error = kernel.setArg(2, opencl.correctionMatrixBuffer(calibration.correction_matrix));
+        error = kernel.setArg(3, number_of_pixels);
+        error = kernel.setArg(4, sensor_.numberOfBands());
 
-    error = queue_.enqueueNDRangeKernel(spectral_correction_kernel_, cl::NullRange, cl::NDRange(static_cast<uint64_t>(sensor_.spatialWidth()) * sensor_.spatialHeight(), sensor_.numberOfBands()), cl::NDRange(workgroup_1, workgroup_2));
-    queue_.enqueueMapBuffer(output_buffer, CL_TRUE, CL_MAP_READ, 0, sizeof(uint16_t) * image.size(), {}, {}, &error);
+        // Every work-item handles KERNEL_VECTOR_WIDTH macro-pixels, workgroups are left to the runtime
+        error = queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((number_of_pixels + KERNEL_VECTOR_WIDTH - 1) / KERNEL_VECTOR_WIDTH));
+    }
+    else {
+        auto& kernel = kernels().spectral_correction;
+
+        error = kernel.setArg(0, output_buffer);
+        error = kernel.setArg(1, input_buffer);
+        error = kernel.setArg(2, opencl.correctionMatrixBuffer(calibration.correction_matrix));
+        error = kernel.setArg(3, sensor_.activeAreaWidth());
+        error = kernel.setArg(4, sensor_.numberOfBands());
+
+        auto local_range = (workgroup_1 == 0 || workgroup_2 == 0) ? cl::NullRange : cl::NDRange(workgroup_1, workgroup_2);
+
+        error = queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(static_cast<uint64_t>(sensor_.spatialWidth()) * sensor_.spatialHeight(), sensor_.numberOfBands()), local_range);
+    }
+
+    if (error != 0) {
+        throw std::runtime_error("OpenCL spectral correction error");
+    }
 }
 
-void Handler::getOneBandAndColourmap(std::vector<uint16_t>& output, const Image& input, unsigned int band_index) {
+void Handler::spectralCorrectionMultiple(std::vector<Image>& outputs, const Image& input, const std::vector<size_t>& matrices) const {
+    if (outputs.size() != matrices.size()) {
+        outputs.resize(matrices.size(), Image(sensor_));
+    }
+
+    std::vector<const float*> coefficients;
+
+    for (size_t m = 0; m < matrices.size(); m++) {
+        coefficients.push_back(sensor_.correctionMatrix(matrices[m]).data());
+
+        if (input.size() != outputs[m].size()) {
+            throw std::runtime_error("Handler::spectralCorrectionMultiple images are not the same size");
+        }
+    }
+
+    auto number_of_bands = sensor_.numberOfBands();
+    std::vector<float> pixel(number_of_bands);
+
+    for (size_t pixel_start = 0; pixel_start < input.size(); pixel_start += number_of_bands) {
+        // Bands are read once for all matrices
+        for (size_t i = 0; i < number_of_bands; i++) {
+            pixel[i] = input.pixelCube(pixel_start + i);
+        }
+
+        for (size_t m = 0; m < matrices.size(); m++) {
+            auto& cube = outputs[m].mutableCube();
+
+            for (size_t band = 0; band < number_of_bands; band++) {
+                auto row = coefficients[m] + number_of_bands * band;
+                float result = 0;
+
+                for (size_t i = 0; i < number_of_bands; i++) {
+                    result += row[i] * pixel[i];
+                }
+
+                cube[pixel_start + band] = result > PIXEL_MAX ? PIXEL_MAX : static_cast<uint16_t>(result);
+            }
+        }
+    }
+}
+
+void Handler::spectralCorrectionMultipleOpenCL(std::vector<Image>& outputs, const Image& input, const std::vector<size_t>& matrices) const {
+    if (sensor_.numberOfBands() > KERNEL_MAX_NUMBER_OF_BANDS) {
+        throw std::runtime_error("Handler::spectralCorrectionMultipleOpenCL supports at most " + std::to_string(KERNEL_MAX_NUMBER_OF_BANDS) + " bands");
+    }
+
+    if (outputs.size() != matrices.size()) {
+        outputs.resize(matrices.size(), Image(sensor_));
+    }
+
+    if (matrices.empty()) {
+        return;
+    }
+
+    std::vector<cl_uint> indices;
+
+    for (size_t m = 0; m < matrices.size(); m++) {
+        if (matrices[m] >= sensor_.numberOfCorrectionMatrices()) {
+            throw std::runtime_error("Handler::spectralCorrectionMultipleOpenCL matrix " + std::to_string(matrices[m]) + " out of range");
+        }
+
+        if (input.size() != outputs[m].size()) {
+            throw std::runtime_error("Handler::spectralCorrectionMultipleOpenCL images are not the same size");
+        }
+
+        indices.push_back(static_cast<cl_uint>(matrices[m]));
+    }
+
+    auto& opencl = this->opencl();
+    auto& kernel = kernels().spectral_correction_multiple;
+    auto number_of_pixels = sensor_.spatialWidth() * sensor_.spatialHeight();
+    auto cube_size = sizeof(uint16_t) * input.size();
+    cl_int error;
+
+    cl::Buffer input_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, cube_size, (void*) input.cube().data(), &error);
+    cl::Buffer indices_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(cl_uint) * indices.size(), indices.data(), &error);
+    cl::Buffer output_buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, cube_size * matrices.size(), nullptr, &error);
+
+    error = kernel.setArg(0, output_buffer);
+    error = kernel.setArg(1, input_buffer);
+    error = kernel.setArg(2, opencl.correctionMatricesBuffer());
+    error = kernel.setArg(3, indices_buffer);
+    error = kernel.setArg(4, static_cast<cl_uint>(indices.size()));
+    error = kernel.setArg(5, number_of_pixels);
+    error = kernel.setArg(6, sensor_.numberOfBands());
+
+    error = queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(number_of_pixels));
+
+    for (size_t m = 0; m < matrices.size(); m++) {
+        error = queue().enqueueReadBuffer(output_buffer, CL_FALSE, cube_size * m, cube_size, outputs[m].mutableCube().data());
+    }
+
+    queue().finish();
+}
+
+void Handler::getOneBandAndColourmap(std::vector<uint16_t>& output, const Image& input, unsigned int band_index) const {
     if (band_index >= sensor_.numberOfBands()) {
         throw std::runtime_error("getOneBandAndColourmap band_index outside of number of bands range.");
     }
@@ -310,6 +872,10 @@ void Handler::getOneBandAndColourmap(std::vector<uint16_t>& output, const Image&
     // Resize output to fit RGB
     output.resize(static_cast<uint64_t>(sensor_.spatialWidth()) * sensor_.spatialHeight() * COLOURS_PER_PIXEL);
 
+    getOneBandAndColourmapRows(output, input, band_index, 0, sensor_.spatialHeight());
+}
+
+void Handler::getOneBandAndColourmapRows(std::vector<uint16_t>& output, const Image& input, unsigned int band_index, size_t first_row, size_t rows) const {
     auto colour1_r = (float)1 / 255 * SHORT_MAX;
     auto colour1_g = (float)0 / 255 * SHORT_MAX;
     auto colour1_b = (float)4 / 255 * SHORT_MAX;
@@ -345,7 +911,7 @@ void Handler::getOneBandAndColourmap(std::vector<uint16_t>& output, const Image&
     auto divide = 7;
     float part = 1.0f / divide;
 
-    for (size_t spatial_y = 0; spatial_y < sensor_.spatialHeight(); spatial_y++) {
+    for (size_t spatial_y = first_row; spatial_y < first_row + rows; spatial_y++) {
         for (size_t spatial_x = 0; spatial_x < sensor_.spatialWidth(); spatial_x++) {
             auto input_index = spatial_x * sensor_.numberOfBands() + spatial_y * sensor_.spatialWidth() * sensor_.numberOfBands() + band_index;
             auto output_index = spatial_x * COLOURS_PER_PIXEL + spatial_y * sensor_.spatialWidth() * COLOURS_PER_PIXEL;
@@ -398,7 +964,7 @@ void Handler::getOneBandAndColourmap(std::vector<uint16_t>& output, const Image&
     }
 }
 
-void Handler::getOneBandAndColourmapOpenCL(std::vector<uint16_t>& output, const Image& input, unsigned int band_index) {
+void Handler::getOneBandAndColourmapOpenCL(std::vector<uint16_t>& output, const Image& input, unsigned int band_index) const {
     if (band_index >= sensor_.numberOfBands()) {
         throw std::runtime_error("getOneBandAndColourmapOpenCL band_index outside of number of bands range.");
     }
@@ -406,16 +972,18 @@ void Handler::getOneBandAndColourmapOpenCL(std::vector<uint16_t>& output, const
     // Resize output to fit RGB
     output.resize(static_cast<uint64_t>(sensor_.spatialWidth()) * sensor_.spatialHeight() * COLOURS_PER_PIXEL);
 
+    auto& opencl = this->opencl();
+    auto& kernel = kernels().get_one_band_and_colourmap;
     cl_int error;
 
-    cl::Buffer input_buffer(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * input.size(), (void*) input.cube().data(), &error);
-    cl::Buffer output_buffer(context_, CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * output.size(), output.data(), &error);
+    cl::Buffer input_buffer(opencl.context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(uint16_t) * input.size(), (void*) input.cube().data(), &error);
+    cl::Buffer output_buffer(opencl.context(), CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_READ_ONLY, sizeof(uint16_t) * output.size(), output.data(), &error);
 
-    error = get_one_band_and_colourmap_kernel_.setArg(0, input_buffer);
-    error = get_one_band_and_colourmap_kernel_.setArg(1, output_buffer);
-    error = get_one_band_and_colourmap_kernel_.setArg(2, band_index);
-    error = get_one_band_and_colourmap_kernel_.setArg(3, sensor_.numberOfBands());
+    error = kernel.setArg(0, input_buffer);
+    error = kernel.setArg(1, output_buffer);
+    error = kernel.setArg(2, band_index);
+    error = kernel.setArg(3, sensor_.numberOfBands());
 
-    error = queue_.enqueueNDRangeKernel(get_one_band_and_colourmap_kernel_, cl::NullRange, cl::NDRange(sensor_.spatialWidth(), sensor_.spatialHeight()), cl::NDRange(sensor_.spatialWidth(), 2));
-    error = queue_.enqueueReadBuffer(output_buffer, CL_TRUE, 0, sizeof(uint16_t) * output.size(), output.data());
-}
\ No newline at end of file
+    error = queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(sensor_.spatialWidth(), sensor_.spatialHeight()), cl::NDRange(sensor_.spatialWidth(), 2));
+    error = queue().enqueueReadBuffer(output_buffer, CL_TRUE, 0, sizeof(uint16_t) * output.size(), output.data());
+}
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "image.hpp"
+#include "bitpacking.hpp"
+#include "mappedfile.hpp"
 #include "sensor.hpp"
 #include "utils.hpp"
 
@@ -22,6 +24,9 @@ Image::Image()
     , number_of_bands_(0) {}
 
 Image::Image(const Sensor& sensor)
+    : Image(sensor, static_cast<uint64_t>(sensor.activeAreaWidth()) * sensor.activeAreaHeight()) {}
+
+Image::Image(const Sensor& sensor, size_t raw_size)
     : bpp_(sensor.bpp())
     , sensor_width_(sensor.sensorWidth())
     , sensor_height_(sensor.sensorHeight())
@@ -34,8 +39,8 @@ Image::Image(const Sensor& sensor)
     , spatial_width_(active_area_width_ / pattern_width_)
     , spatial_height_(active_area_height_ / pattern_height_)
     , number_of_bands_(pattern_width_ * pattern_height_)
-    , data_raw_(static_cast<uint64_t>(active_area_width_) * active_area_height_)
-    , data_cube_(data_raw_.size()) {
+    , data_raw_(raw_size)
+    , data_cube_(raw_size) {
     // Check active area is divisible by pattern width / height
     if ((active_area_width_ % pattern_width_) != 0 || (active_area_height_ % pattern_height_) != 0) {
         throw std::runtime_error("Image invalid active area / pattern");
@@ -55,20 +60,26 @@ Image::Image(const Sensor& sensor, const std::string& filePath)
 
     // Get size of file
     file.seekg(0, std::ios::end);
-    auto actual_size = file.tellg();
+    auto actual_size = static_cast<size_t>(file.tellg());
     file.seekg(0, std::ios::beg);
 
     // Get expected size of file
     auto pixels = active_area_width_ * active_area_height_;
     auto expected_size = pixels * BYTES_PER_PIXEL;
+    auto packed_size = BitPacking::packedSize(pixels);
 
-    // Check if file is correct size
-    if (actual_size != expected_size) {
-        throw std::runtime_error("Image expected size " + std::to_string(expected_size) + " but was " + std::to_string(actual_size));
+    // Retrieve data from file, 10-bit packed files are unpacked
+    if (actual_size == packed_size) {
+        std::vector<uint8_t> packed(packed_size);
+        file.read(reinterpret_cast<char*>(packed.data()), packed_size);
+        BitPacking::unpack10(packed.data(), pixels, data_raw_.data());
+    }
+    else if (actual_size == expected_size) {
+        file.read(reinterpret_cast<char*>(data_raw_.data()), actual_size);
+    }
+    else {
+        throw std::runtime_error("Image expected size " + std::to_string(expected_size) + " or packed size " + std::to_string(packed_size) + " but was " + std::to_string(actual_size));
     }
-
-    // Retrieve data from file
-    file.read(reinterpret_cast<char*>(data_raw_.data()), actual_size);
 
     // Resize cube data for later
     data_cube_.resize(pixels);
@@ -89,6 +100,37 @@ Image::Image(const Sensor& sensor, const std::vector<uint16_t>& data)
     data_cube_.resize(data.size());
 }
 
+Image::Image(const Sensor& sensor, std::shared_ptr<const MappedFile> file)
+    : Image(sensor, 0) {
+    auto pixels = static_cast<uint64_t>(active_area_width_) * active_area_height_;
+    auto expected_size = pixels * BYTES_PER_PIXEL;
+    auto packed_size = BitPacking::packedSize(pixels);
+
+    // 10-bit packed files cannot be used in place, they are unpacked into owned storage
+    if (file->size() == packed_size) {
+        data_raw_.resize(pixels);
+        BitPacking::unpack10(static_cast<const uint8_t*>(file->data()), pixels, data_raw_.data());
+        return;
+    }
+
+    // Check if file is correct size
+    if (file->size() != expected_size) {
+        throw std::runtime_error("Image expected size " + std::to_string(expected_size) + " or packed size " + std::to_string(packed_size) + " but was " + std::to_string(file->size()));
+    }
+
+    mapped_raw_ = std::move(file);
+}
+
+void Image::unmap() {
+    if (!mapped_raw_) {
+        return;
+    }
+
+    auto data = static_cast<const uint16_t*>(mapped_raw_->data());
+    data_raw_.assign(data, data + size());
+    mapped_raw_.reset();
+}
+
 uint16_t Image::pixel(size_t x, size_t y) const {
     const auto i = getArrayIndex(x, y);
 
@@ -96,7 +138,7 @@ uint16_t Image::pixel(size_t x, size_t y) const {
         throw std::out_of_range("Image::pixel(" + std::to_string(x) + ", " + std::to_string(y) + ") out of range " + std::to_string(active_area_width_) + "x" + std::to_string(active_area_height_));
     }
 
-    return data_raw_[i];
+    return rawData()[i];
 }
 
 uint16_t& Image::mutablePixel(size_t x, size_t y) {
@@ -106,6 +148,8 @@ uint16_t& Image::mutablePixel(size_t x, size_t y) {
         throw std::out_of_range("Image::mutablePixel(" + std::to_string(x) + ", " + std::to_string(y) + ") out of range " + std::to_string(active_area_width_) + "x" + std::to_string(active_area_height_));
     }
 
+    unmap();
+
     return data_raw_[i];
 }
 
@@ -114,7 +158,7 @@ uint16_t Image::pixel(size_t i) const {
         throw std::out_of_range("Image::pixel(" + std::to_string(i) + ") out of range " + std::to_string(active_area_width_) + "x" + std::to_string(active_area_height_));
     }
     
-    return data_raw_[i];
+    return rawData()[i];
 }
 
 uint16_t& Image::mutablePixel(size_t i) {
@@ -122,11 +166,13 @@ uint16_t& Image::mutablePixel(size_t i) {
         throw std::out_of_range("Image::mutablePixel(" + std::to_string(i) + ") out of range " + std::to_string(active_area_width_) + "x" + std::to_string(active_area_height_));
     }
 
+    unmap();
+
     return data_raw_[i];
 }
 
 uint16_t Image::pixelCube(size_t i) const {
-    if (i >= size()) {
+    if (i >= data_cube_.size()) {
         throw std::out_of_range("Image::pixelCube(" + std::to_string(i) + ") out of range " + std::to_string(active_area_width_) + "x" + std::to_string(active_area_height_));
     }
 
@@ -138,22 +184,44 @@ uint16_t& Image::mutablePixelCube(size_t i) {
         throw std::out_of_range("Image::mutablePixelCube(" + std::to_string(i) + ") out of range " + std::to_string(active_area_width_) + "x" + std::to_string(active_area_height_));
     }
 
-    return data_cube_[i];
+    return mutableCube()[i];
 }
 
 size_t Image::size() const {
+    if (mapped_raw_) {
+        return mapped_raw_->size() / BYTES_PER_PIXEL;
+    }
+
     return data_raw_.size();
 }
 
+bool Image::isMapped() const {
+    return mapped_raw_ != nullptr;
+}
+
+const uint16_t* Image::rawData() const {
+    if (mapped_raw_) {
+        return static_cast<const uint16_t*>(mapped_raw_->data());
+    }
+
+    return data_raw_.data();
+}
+
 size_t Image::getArrayIndex(size_t x, size_t y) const {
     return x + (active_area_width_ * y);
 }
 
 const std::vector<uint16_t>& Image::data() const {
+    if (mapped_raw_) {
+        throw std::runtime_error("Image::data() of mapped image, use rawData()");
+    }
+
     return data_raw_;
 }
 
 std::vector<uint16_t>& Image::mutableData() {
+    unmap();
+
     return data_raw_;
 }
 
@@ -162,24 +230,37 @@ const std::vector<uint16_t>& Image::cube() const {
 }
 
 std::vector<uint16_t>& Image::mutableCube() {
+    // Mapped images allocate the cube only when it is needed
+    if (data_cube_.size() < size()) {
+        data_cube_.resize(size());
+    }
+
     return data_cube_;
 }
 
-void Image::saveWithoutChecking(const std::string& filename) const {
+void Image::saveWithoutChecking(const std::string& filename, PixelFormat format) const {
     std::cout << "Saving image \"" << filename << "\"...\n";
 
     std::ofstream out(filename, std::ios::out | std::ios::binary);
-    out.write(reinterpret_cast<const char*>(data_raw_.data()), data_raw_.size() * 2);
+
+    if (format == PixelFormat::PACKED10) {
+        std::vector<uint8_t> packed(BitPacking::packedSize(size()));
+        BitPacking::pack10(rawData(), size(), packed.data());
+        out.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+    }
+    else {
+        out.write(reinterpret_cast<const char*>(rawData()), size() * BYTES_PER_PIXEL);
+    }
 
     std::cout << "Saving successful.\n";
 }
 
-void Image::save(const std::string& filename) const {
+void Image::save(const std::string& filename, PixelFormat format) const {
     // Check if file already exists
     if (Utils::doesFileExist(filename)) {
         std::cout << "File already exists!\n";
         return;
     }
 
-    saveWithoutChecking(filename);
+    saveWithoutChecking(filename, format);
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include "imagewriter.hpp"
+
+#include "bitpacking.hpp"
+#include "enviwriter.hpp"
+#include "utils.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+// Frames are written in few large unbuffered requests instead of through the stream buffer
+#define WRITE_BLOCK_SIZE (1 << 20)
+
+ImageWriter::ImageWriter(size_t capacity)
+    : capacity_(capacity)
+    , stop_(false)
+    , jobs_in_progress_(0) {
+    if (capacity_ == 0) {
+        throw std::runtime_error("ImageWriter capacity must be at least 1");
+    }
+
+    thread_ = std::thread(&ImageWriter::run, this);
+}
+
+ImageWriter::~ImageWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+
+    job_added_.notify_one();
+    thread_.join();
+}
+
+bool ImageWriter::write(const std::string& filename, std::vector<uint16_t>&& data, bool overwrite, PixelFormat format) {
+    FrameBuffer buffer(std::move(data));
+
+    if (write(filename, std::move(buffer), overwrite, format)) {
+        return true;
+    }
+
+    // Left untouched when refused
+    data = std::move(buffer.vector());
+
+    return false;
+}
+
+bool ImageWriter::write(const std::string& filename, FrameBuffer&& data, bool overwrite, PixelFormat format) {
+    return push(filename, data, overwrite, format, nullptr, Interleave::BIP);
+}
+
+bool ImageWriter::writeCube(const std::string& filename, const Sensor& sensor, std::vector<uint16_t>&& cube, Interleave interleave, bool overwrite) {
+    FrameBuffer buffer(std::move(cube));
+
+    if (writeCube(filename, sensor, std::move(buffer), interleave, overwrite)) {
+        return true;
+    }
+
+    cube = std::move(buffer.vector());
+
+    return false;
+}
+
+bool ImageWriter::writeCube(const std::string& filename, const Sensor& sensor, FrameBuffer&& cube, Interleave interleave, bool overwrite) {
+    auto expected_size = static_cast<uint64_t>(sensor.spatialWidth()) * sensor.spatialHeight() * sensor.numberOfBands();
+
+    if (cube.size() != expected_size) {
+        throw std::runtime_error("ImageWriter cube expected size " + std::to_string(expected_size) + " but was " + std::to_string(cube.size()));
+    }
+
+    return push(filename, cube, overwrite, PixelFormat::RAW16, std::make_shared<const Sensor>(sensor), interleave);
+}
+
+bool ImageWriter::push(const std::string& filename, FrameBuffer& data, bool overwrite, PixelFormat format, std::shared_ptr<const Sensor> sensor, Interleave interleave) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (jobs_.size() + jobs_in_progress_ >= capacity_) {
+            return false;
+        }
+
+        // data is only moved from once the job is accepted
+        jobs_.push_back({ filename, std::move(data), overwrite, format, std::move(sensor), interleave });
+    }
+
+    job_added_.notify_one();
+
+    return true;
+}
+
+bool ImageWriter::pollResult(WriteResult& result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (results_.empty()) {
+        return false;
+    }
+
+    result = std::move(results_.front());
+    results_.pop_front();
+
+    return true;
+}
+
+void ImageWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    job_done_.wait(lock, [this]() { return jobs_.empty() && jobs_in_progress_ == 0; });
+}
+
+size_t ImageWriter::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return jobs_.size() + jobs_in_progress_;
+}
+
+void ImageWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        job_added_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+
+        // Queued buffers are still written when stopping
+        if (jobs_.empty()) {
+            return;
+        }
+
+        auto job = std::move(jobs_.front());
+        jobs_.pop_front();
+        jobs_in_progress_++;
+
+        lock.unlock();
+        auto result = writeFile(job);
+        lock.lock();
+
+        jobs_in_progress_--;
+        results_.push_back(std::move(result));
+        job_done_.notify_all();
+    }
+}
+
+WriteResult ImageWriter::writeFile(const Job& job) {
+    if (!job.overwrite && Utils::doesFileExist(job.filename)) {
+        return { job.filename, false, "File already exists" };
+    }
+
+    if (job.sensor) {
+        return writeEnviFile(job);
+    }
+
+    // Written next to the target and renamed into place, so files still mapped by MappedFile, e.g. references, keep their old contents
+    auto temporary_filename = job.filename + ".tmp";
+    std::ofstream file;
+
+    // Unbuffered, every block goes to the OS in a single call
+    file.rdbuf()->pubsetbuf(nullptr, 0);
+    file.open(temporary_filename, std::ios::out | std::ios::binary);
+
+    if (file.fail()) {
+        return { job.filename, false, "Failed to open file" };
+    }
+
+    auto data = reinterpret_cast<const char*>(job.data.data());
+    auto remaining = job.data.size() * sizeof(uint16_t);
+    std::vector<uint8_t> packed;
+
+    if (job.format == PixelFormat::PACKED10) {
+        packed.resize(BitPacking::packedSize(job.data.size()));
+        BitPacking::pack10(job.data.data(), job.data.size(), packed.data());
+        data = reinterpret_cast<const char*>(packed.data());
+        remaining = packed.size();
+    }
+
+    while (remaining != 0 && file.good()) {
+        auto block = remaining < WRITE_BLOCK_SIZE ? remaining : WRITE_BLOCK_SIZE;
+        file.write(data, block);
+        data += block;
+        remaining -= block;
+    }
+
+    file.close();
+    auto success = !file.fail();
+
+    if (!success) {
+        std::remove(temporary_filename.c_str());
+        return { job.filename, false, "Failed to write file" };
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary_filename, job.filename, error);
+
+    if (error) {
+        std::remove(temporary_filename.c_str());
+        return { job.filename, false, "Failed to replace file" };
+    }
+
+    return { job.filename, true, "" };
+}
+
+WriteResult ImageWriter::writeEnviFile(const Job& job) {
+    try {
+        EnviWriter writer(job.filename, *job.sensor, job.interleave);
+        writer.writeCube(job.data.data());
+        writer.close();
+    }
+    catch (const std::runtime_error& e) {
+        return { job.filename, false, e.what() };
+    }
+
+    return { job.filename, true, "" };
+}
@@ -1,15 +1,34 @@
 #include <GLFW/glfw3.h>
 #include "xiApi.h"
 
+#include "bitpacking.hpp"
+#include "calibrationcache.hpp"
+#include "cubecodec.hpp"
 #include "filepaths.hpp"
+#include "framepool.hpp"
 #include "image.hpp"
+#include "imagewriter.hpp"
+#include "enviwriter.hpp"
 #include "handler.hpp"
+#include "mappedfile.hpp"
+#include "multicamera.hpp"
+#include "pipeline.hpp"
+#include "recorder.hpp"
+#include "replaysource.hpp"
 #include "sensor.hpp"
+#include "sharedcube.hpp"
+#include "syntheticsource.hpp"
+#include "tilescheduler.hpp"
 #include "utils.hpp"
-#include "xmlparser.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <sstream>
 
@@ -19,11 +38,109 @@
 #define EXPOSURE_TIME_WHITE_REFERENCE 12500
 #define SPECTRAL_WORKGROUP1 108
 #define SPECTRAL_WORKGROUP2 5
+#define CUBE_WORKGROUP 64
+
+// Backend used for processing in the live loop, one of Backend::CPU, Backend::OPENCL_CPU, Backend::OPENCL_GPU
+#define BACKEND Backend::OPENCL_GPU
+
+// Partition the CPU OpenCL device so that RESERVED_COMPUTE_UNITS are kept free for the XIMEA acquisition thread
+#define DEVICE_FISSION false
+#define RESERVED_COMPUTE_UNITS 2
+
+// Number of frames that can wait for the disk, captures are refused when it is reached
+#define WRITER_CAPACITY 8
+
+// ENVI interleave of snapshot cubes, one of Interleave::BSQ, Interleave::BIL, Interleave::BIP
+#define SNAPSHOT_INTERLEAVE Interleave::BIP
+
+// Pixel format delivered by the camera, one of PixelFormat::RAW16, PixelFormat::PACKED10
+// Packed frames need 5 / 8 of the USB3 bandwidth, they are unpacked during offset correction and recorded as received
+#define ACQUISITION_FORMAT PixelFormat::PACKED10
+
+// Storage of raw snapshots and raw recordings, one of PixelFormat::RAW16, PixelFormat::PACKED10
+// Cubes stay 16-bit so that ENVI readers can open them
+#define RAW_STORAGE_FORMAT PixelFormat::PACKED10
+
+// Continuous recording toggled with R, raw sensor frames and / or corrected cubes (BIP with ENVI header)
+#define RECORD_RAW true
+#define RECORD_CUBE true
+#define RECORDING_RING_SIZE (512 << 20)
+#define RECORDING_WRITES_IN_FLIGHT 4
+
+// Recorded cubes are losslessly compressed into a .cbc file (CubeCodec frames, no ENVI header)
+#define CUBE_RECORDING_COMPRESSION true
+
+// Replay recorded raw sensor frames (RAW_STORAGE_FORMAT) from a file or directory instead of the camera and print the throughput
+// Empty uses the camera, a frame rate of 0 replays as fast as the pipeline runs
+#define REPLAY_PATH ""
+#define REPLAY_FRAME_RATE 0
+
+// Feed synthetic frames of every SYNTHETIC_GEOMETRIES sensor instead of the camera and print the throughput of each
+// 0 frames uses the camera, a frame rate of 0 generates frames as fast as the pipeline runs
+#define SYNTHETIC_FRAMES 0
+#define SYNTHETIC_FRAME_RATE 0
+
+// Pattern width, pattern height, spatial width, spatial height, offset x, offset y
+const SyntheticGeometry SYNTHETIC_GEOMETRIES[] = {
+    { 3, 3, 409, 216, 0, 3 },
+    { 4, 4, 512, 272, 0, 0 },
+    { 5, 5, 409, 216, 0, 3 },
+    { 5, 5, 818, 432, 0, 3 },
+};
+
+// What the live view and headless mode do when correction falls behind the camera, see BackpressurePolicy
+// Replays and synthetic frames always block, so that every frame is measured
+#define BACKPRESSURE_POLICY BackpressurePolicy::DROP_OLDEST
+#define BACKPRESSURE_EVERY_NTH 2
+
+// Run without GLFW, a window or the colourmap, e.g. on capture nodes, results only go to the sinks below
+// Stops after HEADLESS_SECONDS or on Ctrl+C, 0 seconds runs until Ctrl+C
+#define HEADLESS false
+#define HEADLESS_SECONDS 0
+#define HEADLESS_STATS_SECONDS 5
+// Records from the start, see RECORD_RAW and RECORD_CUBE
+#define HEADLESS_RECORD true
+// Publishes every corrected cube under this shared memory name, empty disables it
+#define HEADLESS_SHARED_CUBE "HyperspectralCube"
+// Writes every nth corrected cube to SNAPSHOT_FOLDER, 0 disables it
+#define HEADLESS_SNAPSHOT_EVERY 0
+
+// Identical cameras processed in one process, sharing the calibration, the OpenCL programs and the correction matrices
+// With more than 1 camera they run headless, camera i > 0 reads its references from the reference files with "_i" before the extension
+// and publishes to HEADLESS_SHARED_CUBE with "_i" appended
+// SYNTHETIC_CAMERAS cameras of the first synthetic geometry run side by side instead of one geometry after another
+// CAMERA_WORKERS threads process the frames of all cameras, 0 uses every hardware thread
+#define CAMERAS 1
+#define SYNTHETIC_CAMERAS 1
+#define CAMERA_WORKERS 0
+
+// Correct replayed and synthetic frames on a work-stealing TileScheduler of this many workers instead of BACKEND, 0 uses BACKEND
+// Tiles are TILE_ROWS macro-pixel rows, up to TILE_FRAMES_IN_FLIGHT frames are corrected at once
+#define TILE_WORKERS 0
+#define TILE_ROWS 8
+#define TILE_FRAMES_IN_FLIGHT 3
+
+// Frame slots shared by the acquisition, correction and presentation threads of the live view and replays
+// More slots absorb longer hiccups of a stage at the cost of latency
+#define PIPELINE_SLOTS 4
+
+// Count every heap allocation of the program, the I key prints the allocations per frame of the live view
+// Frames are served from preallocated slots and pools, so the steady state should not allocate at all
+// Off by default, counting adds an atomic increment to every allocation
+#define COUNT_ALLOCATIONS false
 
 // Number for iterations used for benchmark
 // Set to 0 for no benchmark
 #define COMPARISON_ITERATIONS 0
 
+#if COUNT_ALLOCATIONS
+#include "allocationcounter.hpp"
+#else
+uint64_t heapAllocations() {
+    return 0;
+}
+#endif
+
 void printInfo(int exposure_time, int band_index, double get_image_time, double offset_correction_time, double converttocube_reflection_correction_time, double spectral_correction_time, double getoneband_colourmap_time, double render_time) {
     auto total_time = get_image_time + offset_correction_time + converttocube_reflection_correction_time + spectral_correction_time + getoneband_colourmap_time + render_time;
     
@@ -62,38 +179,669 @@ bool areYouSure() {
     return true;
 }
 
-void takeWhiteReference(Handler& handler, const Image& image) {
-    if (!areYouSure()) {
-        return;
+Image loadReference(const Sensor& sensor, const std::string& filename, const std::string& name) {
+    // Missing references are left empty
+    try {
+        return Image(sensor, std::make_shared<MappedFile>(filename));
     }
-    
-    image.saveWithoutChecking(WHITE_REFERENCE_FILE);
+    catch (const std::runtime_error& e) {
+        std::cerr << "Failed to load " << name << ": " << e.what() << '\n';
+    }
+
+    return Image(sensor);
+}
+
+// Pooled copy of size samples, the buffer returns to the pool once it was written
+FrameBuffer copyToPool(FramePool& pool, const uint16_t* data, size_t size) {
+    auto buffer = pool.acquire();
+    std::copy(data, data + size, buffer.data());
+
+    return buffer;
+}
+
+void takeWhiteReference(Handler& handler, ImageWriter& writer, FramePool& pool, const Image& image) {
+    // The writer replaces the file, so calibrations still mapping the old reference are unaffected
     handler.setWhiteReference(image);
     std::cout << "New white reference set.\n";
-}
 
-void takeDarkReference(Handler& handler, const Image& image) {
-    if (!areYouSure()) {
-        return;
+    if (!writer.write(WHITE_REFERENCE_FILE, copyToPool(pool, image.rawData(), image.size()))) {
+        std::cerr << "Writer queue full, reference not saved.\n";
     }
-    
-    image.saveWithoutChecking(DARK_REFERENCE_FILE);
+}
+
+void takeDarkReference(Handler& handler, ImageWriter& writer, FramePool& pool, const Image& image) {
+    // The writer replaces the file, so calibrations still mapping the old reference are unaffected
     handler.setDarkReferenceObject(image);
     std::cout << "New dark reference for object set.\n";
-}
 
-void takeDarkReferenceWhite(Handler& handler, const Image& image) {
-    if (!areYouSure()) {
-        return;
+    if (!writer.write(DARK_REFERENCE_FILE, copyToPool(pool, image.rawData(), image.size()))) {
+        std::cerr << "Writer queue full, reference not saved.\n";
     }
-    
-    image.saveWithoutChecking(DARK_REFERENCE_WHITE_FILE);
+}
+
+void takeDarkReferenceWhite(Handler& handler, ImageWriter& writer, FramePool& pool, const Image& image) {
+    // The writer replaces the file, so calibrations still mapping the old reference are unaffected
     handler.setDarkReferenceWhite(image);
     std::cout << "New dark reference for white reference set.\n";
+
+    if (!writer.write(DARK_REFERENCE_WHITE_FILE, copyToPool(pool, image.rawData(), image.size()))) {
+        std::cerr << "Writer queue full, reference not saved.\n";
+    }
+}
+
+void takeImage(ImageWriter& writer, FramePool& pool, const Sensor& sensor, const Image& image) {
+    // Raw frame and corrected cube with ENVI header, snapshots never overwrite existing files
+    auto filename = SNAPSHOT_FOLDER + Utils::getTimeStamp();
+
+    if (!writer.write(filename + ".raw", copyToPool(pool, image.rawData(), image.size()), false, RAW_STORAGE_FORMAT)) {
+        std::cerr << "Writer queue full, image not saved.\n";
+        return;
+    }
+
+    if (!writer.writeCube(filename + ".img", sensor, copyToPool(pool, image.cube().data(), image.size()), SNAPSHOT_INTERLEAVE, false)) {
+        std::cerr << "Writer queue full, cube not saved.\n";
+    }
+}
+
+void printWriteResults(ImageWriter& writer) {
+    WriteResult result;
+
+    while (writer.pollResult(result)) {
+        if (result.success) {
+            std::cout << "Saved \"" << result.filename << "\".\n";
+        }
+        else {
+            std::cerr << "Failed to save \"" << result.filename << "\": " << result.message << ".\n";
+        }
+    }
 }
 
-void takeImage(const Image& image) {
-    image.save(SNAPSHOT_FOLDER + Utils::getTimeStamp() + ".hdr");
+struct Recording {
+    std::unique_ptr<Recorder> raw;
+    std::unique_ptr<Recorder> cube;
+    std::string cube_filename;
+    // Only set when cubes are compressed
+    std::unique_ptr<CubeCodec> codec;
+    std::vector<uint8_t> encoded;
+};
+
+size_t acquiredFrameSize(const Sensor& sensor) {
+    size_t samples = static_cast<size_t>(sensor.sensorWidth()) * sensor.sensorHeight();
+
+    return ACQUISITION_FORMAT == PixelFormat::PACKED10 ? BitPacking::packedSize(samples) : samples * PIXEL_BYTE_SIZE;
+}
+
+void processFrame(Handler& handler, const void* frame, Image& image, ProcessingTimes* times) {
+    if (ACQUISITION_FORMAT == PixelFormat::PACKED10) {
+        handler.processPacked(static_cast<const uint8_t*>(frame), image, times);
+    }
+    else {
+        handler.process(static_cast<const uint16_t*>(frame), image, times);
+    }
+}
+
+// Frames the camera dropped before they were read, found from gaps in acq_nframe
+// Only written by the acquisition thread
+struct CameraFrames {
+    bool first = true;
+    unsigned int last = 0;
+    std::atomic<uint64_t> lost = 0;
+};
+
+CameraFrames camera_frames;
+
+// Copies the frame out of the XIMEA buffer, which is reused by the next xiGetImage
+void acquireFrame(HANDLE handle, XI_IMG& ximea_image, PipelineFrame& frame) {
+    if (xiGetImage(handle, 1000, &ximea_image) != XI_OK) {
+        throw std::runtime_error("Error after xiGetImage");
+    }
+
+    if (!camera_frames.first && ximea_image.acq_nframe > camera_frames.last + 1) {
+        camera_frames.lost.fetch_add(ximea_image.acq_nframe - camera_frames.last - 1, std::memory_order_relaxed);
+    }
+
+    camera_frames.first = false;
+    camera_frames.last = ximea_image.acq_nframe;
+
+    std::memcpy(frame.raw.data(), ximea_image.bp, frame.raw.size());
+}
+
+void colourmapFrame(Handler& handler, PipelineFrame& frame, int band_index) {
+    auto start = std::chrono::steady_clock::now();
+    handler.colourmap(frame.pixels, frame.image, band_index);
+    frame.colourmap_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void printPipelineStats(const PipelineStats& stats) {
+    auto average = [](double seconds, uint64_t frames) { return frames > 0 ? seconds / frames : 0; };
+
+    std::cout << "Pipeline: " << stats.frames_presented << " frames in " << stats.seconds << "s (" << stats.framesPerSecond() << "fps)\n";
+    std::cout << "Acquisition stage: " << average(stats.acquisition_seconds, stats.frames_acquired) << "s per frame\n";
+    std::cout << "Correction stage: " << average(stats.processing_seconds, stats.frames_processed) << "s per frame\n";
+    std::cout << "Presentation stage: " << average(stats.presentation_seconds, stats.frames_presented) << "s per frame\n";
+    std::cout << "Dropped frames: " << stats.frames_dropped << " by the pipeline, " << camera_frames.lost.load() << " by the camera\n";
+    std::cout << "Queue depth: " << stats.acquired_queue_depth << " to correct (at most " << stats.max_acquired_queue_depth << "), " << stats.processed_queue_depth << " to present\n";
+    std::cout << "Latency: " << stats.averageLatency() << "s average, " << stats.max_latency_seconds << "s at most\n";
+}
+
+void printAllocations(const FramePoolStats& capture_pool, uint64_t allocations, uint64_t frames) {
+    std::cout << "Capture buffers: " << capture_pool.allocations << " allocated, " << capture_pool.acquisitions << " used, " << capture_pool.outstanding << " being written\n";
+
+    if (COUNT_ALLOCATIONS) {
+        std::cout << "Heap allocations: " << allocations << " in " << frames << " frames (" << (frames > 0 ? static_cast<double>(allocations) / frames : 0) << " per frame)\n";
+    }
+}
+
+void printRecorderStats(const std::string& name, const RecorderStats& stats) {
+    std::cout << name << ": " << stats.frames_recorded << " frames recorded, " << stats.frames_dropped << " dropped, "
+              << stats.megabytesPerSecond() << " MB/s over " << stats.seconds << "s\n";
+}
+
+void startRecording(Recording& recording, const Sensor& sensor) {
+    auto filename = SNAPSHOT_FOLDER + Utils::getTimeStamp();
+    uint64_t raw_frame_size = static_cast<uint64_t>(sensor.sensorWidth()) * sensor.sensorHeight() * BYTES_PER_PIXEL;
+    uint64_t cube_frame_size = static_cast<uint64_t>(sensor.activeAreaWidth()) * sensor.activeAreaHeight() * BYTES_PER_PIXEL;
+
+    // Packed frames are already in the PACKED10 storage layout
+    if (RECORD_RAW && ACQUISITION_FORMAT == PixelFormat::PACKED10) {
+        recording.raw = std::make_unique<Recorder>(filename + "_raw.raw", acquiredFrameSize(sensor), RECORDING_RING_SIZE, RECORDING_WRITES_IN_FLIGHT);
+    }
+    else if (RECORD_RAW) {
+        recording.raw = std::make_unique<Recorder>(filename + "_raw.raw", raw_frame_size, RECORDING_RING_SIZE, RECORDING_WRITES_IN_FLIGHT, RAW_STORAGE_FORMAT);
+    }
+
+    if (RECORD_CUBE && CUBE_RECORDING_COMPRESSION) {
+        recording.codec = std::make_unique<CubeCodec>(sensor);
+        recording.encoded.reserve(recording.codec->maxEncodedSize());
+        recording.cube_filename = filename + "_cube.cbc";
+        recording.cube = std::make_unique<Recorder>(recording.cube_filename, recording.codec->maxEncodedSize(), RECORDING_RING_SIZE, RECORDING_WRITES_IN_FLIGHT);
+    }
+    else if (RECORD_CUBE) {
+        recording.cube_filename = filename + "_cube.img";
+        recording.cube = std::make_unique<Recorder>(recording.cube_filename, cube_frame_size, RECORDING_RING_SIZE, RECORDING_WRITES_IN_FLIGHT);
+    }
+
+    std::cout << "Recording started.\n";
+}
+
+void stopRecording(Recording& recording, const Sensor& sensor) {
+    try {
+        if (recording.raw) {
+            printRecorderStats("Raw recording", recording.raw->stop());
+        }
+
+        if (recording.cube) {
+            auto stats = recording.cube->stop();
+            printRecorderStats("Cube recording", stats);
+
+            // Cubes are stored one after another, so the recording is one tall BIP cube
+            if (!recording.codec) {
+                EnviWriter::writeHeader(recording.cube_filename, sensor, Interleave::BIP, stats.frames_recorded * sensor.spatialHeight());
+            }
+        }
+
+        std::cout << "Recording stopped.\n";
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Recording failed: " << e.what() << '\n';
+    }
+
+    recording.raw.reset();
+    recording.cube.reset();
+    recording.codec.reset();
+}
+
+void recordCube(Recording& recording, const Image& image) {
+    if (!recording.codec) {
+        recording.cube->record(image.cube().data());
+        return;
+    }
+
+    recording.encoded.clear();
+    recording.codec->encode(image.cube().data(), recording.encoded);
+    recording.cube->record(recording.encoded.data(), recording.encoded.size());
+}
+
+// Runs the full pipeline including the colourmap on the 16-bit frames of next until it returns nullptr, nothing is rendered
+// Reading the next frame overlaps the correction of the previous one
+void runFrames(Handler& handler, const Sensor& sensor, const std::function<const uint16_t*()>& next, const std::string& title) {
+    auto frame_size = static_cast<size_t>(sensor.sensorWidth()) * sensor.sensorHeight() * PIXEL_BYTE_SIZE;
+
+    ProcessingTimes total;
+    double colourmap_time = 0;
+
+    // Frames in flight need a slot each on top of the other stages
+    std::unique_ptr<TileScheduler> scheduler;
+    size_t frames_in_flight = 1;
+
+    if (TILE_WORKERS > 0) {
+        scheduler = std::make_unique<TileScheduler>(handler, TILE_WORKERS, TILE_ROWS, TILE_FRAMES_IN_FLIGHT);
+        frames_in_flight = TILE_FRAMES_IN_FLIGHT;
+    }
+
+    Pipeline pipeline(sensor, frame_size, PIPELINE_SLOTS + frames_in_flight - 1,
+        [&next](PipelineFrame& frame) {
+            auto data = next();
+
+            if (!data) {
+                return false;
+            }
+
+            std::memcpy(frame.raw.data(), data, frame.raw.size());
+            return true;
+        },
+        [&handler, &scheduler](PipelineFrame& frame) {
+            if (scheduler) {
+                scheduler->submit(frame.raw.data(), PixelFormat::RAW16, frame.image, &frame.pixels, 0, [&frame] { frame.processed.store(true, std::memory_order_release); });
+                return;
+            }
+
+            handler.process(reinterpret_cast<const uint16_t*>(frame.raw.data()), frame.image, &frame.times);
+            colourmapFrame(handler, frame, 0);
+        },
+        BackpressurePolicy::BLOCK, 1, frames_in_flight);
+
+    while (!pipeline.finished()) {
+        auto frame = pipeline.present(std::chrono::milliseconds(1000));
+
+        if (frame) {
+            total.offset_correction += frame->times.offset_correction;
+            total.converttocube_reflection_correction += frame->times.converttocube_reflection_correction;
+            total.spectral_correction += frame->times.spectral_correction;
+            colourmap_time += frame->colourmap_time;
+        }
+    }
+
+    auto stats = pipeline.stats();
+    auto frames = static_cast<double>(std::max<uint64_t>(stats.frames_presented, 1));
+
+    std::cout << "----- " << title << " -----\n";
+    printPipelineStats(stats);
+    std::cout << "Offset correction time: " << total.offset_correction / frames << "s\n";
+    std::cout << "Convert to cube + reflection correction time: " << total.converttocube_reflection_correction / frames << "s\n";
+    std::cout << "Spectral correction time: " << total.spectral_correction / frames << "s\n";
+    std::cout << "GetOneBand + colourmap time: " << colourmap_time / frames << "s\n";
+    std::cout << "Sensor data: " << stats.framesPerSecond() * frame_size / (1 << 20) << "MB/s\n";
+
+    if (scheduler) {
+        auto scheduler_stats = scheduler->stats();
+        std::cout << "Tile scheduler: " << scheduler_stats.workers << " workers, " << scheduler->tiles() << " tiles per frame, "
+                  << scheduler_stats.utilization() * 100 << "% utilization, " << scheduler_stats.steals << " of " << scheduler_stats.tasks << " tasks stolen\n";
+    }
+}
+
+int runReplay(Handler& handler, const Sensor& sensor) {
+    try {
+        ReplaySource source(REPLAY_PATH, sensor, RAW_STORAGE_FORMAT, REPLAY_FRAME_RATE);
+
+        std::cout << "Replay of \"" << REPLAY_PATH << "\" started.\n";
+
+        // Replayed frames are always 16-bit
+        runFrames(handler, sensor, [&source]() { return source.next(); }, "REPLAY");
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Replay failed: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Needs neither the calibration file nor the camera, every geometry gets its own handler with an identity correction matrix
+int runSynthetic(const DeviceFission& fission) {
+    try {
+        SyntheticOptions options;
+        options.frames = SYNTHETIC_FRAMES;
+        options.frame_rate = SYNTHETIC_FRAME_RATE;
+
+        for (const auto& geometry : SYNTHETIC_GEOMETRIES) {
+            auto sensor = SyntheticSource::makeSensor(geometry);
+            SyntheticSource source(sensor, options);
+
+            Handler handler(sensor, source.darkReference(), source.darkReference(), source.whiteReference(), EXPOSURE_TIME, EXPOSURE_TIME, BACKEND, fission);
+            handler.setWorkgroups(CUBE_WORKGROUP, SPECTRAL_WORKGROUP1, SPECTRAL_WORKGROUP2);
+
+            std::ostringstream title;
+            title << "SYNTHETIC " << sensor.sensorWidth() << "x" << sensor.sensorHeight() << ", " << sensor.numberOfBands() << " BANDS";
+
+            runFrames(handler, sensor, [&source]() { return source.next(); }, title.str());
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Synthetic run failed: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+std::atomic<bool> headless_stop(false);
+
+void requestHeadlessStop(int) {
+    headless_stop = true;
+}
+
+void printCameraStats(const MultiCamera& cameras) {
+    auto stats = cameras.stats();
+
+    for (size_t i = 0; i < stats.cameras.size(); i++) {
+        auto& camera = stats.cameras[i];
+        auto frames = static_cast<double>(std::max<uint64_t>(camera.frames_processed, 1));
+
+        std::cout << cameras.name(i) << ": " << camera.frames_processed << " frames, " << camera.frames_dropped << " dropped, "
+                  << (stats.seconds > 0 ? camera.frames_processed / stats.seconds : 0) << "fps, " << camera.processing_seconds / frames << "s per frame\n";
+    }
+
+    std::cout << "All cameras: " << stats.framesPerSecond() << "fps on " << stats.workers << " workers\n";
+}
+
+// Cameras differ in their references only, as identical cameras would
+int runSyntheticCameras(const DeviceFission& fission) {
+    try {
+        auto sensor = SyntheticSource::makeSensor(SYNTHETIC_GEOMETRIES[0]);
+        std::vector<std::unique_ptr<SyntheticSource>> sources;
+
+        for (unsigned int i = 0; i < SYNTHETIC_CAMERAS; i++) {
+            SyntheticOptions options;
+            options.frames = SYNTHETIC_FRAMES;
+            options.frame_rate = SYNTHETIC_FRAME_RATE;
+            options.white_level -= 20 * i;
+            options.seed += i;
+
+            sources.push_back(std::make_unique<SyntheticSource>(sensor, options));
+        }
+
+        // One handler, so the programs are built once
+        Handler handler(sensor, sources[0]->darkReference(), sources[0]->darkReference(), sources[0]->whiteReference(), EXPOSURE_TIME, EXPOSURE_TIME, BACKEND, fission);
+        handler.setWorkgroups(CUBE_WORKGROUP, SPECTRAL_WORKGROUP1, SPECTRAL_WORKGROUP2);
+
+        std::vector<CameraInput> inputs;
+
+        for (size_t i = 0; i < sources.size(); i++) {
+            auto& source = *sources[i];
+
+            CameraInput input;
+            input.name = "Synthetic camera " + std::to_string(i);
+            input.calibration = handler.makeCalibration(source.darkReference(), source.darkReference(), source.whiteReference(), EXPOSURE_TIME, EXPOSURE_TIME);
+            input.acquire = [&source](PipelineFrame& frame) {
+                auto data = source.next();
+
+                if (!data) {
+                    return false;
+                }
+
+                std::memcpy(frame.raw.data(), data, frame.raw.size());
+                return true;
+            };
+
+            inputs.push_back(std::move(input));
+        }
+
+        auto frame_size = static_cast<size_t>(sensor.sensorWidth()) * sensor.sensorHeight() * PIXEL_BYTE_SIZE;
+        MultiCamera cameras(handler, frame_size, std::move(inputs), nullptr, CAMERA_WORKERS, PIPELINE_SLOTS);
+        cameras.wait();
+
+        std::cout << "----- " << SYNTHETIC_CAMERAS << " SYNTHETIC CAMERAS -----\n";
+        printCameraStats(cameras);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Synthetic cameras failed: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// File of camera index, camera 0 uses file itself
+std::string cameraFile(const std::string& file, size_t camera) {
+    if (camera == 0) {
+        return file;
+    }
+
+    auto suffix = "_" + std::to_string(camera);
+    auto dot = file.find_last_of('.');
+
+    return dot == std::string::npos ? file + suffix : file.substr(0, dot) + suffix + file.substr(dot);
+}
+
+// Opens camera index, configures it like the live camera and starts acquisition
+// Throws std::runtime_error if any step fails, the device is closed again
+HANDLE openCamera(unsigned int index, const Sensor& sensor) {
+    HANDLE handle = NULL;
+
+    if (xiOpenDevice(index, &handle) != XI_OK) {
+        throw std::runtime_error("Error after xiOpenDevice of camera " + std::to_string(index));
+    }
+
+    auto check = [handle, index](XI_RETURN status, const std::string& step) {
+        if (status != XI_OK) {
+            xiCloseDevice(handle);
+            throw std::runtime_error("Error after " + step + " of camera " + std::to_string(index));
+        }
+    };
+
+    check(xiSetParamInt(handle, XI_PRM_EXPOSURE, EXPOSURE_TIME), "xiSetParam exposure time");
+    check(xiSetParamInt(handle, XI_PRM_BUFFER_POLICY, XI_BP_UNSAFE), "xiSetParam buffer policy");
+
+    if (ACQUISITION_FORMAT == PixelFormat::PACKED10) {
+        check(xiSetParamInt(handle, XI_PRM_IMAGE_DATA_FORMAT, XI_FRM_TRANSPORT_DATA), "xiSetParam format 10bit packed");
+        check(xiSetParamInt(handle, XI_PRM_OUTPUT_DATA_BIT_DEPTH, XI_BPP_10), "xiSetParam format 10bit packed");
+        check(xiSetParamInt(handle, XI_PRM_OUTPUT_DATA_PACKING, XI_ON), "xiSetParam format 10bit packed");
+        check(xiSetParamInt(handle, XI_PRM_OUTPUT_DATA_PACKING_TYPE, XI_DATA_PACK_PFNC_LSB_PACKING), "xiSetParam format 10bit packed");
+    }
+    else {
+        check(xiSetParamInt(handle, XI_PRM_IMAGE_DATA_FORMAT, XI_RAW16), "xiSetParam format 16bit raw");
+    }
+
+    int buffer_size = 0;
+    check(xiGetParamInt(handle, XI_PRM_IMAGE_PAYLOAD_SIZE, &buffer_size), "xiGetParam payload size");
+
+    if (static_cast<size_t>(buffer_size) != acquiredFrameSize(sensor)) {
+        xiCloseDevice(handle);
+        throw std::runtime_error("Buffer size of camera " + std::to_string(index) + " does not correspond to calibration file");
+    }
+
+    check(xiStartAcquisition(handle), "xiStartAcquisition");
+
+    return handle;
+}
+
+// Every camera is acquired on its own thread, a camera whose slots are all busy drops its newest frames
+int runCameras(Handler& handler, const Sensor& sensor) {
+    std::vector<HANDLE> handles;
+    std::vector<XI_IMG> ximea_images(CAMERAS);
+    auto program_return = EXIT_SUCCESS;
+
+    try {
+        std::vector<CameraInput> inputs;
+        std::vector<std::unique_ptr<SharedCube>> shared_cubes;
+
+        for (unsigned int i = 0; i < CAMERAS; i++) {
+            handles.push_back(openCamera(i, sensor));
+
+            auto& ximea_image = ximea_images[i];
+            memset(&ximea_image, 0, sizeof(ximea_image));
+            ximea_image.size = sizeof(XI_IMG);
+
+            CameraInput input;
+            input.name = "Camera " + std::to_string(i);
+            input.format = ACQUISITION_FORMAT;
+            input.calibration = i == 0 ? handler.calibration() :
+                handler.makeCalibration(loadReference(sensor, cameraFile(DARK_REFERENCE_FILE, i), "dark reference object"),
+                                        loadReference(sensor, cameraFile(DARK_REFERENCE_WHITE_FILE, i), "dark reference white"),
+                                        loadReference(sensor, cameraFile(WHITE_REFERENCE_FILE, i), "white reference"),
+                                        EXPOSURE_TIME,
+                                        EXPOSURE_TIME_WHITE_REFERENCE);
+
+            // The XIMEA buffer is reused by the next xiGetImage of the same camera
+            input.acquire = [handle = handles.back(), &ximea_image](PipelineFrame& frame) {
+                if (xiGetImage(handle, 1000, &ximea_image) != XI_OK) {
+                    throw std::runtime_error("Error after xiGetImage");
+                }
+
+                std::memcpy(frame.raw.data(), ximea_image.bp, frame.raw.size());
+                return true;
+            };
+
+            inputs.push_back(std::move(input));
+
+            if (!std::string(HEADLESS_SHARED_CUBE).empty()) {
+                shared_cubes.push_back(std::make_unique<SharedCube>(cameraFile(HEADLESS_SHARED_CUBE, i), sensor));
+            }
+        }
+
+        // Frames of one camera are never published concurrently, so each shared cube keeps a single writer
+        MultiCamera cameras(handler, acquiredFrameSize(sensor), std::move(inputs),
+            [&shared_cubes](size_t camera, PipelineFrame& frame) {
+                if (!shared_cubes.empty()) {
+                    shared_cubes[camera]->publish(frame.image.cube().data(), frame.sequence);
+                }
+            },
+            CAMERA_WORKERS, PIPELINE_SLOTS, true);
+
+        std::signal(SIGINT, requestHeadlessStop);
+        std::cout << CAMERAS << " cameras started.\n";
+
+        auto start = std::chrono::steady_clock::now();
+        auto next_stats = start + std::chrono::seconds(HEADLESS_STATS_SECONDS);
+
+        while (!headless_stop) {
+            auto now = std::chrono::steady_clock::now();
+
+            if (HEADLESS_SECONDS > 0 && now - start >= std::chrono::seconds(HEADLESS_SECONDS)) {
+                break;
+            }
+
+            if (now >= next_stats) {
+                std::cout << "----- " << static_cast<int>(std::chrono::duration<double>(now - start).count()) << "s -----\n";
+                printCameraStats(cameras);
+                next_stats += std::chrono::seconds(HEADLESS_STATS_SECONDS);
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        std::signal(SIGINT, SIG_DFL);
+        cameras.stop();
+
+        std::cout << "----- " << CAMERAS << " CAMERAS -----\n";
+        printCameraStats(cameras);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Cameras failed: " << e.what() << '\n';
+        program_return = EXIT_FAILURE;
+    }
+
+    for (auto handle : handles) {
+        xiStopAcquisition(handle);
+        xiCloseDevice(handle);
+    }
+
+    return program_return;
+}
+
+// Acquisition and correction run on the pipeline threads, this thread only feeds the sinks and prints the stats
+void runHeadless(Handler& handler, const Sensor& sensor, HANDLE handle, XI_IMG& ximea_image, Recording& recording, ImageWriter& writer, FramePool& pool) {
+    std::unique_ptr<SharedCube> shared_cube;
+
+    if (!std::string(HEADLESS_SHARED_CUBE).empty()) {
+        shared_cube = std::make_unique<SharedCube>(HEADLESS_SHARED_CUBE, sensor);
+        std::cout << "Publishing cubes to shared memory \"" << HEADLESS_SHARED_CUBE << "\".\n";
+    }
+
+    if (HEADLESS_RECORD) {
+        startRecording(recording, sensor);
+    }
+
+    std::signal(SIGINT, requestHeadlessStop);
+
+    Pipeline pipeline(sensor, acquiredFrameSize(sensor), PIPELINE_SLOTS,
+        [handle, &ximea_image](PipelineFrame& frame) {
+            acquireFrame(handle, ximea_image, frame);
+            return true;
+        },
+        [&handler, &recording](PipelineFrame& frame) {
+            processFrame(handler, frame.raw.data(), frame.image, &frame.times);
+
+            if (recording.raw) {
+                recording.raw->record(frame.raw.data());
+            }
+
+            if (recording.cube) {
+                recordCube(recording, frame.image);
+            }
+        },
+        BACKPRESSURE_POLICY, BACKPRESSURE_EVERY_NTH);
+
+    auto start = std::chrono::steady_clock::now();
+    auto next_stats = start + std::chrono::seconds(HEADLESS_STATS_SECONDS);
+    auto snapshot_prefix = SNAPSHOT_FOLDER + Utils::getTimeStamp() + "_";
+    PipelineStats last_stats;
+
+    std::cout << "Headless processing started.\n";
+
+    while (!headless_stop) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (HEADLESS_SECONDS > 0 && now - start >= std::chrono::seconds(HEADLESS_SECONDS)) {
+            break;
+        }
+
+        if (now >= next_stats) {
+            auto stats = pipeline.stats();
+            auto interval = stats.seconds - last_stats.seconds;
+
+            std::cout << "----- " << static_cast<int>(stats.seconds) << "s -----\n";
+            std::cout << "Last " << interval << "s: " << (interval > 0 ? (stats.frames_presented - last_stats.frames_presented) / interval : 0) << "fps\n";
+            printPipelineStats(stats);
+
+            if (recording.raw) {
+                printRecorderStats("Raw recording", recording.raw->stats());
+            }
+
+            if (recording.cube) {
+                printRecorderStats("Cube recording", recording.cube->stats());
+            }
+
+            printWriteResults(writer);
+
+            last_stats = stats;
+            next_stats += std::chrono::seconds(HEADLESS_STATS_SECONDS);
+        }
+
+        auto frame = pipeline.present(std::chrono::milliseconds(100));
+
+        if (!frame) {
+            continue;
+        }
+
+        if (shared_cube) {
+            shared_cube->publish(frame->image.cube().data(), frame->sequence);
+        }
+
+        if (HEADLESS_SNAPSHOT_EVERY > 0 && frame->sequence % HEADLESS_SNAPSHOT_EVERY == 0) {
+            auto filename = snapshot_prefix + std::to_string(frame->sequence) + ".img";
+
+            if (!writer.writeCube(filename, sensor, copyToPool(pool, frame->image.cube().data(), frame->image.size()), SNAPSHOT_INTERLEAVE, false)) {
+                std::cerr << "Writer queue full, cube not saved.\n";
+            }
+        }
+    }
+
+    std::signal(SIGINT, SIG_DFL);
+    pipeline.stop();
+
+    std::cout << "----- HEADLESS -----\n";
+    printPipelineStats(pipeline.stats());
+}
+
+void nextCorrectionMatrix(Handler& handler, const Sensor& sensor) {
+    auto index = (handler.correctionMatrix() + 1) % sensor.numberOfCorrectionMatrices();
+    handler.setCorrectionMatrix(index);
+
+    if (!sensor.correctionMatrices().empty()) {
+        std::cout << "Set correction matrix to " << sensor.correctionMatrices()[index].name << '\n';
+    }
 }
 
 void incrementBand(Sensor& sensor, int& band_index) {
@@ -113,9 +861,19 @@ void decrementBand(Sensor& sensor, int& band_index) {
 }
 
 int main() {
+    DeviceFission fission;
+    fission.enabled = DEVICE_FISSION;
+    fission.reserved_compute_units = RESERVED_COMPUTE_UNITS;
+
+    // No calibration, window or camera is needed for synthetic frames
+    if (SYNTHETIC_FRAMES > 0) {
+        return SYNTHETIC_CAMERAS > 1 ? runSyntheticCameras(fission) : runSynthetic(fission);
+    }
+
     Sensor sensor;
     
-    if (!XmlParser::ParseSensorCalibrationFileCamera(sensor, CALIBRATION_FILE)) {
+    // The XML is only parsed when it changed since the cache was written
+    if (!CalibrationCache::loadOrParse(sensor, CALIBRATION_FILE)) {
         std::cerr << "CALIBRATION FILE PARSE FAILED";
         return EXIT_FAILURE;
     }
@@ -151,68 +909,74 @@ int main() {
 
     Image output(sensor);
 
-    Image dark_ref(sensor);
-    Image dark_ref_white(sensor);
-    Image white_ref(sensor);
-
-    if (Utils::doesFileExist(DARK_REFERENCE_FILE)) {
-        dark_ref = Image(sensor, DARK_REFERENCE_FILE);
-    }
-    else {
-        std::cerr << "Failed to load dark reference object.\n";
+    // References are mapped straight into the handler, which then holds the only mapping of each file
+    Handler handler(sensor,
+                    loadReference(sensor, DARK_REFERENCE_FILE, "dark reference object"),
+                    loadReference(sensor, DARK_REFERENCE_WHITE_FILE, "dark reference white"),
+                    loadReference(sensor, WHITE_REFERENCE_FILE, "white reference"),
+                    EXPOSURE_TIME,
+                    EXPOSURE_TIME_WHITE_REFERENCE,
+                    BACKEND,
+                    fission);
+    handler.setWorkgroups(CUBE_WORKGROUP, SPECTRAL_WORKGROUP1, SPECTRAL_WORKGROUP2);
+
+    // No window or camera is needed for a replay
+    if (!std::string(REPLAY_PATH).empty()) {
+        return runReplay(handler, sensor);
     }
 
-    if (Utils::doesFileExist(DARK_REFERENCE_WHITE_FILE)) {
-        dark_ref_white = Image(sensor, DARK_REFERENCE_WHITE_FILE);
-    }
-    else {
-        std::cerr << "Failed to load dark reference white.\n";
+    // No window either, every camera is processed headless
+    if (CAMERAS > 1) {
+        return runCameras(handler, sensor);
     }
 
-    if (Utils::doesFileExist(WHITE_REFERENCE_FILE)) {
-        white_ref = Image(sensor, WHITE_REFERENCE_FILE);
-    }
-    else {
-        std::cerr << "Failed to load white reference.\n";
-    }
-
-    Handler handler(sensor, dark_ref, dark_ref_white, white_ref, EXPOSURE_TIME, EXPOSURE_TIME_WHITE_REFERENCE);
-
-    // GLFW
-    GLFWwindow* window;
+    // Snapshots and references are written in the background
+    // Captured frames are copied into pooled buffers, which return to the pool once written
+    ImageWriter writer(WRITER_CAPACITY);
+    FramePool capture_pool(static_cast<size_t>(sensor.activeAreaWidth()) * sensor.activeAreaHeight());
+
+    Recording recording;
+    bool record_key_down = false;
+    bool matrix_key_down = false;
+
+    // GLFW, not used when headless
+    GLFWwindow* window = nullptr;
+
+    if (!HEADLESS) {
+        /* Initialize the library */
+        if (!glfwInit())
+            return EXIT_FAILURE;
+
+        // Get monitor content scaling
+        auto monitor = glfwGetPrimaryMonitor();
+        if (!monitor) {
+            std::cerr << "No monitor found, set HEADLESS to run without a window\n";
+            glfwTerminate();
+            return EXIT_FAILURE;
+        }
 
-    /* Initialize the library */
-    if (!glfwInit())
-        return EXIT_FAILURE;
+        float scale_x, scale_y;
+        glfwGetMonitorContentScale(monitor, &scale_x, &scale_y);
 
-    // Get monitor content scaling
-    auto monitor = glfwGetPrimaryMonitor();
-    if (!monitor) {
-        glfwTerminate();
-        return EXIT_FAILURE;
-    }
+        // Disable window resizing
+        glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
 
-    float scale_x, scale_y;
-    glfwGetMonitorContentScale(monitor, &scale_x, &scale_y);
+        /* Create a windowed mode window and its OpenGL context */
+        window = glfwCreateWindow(screen_width * multiply, screen_height * multiply, "HyperspectralCalibration", NULL, NULL);
+        if (!window) {
+            glfwTerminate();
+            return EXIT_FAILURE;
+        }
 
-    // Disable window resizing
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+        /* Make the window's context current */
+        glfwMakeContextCurrent(window);
 
-    /* Create a windowed mode window and its OpenGL context */
-    window = glfwCreateWindow(screen_width * multiply, screen_height * multiply, "HyperspectralCalibration", NULL, NULL);
-    if (!window) {
-        glfwTerminate();
-        return EXIT_FAILURE;
+        // Set starting position and zooming
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelZoom(multiply * scale_x, -multiply * scale_y);
+        glRasterPos2i(-1, 1);
     }
 
-    /* Make the window's context current */
-    glfwMakeContextCurrent(window);
-
-    // Set starting position and zooming
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelZoom(multiply * scale_x, -multiply * scale_y);
-    glRasterPos2i(-1, 1);
-
     // Setup XIMEA Camera
     HANDLE handle = NULL;
     XI_RETURN status = XI_OK;
@@ -222,7 +986,11 @@ int main() {
 
     if (status != XI_OK) {
         std::cerr << "Error after xiOpenDevice\n";
-        glfwTerminate();
+
+        if (window) {
+            glfwTerminate();
+        }
+
         return EXIT_FAILURE;
     }
 
@@ -244,13 +1012,37 @@ int main() {
         goto finish;
     }
 
-    // Setting image data format to raw 16 bit
-    status = xiSetParamInt(handle, XI_PRM_IMAGE_DATA_FORMAT, XI_RAW16);
+    if (ACQUISITION_FORMAT == PixelFormat::PACKED10) {
+        // Setting image data format to 10 bit transport data packed least significant bits first
+        status = xiSetParamInt(handle, XI_PRM_IMAGE_DATA_FORMAT, XI_FRM_TRANSPORT_DATA);
 
-    if (status != XI_OK) {
-        std::cerr << "Error after xiSetParam format 16bit raw\n";
-        program_return = EXIT_FAILURE;
-        goto finish;
+        if (status == XI_OK) {
+            status = xiSetParamInt(handle, XI_PRM_OUTPUT_DATA_BIT_DEPTH, XI_BPP_10);
+        }
+
+        if (status == XI_OK) {
+            status = xiSetParamInt(handle, XI_PRM_OUTPUT_DATA_PACKING, XI_ON);
+        }
+
+        if (status == XI_OK) {
+            status = xiSetParamInt(handle, XI_PRM_OUTPUT_DATA_PACKING_TYPE, XI_DATA_PACK_PFNC_LSB_PACKING);
+        }
+
+        if (status != XI_OK) {
+            std::cerr << "Error after xiSetParam format 10bit packed\n";
+            program_return = EXIT_FAILURE;
+            goto finish;
+        }
+    }
+    else {
+        // Setting image data format to raw 16 bit
+        status = xiSetParamInt(handle, XI_PRM_IMAGE_DATA_FORMAT, XI_RAW16);
+
+        if (status != XI_OK) {
+            std::cerr << "Error after xiSetParam format 16bit raw\n";
+            program_return = EXIT_FAILURE;
+            goto finish;
+        }
     }
 
     // Get XIMEA Image
@@ -262,9 +1054,9 @@ int main() {
     status = xiGetParamInt(handle, XI_PRM_IMAGE_PAYLOAD_SIZE, &buffer_size);
 
     // Check buffer_size corresponds to calibration file
-    if (buffer_size != sensor.sensorWidth() * sensor.sensorHeight() * PIXEL_BYTE_SIZE) {
+    if (static_cast<size_t>(buffer_size) != acquiredFrameSize(sensor)) {
         std::cerr << "Buffer_size does not correspond to calibration file\n";
-        std::cerr << "Buffer_size = " << buffer_size << "; calibration_file = " << sensor.sensorWidth() * sensor.sensorHeight() * PIXEL_BYTE_SIZE << "\n";
+        std::cerr << "Buffer_size = " << buffer_size << "; calibration_file = " << acquiredFrameSize(sensor) << "\n";
         program_return = EXIT_FAILURE;
         goto finish;
     }
@@ -280,7 +1072,7 @@ int main() {
 
     inAcquisition = true;
 
-    try
+    try
     {
         if (COMPARISON_ITERATIONS > 0) {
             std::cout << "Comparison started with repeat time: " << COMPARISON_ITERATIONS << "\n";
@@ -319,10 +1111,18 @@ int main() {
                 }
 
                 auto raw_data = reinterpret_cast<uint16_t*>(ximea_image.bp);
+                auto packed_data = static_cast<const uint8_t*>(ximea_image.bp);
 
                 // C++
                 auto offset_start = std::chrono::system_clock::now();
-                handler.offset(raw_data, image);
+
+                if (ACQUISITION_FORMAT == PixelFormat::PACKED10) {
+                    handler.offsetPacked(packed_data, image);
+                }
+                else {
+                    handler.offset(raw_data, image);
+                }
+
                 auto cube_and_reflection_start = std::chrono::system_clock::now();
                 handler.convertToCubeAndReflectionCorrection(image);
                 auto spectral_start = std::chrono::system_clock::now();
@@ -333,7 +1133,14 @@ int main() {
 
                 // OpenCL
                 auto offset_opencl_start = std::chrono::system_clock::now();
-                handler.offsetOpenCL(raw_data, image_opencl);
+
+                if (ACQUISITION_FORMAT == PixelFormat::PACKED10) {
+                    handler.offsetPackedOpenCL(packed_data, image_opencl);
+                }
+                else {
+                    handler.offsetOpenCL(raw_data, image_opencl);
+                }
+
                 auto cube_and_reflection_opencl_start = std::chrono::system_clock::now();
                 handler.convertToCubeAndReflectionCorrectionOpenCL(image);
                 auto spectral_opencl_start = std::chrono::system_clock::now();
@@ -344,10 +1151,14 @@ int main() {
 
                 // Render
                 auto render_start = std::chrono::system_clock::now();
-                glClear(GL_COLOR_BUFFER_BIT);
-                glDrawPixels(screen_width, screen_height, GL_RGB, GL_UNSIGNED_SHORT, output_opencl.data());
-                glfwSwapBuffers(window);
-                glfwPollEvents();
+
+                if (window) {
+                    glClear(GL_COLOR_BUFFER_BIT);
+                    glDrawPixels(screen_width, screen_height, GL_RGB, GL_UNSIGNED_SHORT, output_opencl.data());
+                    glfwSwapBuffers(window);
+                    glfwPollEvents();
+                }
+
                 auto render_end = std::chrono::system_clock::now();
 
                 // Get image
@@ -417,107 +1228,167 @@ int main() {
             std::cout << "\nComparison done.\n";
         }
 
+        if (HEADLESS) {
+            runHeadless(handler, sensor, handle, ximea_image, recording, writer, capture_pool);
+            goto finish;
+        }
+
+        // Acquisition and correction run on their own threads, this thread renders and polls the keys
+        // Everything touching the handler or the recorders is run between frames by the correction thread
+        std::atomic<int> colourmap_band(band_index);
+
+        // Heap allocations and presented frames when I was last pressed
+        uint64_t info_allocations = heapAllocations();
+        uint64_t info_frames = 0;
+
+        Pipeline pipeline(sensor, acquiredFrameSize(sensor), PIPELINE_SLOTS,
+            [handle, &ximea_image](PipelineFrame& frame) {
+                acquireFrame(handle, ximea_image, frame);
+                return true;
+            },
+            [&handler, &recording, &colourmap_band](PipelineFrame& frame) {
+                processFrame(handler, frame.raw.data(), frame.image, &frame.times);
+
+                // Frames the disk cannot keep up with are dropped and counted by the recorders
+                if (recording.raw) {
+                    recording.raw->record(frame.raw.data());
+                }
+
+                if (recording.cube) {
+                    recordCube(recording, frame.image);
+                }
+
+                colourmapFrame(handler, frame, colourmap_band.load());
+            },
+            BACKPRESSURE_POLICY, BACKPRESSURE_EVERY_NTH);
+
         /* Loop until the user closes the window */
         while (!glfwWindowShouldClose(window)) {
-            auto start = std::chrono::system_clock::now();
-            // Getting image from camera
-            status = xiGetImage(handle, 1000, &ximea_image);
+            auto frame = pipeline.present(std::chrono::milliseconds(1000));
 
-            if (status != XI_OK) {
-                std::cerr << "Error after xiGetImage\n";
-                program_return = EXIT_FAILURE;
-                goto finish;
+            if (!frame) {
+                glfwPollEvents();
+                continue;
             }
 
-            auto raw_data = reinterpret_cast<uint16_t*>(ximea_image.bp);
-            Image image(sensor);
-            auto end = std::chrono::system_clock::now();
-            std::chrono::duration<double> time = end - start;
-            get_image_time = time.count();
+            auto stats = pipeline.stats();
+            get_image_time = stats.frames_acquired > 0 ? stats.acquisition_seconds / stats.frames_acquired : 0;
+            offset_correction_time = frame->times.offset_correction;
+            converttocube_reflection_correction_time = frame->times.converttocube_reflection_correction;
+            spectral_correction_time = frame->times.spectral_correction;
+            getoneband_colourmap_time = frame->colourmap_time;
 
-            start = std::chrono::system_clock::now();
-            handler.offset(raw_data, image);
-            end = std::chrono::system_clock::now();
-            time = end - start;
-            offset_correction_time = time.count();
+            // References are set by the correction thread, which does not reuse the presented slot before the command ran
+            auto& image = frame->image;
 
-            if (GetKeyState('W') & KEY_PRESS_MASK) {
-                takeWhiteReference(handler, image);
+            if ((GetKeyState('W') & KEY_PRESS_MASK) && areYouSure()) {
+                pipeline.runBetweenFrames([&handler, &writer, &capture_pool, &image] { takeWhiteReference(handler, writer, capture_pool, image); });
             }
 
-            if (GetKeyState('D') & KEY_PRESS_MASK) {
-                takeDarkReference(handler, image);
+            if ((GetKeyState('D') & KEY_PRESS_MASK) && areYouSure()) {
+                pipeline.runBetweenFrames([&handler, &writer, &capture_pool, &image] { takeDarkReference(handler, writer, capture_pool, image); });
             }
 
-            if (GetKeyState('A') & KEY_PRESS_MASK) {
-                takeDarkReferenceWhite(handler, image);
+            if ((GetKeyState('A') & KEY_PRESS_MASK) && areYouSure()) {
+                pipeline.runBetweenFrames([&handler, &writer, &capture_pool, &image] { takeDarkReferenceWhite(handler, writer, capture_pool, image); });
             }
 
             if (GetKeyState('I') & KEY_PRESS_MASK) {
                 printInfo(EXPOSURE_TIME, band_index, get_image_time, offset_correction_time, converttocube_reflection_correction_time, spectral_correction_time, getoneband_colourmap_time, render_time);
+                printPipelineStats(stats);
+                printAllocations(capture_pool.stats(), heapAllocations() - info_allocations, stats.frames_presented - info_frames);
+                info_allocations = heapAllocations();
+                info_frames = stats.frames_presented;
+
+                pipeline.runBetweenFrames([&recording] {
+                    if (recording.raw) {
+                        printRecorderStats("Raw recording", recording.raw->stats());
+                    }
+
+                    if (recording.cube) {
+                        printRecorderStats("Cube recording", recording.cube->stats());
+                    }
+                });
             }
 
-            if (GetKeyState(VK_SPACE) & KEY_PRESS_MASK) {
-                takeImage(image);
+            // Toggle only once per key press
+            auto record_key = (GetKeyState('R') & KEY_PRESS_MASK) != 0;
+
+            if (record_key && !record_key_down) {
+                pipeline.runBetweenFrames([&recording, &sensor] {
+                    if (recording.raw || recording.cube) {
+                        stopRecording(recording, sensor);
+                    }
+                    else {
+                        startRecording(recording, sensor);
+                    }
+                });
             }
 
+            record_key_down = record_key;
+
+            // Switches between frames, takes effect on the next processed frame
+            auto matrix_key = (GetKeyState('M') & KEY_PRESS_MASK) != 0;
+
+            if (matrix_key && !matrix_key_down) {
+                pipeline.runBetweenFrames([&handler, &sensor] { nextCorrectionMatrix(handler, sensor); });
+            }
+
+            matrix_key_down = matrix_key;
+
             if (GetKeyState(VK_RIGHT) & KEY_PRESS_MASK) {
                 incrementBand(sensor, band_index);
+                colourmap_band = band_index;
             }
 
             if (GetKeyState(VK_LEFT) & KEY_PRESS_MASK) {
                 decrementBand(sensor, band_index);
+                colourmap_band = band_index;
             }
 
+            printWriteResults(writer);
+
             if (GetKeyState(VK_ESCAPE) & KEY_PRESS_MASK) {
                 std::cout << "Exiting program.\n";
                 break;
             }
 
-            start = std::chrono::system_clock::now();
-            handler.convertToCubeAndReflectionCorrectionOpenCL(image);
-            end = std::chrono::system_clock::now();
-            time = end - start;
-            converttocube_reflection_correction_time = time.count();
-
-            start = std::chrono::system_clock::now();
-            handler.spectralCorrectionOpenCL(image, SPECTRAL_WORKGROUP1, SPECTRAL_WORKGROUP2);
-            end = std::chrono::system_clock::now();
-            time = end - start;
-            spectral_correction_time = time.count();
-
-            std::vector<uint16_t> pixels;
-            start = std::chrono::system_clock::now();
-            handler.getOneBandAndColourmap(pixels, image, band_index);
-            end = std::chrono::system_clock::now();
-            time = end - start;
-            getoneband_colourmap_time = time.count();
-
-            start = std::chrono::system_clock::now();
+            if (GetKeyState(VK_SPACE) & KEY_PRESS_MASK) {
+                takeImage(writer, capture_pool, sensor, image);
+            }
+
+            auto start = std::chrono::system_clock::now();
             /* Render here */
             glClear(GL_COLOR_BUFFER_BIT);
 
-            glDrawPixels(screen_width, screen_height, GL_RGB, GL_UNSIGNED_SHORT, pixels.data());
+            glDrawPixels(screen_width, screen_height, GL_RGB, GL_UNSIGNED_SHORT, frame->pixels.data());
 
             /* Swap front and back buffers */
             glfwSwapBuffers(window);
 
             /* Poll for and process events */
             glfwPollEvents();
-            end = std::chrono::system_clock::now();
-            time = end - start;
+            auto end = std::chrono::system_clock::now();
+            std::chrono::duration<double> time = end - start;
             render_time = time.count();
         }
-    }
-    catch (const std::exception& e)
-    {
-        program_return = EXIT_FAILURE;
-        std::cerr << "Exception thrown:\n";
-        std::cerr << e.what();
-        goto finish;
+    }
+    catch (const std::exception& e)
+    {
+        program_return = EXIT_FAILURE;
+        std::cerr << "Exception thrown:\n";
+        std::cerr << e.what();
+        goto finish;
     }
 
 finish:
+    if (recording.raw || recording.cube) {
+        stopRecording(recording, sensor);
+    }
+
+    writer.flush();
+    printWriteResults(writer);
+
     if (inAcquisition) {
         status = xiStopAcquisition(handle);
 
@@ -531,7 +1402,9 @@ finish:
         xiCloseDevice(handle);
     }
 
-    glfwTerminate();
+    if (window) {
+        glfwTerminate();
+    }
 
     return program_return;
 }
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "mappedfile.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filepath)
+    : data_(nullptr)
+    , size_(0)
+    , file_handle_(INVALID_HANDLE_VALUE)
+    , mapping_handle_(nullptr) {
+    // FILE_SHARE_DELETE lets ImageWriter replace the file while it is mapped, the mapping keeps the old contents
+    file_handle_ = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if (file_handle_ == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("MappedFile failed to open \"" + filepath + "\"");
+    }
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(file_handle_, &size)) {
+        CloseHandle(file_handle_);
+        throw std::runtime_error("MappedFile failed to get size of \"" + filepath + "\"");
+    }
+
+    size_ = static_cast<size_t>(size.QuadPart);
+
+    // Empty files cannot be mapped
+    if (size_ == 0) {
+        return;
+    }
+
+    mapping_handle_ = CreateFileMappingA(file_handle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mapping_handle_ == nullptr) {
+        CloseHandle(file_handle_);
+        throw std::runtime_error("MappedFile failed to map \"" + filepath + "\"");
+    }
+
+    data_ = MapViewOfFile(mapping_handle_, FILE_MAP_READ, 0, 0, 0);
+
+    if (data_ == nullptr) {
+        CloseHandle(mapping_handle_);
+        CloseHandle(file_handle_);
+        throw std::runtime_error("MappedFile failed to map \"" + filepath + "\"");
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+    }
+
+    if (mapping_handle_ != nullptr) {
+        CloseHandle(mapping_handle_);
+    }
+
+    CloseHandle(file_handle_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filepath)
+    : data_(nullptr)
+    , size_(0) {
+    auto file = open(filepath.c_str(), O_RDONLY);
+
+    if (file < 0) {
+        throw std::runtime_error("MappedFile failed to open \"" + filepath + "\"");
+    }
+
+    struct stat status;
+
+    if (fstat(file, &status) != 0) {
+        close(file);
+        throw std::runtime_error("MappedFile failed to get size of \"" + filepath + "\"");
+    }
+
+    size_ = static_cast<size_t>(status.st_size);
+
+    // Empty files cannot be mapped
+    if (size_ != 0) {
+        auto data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+
+        if (data == MAP_FAILED) {
+            close(file);
+            throw std::runtime_error("MappedFile failed to map \"" + filepath + "\"");
+        }
+
+        // Frames are read front to back
+        madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = data;
+    }
+
+    // The mapping stays valid after closing the descriptor
+    close(file);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(const_cast<void*>(data_), size_);
+    }
+}
+
+#endif
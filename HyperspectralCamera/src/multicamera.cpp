@@ -0,0 +1,313 @@
+#include "multicamera.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+// ----- MultiCameraStats -----
+
+uint64_t MultiCameraStats::framesProcessed() const {
+    uint64_t frames = 0;
+
+    for (auto& camera : cameras) {
+        frames += camera.frames_processed;
+    }
+
+    return frames;
+}
+
+// ----- MultiCamera -----
+
+MultiCamera::MultiCamera(const Handler& handler, size_t frame_size, std::vector<CameraInput> cameras, FrameFunction on_frame,
+                         unsigned int workers, size_t slots, bool drop_when_full)
+    : handler_(handler)
+    , on_frame_(std::move(on_frame))
+    , drop_when_full_(drop_when_full)
+    , next_camera_(0)
+    , stop_(false)
+    , start_(std::chrono::steady_clock::now()) {
+    if (cameras.empty()) {
+        throw std::runtime_error("MultiCamera needs at least 1 camera");
+    }
+
+    if (slots == 0) {
+        throw std::runtime_error("MultiCamera slots must not be 0");
+    }
+
+    auto sensor = handler.getSensor();
+
+    for (auto& input : cameras) {
+        if (!input.calibration) {
+            throw std::runtime_error("MultiCamera camera \"" + input.name + "\" has no calibration");
+        }
+
+        auto camera = std::make_unique<Camera>();
+        camera->input = std::move(input);
+
+        for (size_t i = 0; i <= slots; i++) {
+            auto frame = std::make_unique<PipelineFrame>();
+            frame->raw.resize(frame_size);
+            frame->image = Image(sensor);
+
+            camera->frames.push_back(std::move(frame));
+
+            if (i < slots) {
+                camera->free.push_back(i);
+            }
+        }
+
+        cameras_.push_back(std::move(camera));
+    }
+
+    if (workers == 0) {
+        workers = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for (unsigned int i = 0; i < workers; i++) {
+        workers_.emplace_back(&MultiCamera::runWorker, this);
+    }
+
+    for (size_t i = 0; i < cameras_.size(); i++) {
+        cameras_[i]->thread = std::thread(&MultiCamera::runAcquisition, this, i);
+    }
+}
+
+MultiCamera::~MultiCamera() {
+    stop();
+}
+
+void MultiCamera::runAcquisition(size_t index) {
+    auto& camera = *cameras_[index];
+    auto spare_slot = camera.frames.size() - 1;
+
+    try {
+        while (true) {
+            size_t slot = spare_slot;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+
+                if (!drop_when_full_) {
+                    slot_freed_.wait(lock, [this, &camera] { return stop_ || !camera.free.empty(); });
+                }
+
+                if (stop_) {
+                    break;
+                }
+
+                if (!camera.free.empty()) {
+                    slot = camera.free.back();
+                    camera.free.pop_back();
+                }
+            }
+
+            // Only this thread writes frames_acquired
+            auto& frame = *camera.frames[slot];
+            auto sequence = camera.stats.frames_acquired;
+
+            if (!camera.input.acquire(frame)) {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                if (slot != spare_slot) {
+                    camera.free.push_back(slot);
+                }
+
+                break;
+            }
+
+            frame.sequence = sequence;
+            frame.acquired_at = std::chrono::steady_clock::now();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                camera.stats.frames_acquired++;
+
+                if (slot == spare_slot) {
+                    camera.stats.frames_dropped++;
+                    continue;
+                }
+
+                camera.ready.push_back(slot);
+            }
+
+            work_available_.notify_one();
+        }
+    }
+    catch (...) {
+        fail(std::current_exception());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        camera.acquisition_done = true;
+    }
+
+    // Idle workers check whether every camera is done
+    work_available_.notify_all();
+    frame_done_.notify_all();
+}
+
+void MultiCamera::runWorker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!stop_) {
+        size_t index;
+        size_t slot;
+
+        if (!takeFrame(index, slot)) {
+            if (acquisitionDone()) {
+                break;
+            }
+
+            work_available_.wait(lock);
+            continue;
+        }
+
+        auto& camera = *cameras_[index];
+        camera.processing = true;
+        lock.unlock();
+
+        auto& frame = *camera.frames[slot];
+        auto start = std::chrono::steady_clock::now();
+
+        try {
+            if (camera.input.format == PixelFormat::PACKED10) {
+                handler_.processPacked(*camera.input.calibration, frame.raw.data(), frame.image, &frame.times);
+            }
+            else {
+                handler_.process(*camera.input.calibration, reinterpret_cast<const uint16_t*>(frame.raw.data()), frame.image, &frame.times);
+            }
+
+            if (on_frame_) {
+                on_frame_(index, frame);
+            }
+        }
+        catch (...) {
+            fail(std::current_exception());
+        }
+
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        camera.processing = false;
+        camera.stats.frames_processed++;
+        camera.stats.processing_seconds += seconds;
+        camera.free.push_back(slot);
+
+        // The camera may have more frames ready, which no worker took while this one was processed
+        slot_freed_.notify_all();
+        work_available_.notify_all();
+        frame_done_.notify_all();
+    }
+}
+
+bool MultiCamera::takeFrame(size_t& camera, size_t& slot) {
+    for (size_t i = 0; i < cameras_.size(); i++) {
+        auto index = (next_camera_ + i) % cameras_.size();
+        auto& candidate = *cameras_[index];
+
+        if (candidate.processing || candidate.ready.empty()) {
+            continue;
+        }
+
+        camera = index;
+        slot = candidate.ready.front();
+        candidate.ready.pop_front();
+
+        // The next search starts after the served camera
+        next_camera_ = (index + 1) % cameras_.size();
+
+        return true;
+    }
+
+    return false;
+}
+
+bool MultiCamera::acquisitionDone() const {
+    for (auto& camera : cameras_) {
+        if (!camera->acquisition_done || !camera->ready.empty()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MultiCamera::fail(std::exception_ptr error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (!error_) {
+            error_ = error;
+        }
+
+        stop_ = true;
+    }
+
+    work_available_.notify_all();
+    slot_freed_.notify_all();
+    frame_done_.notify_all();
+}
+
+void MultiCamera::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    frame_done_.wait(lock, [this] {
+        if (stop_) {
+            return true;
+        }
+
+        for (auto& camera : cameras_) {
+            if (camera->processing) {
+                return false;
+            }
+        }
+
+        return acquisitionDone();
+    });
+
+    if (error_) {
+        auto error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void MultiCamera::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+
+    work_available_.notify_all();
+    slot_freed_.notify_all();
+    frame_done_.notify_all();
+
+    for (auto& camera : cameras_) {
+        if (camera->thread.joinable()) {
+            camera->thread.join();
+        }
+    }
+
+    for (auto& worker : workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+MultiCameraStats MultiCamera::stats() const {
+    MultiCameraStats stats;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (auto& camera : cameras_) {
+            stats.cameras.push_back(camera->stats);
+        }
+    }
+
+    stats.workers = workers();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+
+    return stats;
+}
@@ -0,0 +1,192 @@
+#include "openclcontext.hpp"
+
+#include "filepaths.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iostream>
+
+// ----- OpenCLContext -----
+
+OpenCLContext::OpenCLContext(const Sensor& sensor, cl_device_type device_type, bool allow_fallback, const DeviceFission& fission)
+    : sensor_(sensor)
+    , cpu_device_(false) {
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+
+    // Take the first platform providing a device of the requested type
+    std::vector<cl::Device> devices;
+
+    for (const auto& platform : platforms) {
+        platform.getDevices(device_type, &devices);
+
+        if (devices.size() != 0) {
+            break;
+        }
+    }
+
+    // Fall back to a CPU OpenCL implementation on hosts without GPU
+    if (devices.size() == 0 && allow_fallback) {
+        for (const auto& platform : platforms) {
+            platform.getDevices(CL_DEVICE_TYPE_CPU, &devices);
+
+            if (devices.size() != 0) {
+                break;
+            }
+        }
+    }
+
+    if (devices.size() == 0) {
+        throw std::runtime_error("OpenCL 0 devices");
+    }
+
+    device_ = devices.front();
+    cpu_device_ = device_.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU;
+
+    compute_device_ = device_;
+
+    if (cpu_device_ && fission.enabled) {
+        createSubDevice(fission);
+    }
+
+    context_ = cl::Context(compute_device_);
+
+    // Programs are independent, build them in parallel
+    auto convert_to_cube_and_reflection_correction_program = std::async(std::launch::async, [this]() {
+        return buildProgram(CONVERT_TO_CUBE_AND_REFLECTION_CORRECTION_FILE, "convert to cube and reflection correction");
+    });
+
+    auto spectral_correction_program = std::async(std::launch::async, [this]() {
+        return buildProgram(SPECTRAL_CORRECTION_FILE, "spectral correction");
+    });
+
+    auto offset_correction_program = std::async(std::launch::async, [this]() {
+        return buildProgram(OFFSET_FILE, "offset correction");
+    });
+
+    auto get_one_band_and_colourmap_program = std::async(std::launch::async, [this]() {
+        return buildProgram(GET_ONE_BAND_AND_COLOURMAP, "get one band and colourmap");
+    });
+
+    convert_to_cube_and_reflection_correction_program_ = convert_to_cube_and_reflection_correction_program.get();
+    spectral_correction_program_ = spectral_correction_program.get();
+    offset_correction_program_ = offset_correction_program.get();
+    get_one_band_and_colourmap_program_ = get_one_band_and_colourmap_program.get();
+
+    // Fail early if a kernel is missing, kernels used for processing are created by every thread
+    createKernels();
+
+    // Initialize buffers
+    cl_int error;
+
+    // Every correction matrix is copied to the device once, switching matrices only selects another buffer
+    std::vector<float> correction_matrices;
+
+    for (size_t i = 0; i < sensor_.numberOfCorrectionMatrices(); i++) {
+        auto& coefficients = sensor_.correctionMatrix(i);
+
+        // The kernels index every matrix of correction_matrices_buffer_ by numberOfBands * numberOfBands
+        if (coefficients.size() != sensor_.numberOfBands() * sensor_.numberOfBands()) {
+            throw std::runtime_error("OpenCL correction matrix " + std::to_string(i) + " has " + std::to_string(coefficients.size()) + " coefficients");
+        }
+
+        correction_matrix_buffers_.emplace_back(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(float) * coefficients.size(), const_cast<float*>(coefficients.data()), &error);
+
+        if (error != 0) {
+            throw std::runtime_error("OpenCL coefficient buffer error");
+        }
+
+        correction_matrices.insert(correction_matrices.end(), coefficients.begin(), coefficients.end());
+    }
+
+    correction_matrices_buffer_ = cl::Buffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR | CL_MEM_HOST_NO_ACCESS, sizeof(float) * correction_matrices.size(), correction_matrices.data(), &error);
+
+    if (error != 0) {
+        throw std::runtime_error("OpenCL correction matrices buffer error");
+    }
+}
+
+void OpenCLContext::createSubDevice(const DeviceFission& fission) {
+    auto partition_properties = device_.getInfo<CL_DEVICE_PARTITION_PROPERTIES>();
+
+    if (std::find(partition_properties.begin(), partition_properties.end(), CL_DEVICE_PARTITION_BY_COUNTS) == partition_properties.end()) {
+        std::cerr << "OpenCL device cannot be partitioned by counts, using the whole device" << std::endl;
+        return;
+    }
+
+    auto compute_units = device_.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+
+    if (fission.reserved_compute_units >= compute_units) {
+        throw std::runtime_error("OpenCL device fission reserves all compute units");
+    }
+
+    // One sub-device with every compute unit that is not reserved
+    const cl_device_partition_property properties[] = {
+        CL_DEVICE_PARTITION_BY_COUNTS,
+        static_cast<cl_device_partition_property>(compute_units - fission.reserved_compute_units),
+        CL_DEVICE_PARTITION_BY_COUNTS_LIST_END,
+        0
+    };
+
+    std::vector<cl::Device> sub_devices;
+
+    if (device_.createSubDevices(properties, &sub_devices) != 0 || sub_devices.empty()) {
+        throw std::runtime_error("OpenCL sub-device error");
+    }
+
+    compute_device_ = sub_devices.front();
+}
+
+cl::Program OpenCLContext::buildProgram(const std::string& file, const std::string& name) const {
+    std::ifstream source_file(file);
+    std::string source{ std::istreambuf_iterator<char>(source_file), std::istreambuf_iterator<char>() };
+
+    cl::Program::Sources sources({ std::make_pair(source.c_str(), source.size() + 1) });
+    cl::Program program(context_, sources);
+
+    auto error = program.build({ compute_device_ });
+
+    if (error != 0) {
+        throw std::runtime_error("OpenCL " + name + " program build error");
+    }
+
+    return program;
+}
+
+OpenCLKernels OpenCLContext::createKernels() const {
+    OpenCLKernels kernels;
+    kernels.convert_to_cube_and_reflection_correction = createKernel(convert_to_cube_and_reflection_correction_program_, "ConvertToCubeAndReflectionCorrection");
+    kernels.convert_to_cube_and_reflection_correction_local = createKernel(convert_to_cube_and_reflection_correction_program_, "ConvertToCubeAndReflectionCorrectionLocal");
+    kernels.convert_to_cube_and_reflection_correction_vector = createKernel(convert_to_cube_and_reflection_correction_program_, "ConvertToCubeAndReflectionCorrectionVector");
+    kernels.spectral_correction = createKernel(spectral_correction_program_, "SpectralCorrection");
+    kernels.spectral_correction_vector = createKernel(spectral_correction_program_, "SpectralCorrectionVector");
+    kernels.spectral_correction_multiple = createKernel(spectral_correction_program_, "SpectralCorrectionMultiple");
+    kernels.offset_correction = createKernel(offset_correction_program_, "OffsetCorrection");
+    kernels.offset_correction_packed = createKernel(offset_correction_program_, "OffsetCorrectionPacked");
+    kernels.get_one_band_and_colourmap = createKernel(get_one_band_and_colourmap_program_, "GetOneBandAndColourmap");
+
+    return kernels;
+}
+
+cl::CommandQueue OpenCLContext::createQueue() const {
+    cl_int error;
+    cl::CommandQueue queue(context_, compute_device_, 0, &error);
+
+    if (error != 0) {
+        throw std::runtime_error("OpenCL queue error");
+    }
+
+    return queue;
+}
+
+cl::Kernel OpenCLContext::createKernel(const cl::Program& program, const std::string& name) const {
+    cl_int error;
+    cl::Kernel kernel(program, name.c_str(), &error);
+
+    if (error != 0) {
+        throw std::runtime_error("OpenCL " + name + " kernel error");
+    }
+
+    return kernel;
+}
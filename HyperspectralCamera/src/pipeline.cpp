@@ -0,0 +1,396 @@
+#include "pipeline.hpp"
+
+#include <stdexcept>
+
+#define BACKOFF_SPINS 64
+#define BACKOFF_YIELDS 128
+#define BACKOFF_SLEEP_US 50
+
+// Empty mailbox
+#define NO_SLOT SIZE_MAX
+
+namespace {
+    // Spins, then yields, then sleeps, so that a waiting stage leaves its core to the busy ones
+    class Backoff {
+        unsigned int count_ = 0;
+
+    public:
+        void pause() {
+            if (count_ >= BACKOFF_YIELDS) {
+                std::this_thread::sleep_for(std::chrono::microseconds(BACKOFF_SLEEP_US));
+                return;
+            }
+
+            if (count_ >= BACKOFF_SPINS) {
+                std::this_thread::yield();
+            }
+
+            count_++;
+        }
+
+        void reset() { count_ = 0; }
+    };
+
+    uint64_t elapsedNanoseconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+// ----- Pipeline -----
+
+Pipeline::Pipeline(const Sensor& sensor, size_t frame_size, size_t slots, AcquireFunction acquire, ProcessFunction process,
+                   BackpressurePolicy policy, unsigned int every_nth, size_t frames_in_flight)
+    : spare_slot_(slots)
+    , policy_(policy)
+    , every_nth_(every_nth)
+    , frames_in_flight_(frames_in_flight)
+    , free_(slots)
+    , acquired_(slots)
+    , processed_(slots)
+    , latest_(NO_SLOT)
+    , acquire_(std::move(acquire))
+    , process_(std::move(process))
+    , stop_(false)
+    , acquisition_done_(false)
+    , processing_done_(false)
+    , commands_pending_(false)
+    , frames_acquired_(0)
+    , frames_processed_(0)
+    , frames_presented_(0)
+    , frames_dropped_(0)
+    , max_acquired_queue_depth_(0)
+    , latency_ns_(0)
+    , max_latency_ns_(0)
+    , acquisition_ns_(0)
+    , processing_ns_(0)
+    , presentation_ns_(0)
+    , start_(std::chrono::steady_clock::now())
+    , presenting_(false)
+    , presented_slot_(0) {
+    if (slots < 2) {
+        throw std::runtime_error("Pipeline needs at least 2 slots");
+    }
+
+    if (every_nth == 0) {
+        throw std::runtime_error("Pipeline every_nth must not be 0");
+    }
+
+    if (frames_in_flight == 0) {
+        throw std::runtime_error("Pipeline frames_in_flight must not be 0");
+    }
+
+    for (size_t i = 0; i <= slots; i++) {
+        auto frame = std::make_unique<PipelineFrame>();
+        frame->raw.resize(frame_size);
+        frame->image = Image(sensor);
+        frame->pixels.reserve(static_cast<size_t>(sensor.spatialWidth()) * sensor.spatialHeight() * COLOURS_PER_PIXEL);
+
+        frames_.push_back(std::move(frame));
+
+        if (i != spare_slot_) {
+            free_.tryPush(i);
+        }
+    }
+
+    acquisition_thread_ = std::thread(&Pipeline::runAcquisition, this);
+    processing_thread_ = std::thread(&Pipeline::runProcessing, this);
+}
+
+Pipeline::~Pipeline() {
+    stop();
+}
+
+void Pipeline::runAcquisition() {
+    Backoff backoff;
+    // Slot of a frame replaced in the mailbox, acquired into next
+    size_t replaced = NO_SLOT;
+
+    try {
+        while (!stop_.load(std::memory_order_relaxed)) {
+            size_t slot;
+            auto sequence = frames_acquired_.load(std::memory_order_relaxed);
+
+            if (policy_ == BackpressurePolicy::EVERY_NTH && sequence % every_nth_ != 0) {
+                slot = spare_slot_;
+            }
+            else if (replaced != NO_SLOT) {
+                slot = replaced;
+                replaced = NO_SLOT;
+            }
+            else if (!free_.tryPop(slot)) {
+                if (policy_ == BackpressurePolicy::BLOCK || policy_ == BackpressurePolicy::EVERY_NTH) {
+                    backoff.pause();
+                    continue;
+                }
+
+                // Correction is behind, the frame is still acquired so the camera does not fall behind too
+                slot = spare_slot_;
+            }
+
+            backoff.reset();
+
+            auto& frame = *frames_[slot];
+            auto start = std::chrono::steady_clock::now();
+
+            if (!acquire_(frame)) {
+                break;
+            }
+
+            frame.sequence = sequence;
+            frame.acquired_at = std::chrono::steady_clock::now();
+            acquisition_ns_.fetch_add(elapsedNanoseconds(start), std::memory_order_relaxed);
+            frames_acquired_.fetch_add(1, std::memory_order_relaxed);
+
+            if (slot == spare_slot_) {
+                frames_dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            if (policy_ == BackpressurePolicy::DROP_OLDEST) {
+                replaced = latest_.exchange(slot, std::memory_order_acq_rel);
+                max_acquired_queue_depth_.store(1, std::memory_order_relaxed);
+
+                if (replaced != NO_SLOT) {
+                    frames_dropped_.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                continue;
+            }
+
+            acquired_.tryPush(slot);
+
+            auto depth = acquired_.size();
+
+            if (depth > max_acquired_queue_depth_.load(std::memory_order_relaxed)) {
+                max_acquired_queue_depth_.store(depth, std::memory_order_relaxed);
+            }
+        }
+    }
+    catch (...) {
+        fail(std::current_exception());
+    }
+
+    acquisition_done_.store(true, std::memory_order_release);
+}
+
+void Pipeline::runProcessing() {
+    Backoff backoff;
+
+    // Slots processed asynchronously, in acquisition order
+    std::vector<size_t> in_flight(frames_.size());
+    size_t in_flight_head = 0;
+    size_t in_flight_count = 0;
+
+    auto handOnFinished = [&]() {
+        if (in_flight_count == 0 || !frames_[in_flight[in_flight_head]]->processed.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        processed_.tryPush(in_flight[in_flight_head]);
+        frames_processed_.fetch_add(1, std::memory_order_relaxed);
+        in_flight_head = (in_flight_head + 1) % in_flight.size();
+        in_flight_count--;
+
+        return true;
+    };
+
+    try {
+        while (!stop_.load(std::memory_order_relaxed)) {
+            if (handOnFinished()) {
+                backoff.reset();
+                continue;
+            }
+
+            size_t slot;
+
+            if (in_flight_count == frames_in_flight_ || !takeAcquired(slot)) {
+                if (in_flight_count > 0 || !acquisition_done_.load(std::memory_order_acquire)) {
+                    runCommands();
+                    backoff.pause();
+                    continue;
+                }
+
+                // Done is set after the last push, so one more pop finds any frame left
+                if (!takeAcquired(slot)) {
+                    break;
+                }
+            }
+
+            backoff.reset();
+
+            // Commands are run after the pop, so a command posted while a frame was presented
+            // runs before that frame's slot can be processed again
+            runCommands();
+
+            auto& frame = *frames_[slot];
+            auto start = std::chrono::steady_clock::now();
+
+            if (frames_in_flight_ == 1) {
+                process_(frame);
+                processing_ns_.fetch_add(elapsedNanoseconds(start), std::memory_order_relaxed);
+                frames_processed_.fetch_add(1, std::memory_order_relaxed);
+
+                processed_.tryPush(slot);
+                continue;
+            }
+
+            // Only the time to start processing is counted
+            frame.processed.store(false, std::memory_order_relaxed);
+            process_(frame);
+            processing_ns_.fetch_add(elapsedNanoseconds(start), std::memory_order_relaxed);
+
+            in_flight[(in_flight_head + in_flight_count) % in_flight.size()] = slot;
+            in_flight_count++;
+        }
+    }
+    catch (...) {
+        fail(std::current_exception());
+    }
+
+    // Asynchronous processing must not outlive the slots
+    while (in_flight_count > 0) {
+        if (!handOnFinished()) {
+            std::this_thread::yield();
+        }
+    }
+
+    processing_done_.store(true, std::memory_order_release);
+}
+
+bool Pipeline::takeAcquired(size_t& slot) {
+    if (policy_ != BackpressurePolicy::DROP_OLDEST) {
+        return acquired_.tryPop(slot);
+    }
+
+    slot = latest_.exchange(NO_SLOT, std::memory_order_acq_rel);
+
+    return slot != NO_SLOT;
+}
+
+void Pipeline::runCommands() {
+    if (!commands_pending_.exchange(false, std::memory_order_acquire)) {
+        return;
+    }
+
+    std::vector<Command> commands;
+
+    {
+        std::lock_guard<std::mutex> lock(commands_mutex_);
+        commands.swap(commands_);
+    }
+
+    for (auto& command : commands) {
+        command();
+    }
+}
+
+void Pipeline::fail(std::exception_ptr error) {
+    {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+
+        if (!error_) {
+            error_ = error;
+        }
+    }
+
+    stop_.store(true);
+}
+
+PipelineFrame* Pipeline::present(std::chrono::milliseconds timeout) {
+    if (presenting_) {
+        presentation_ns_.fetch_add(elapsedNanoseconds(presented_at_), std::memory_order_relaxed);
+
+        // Counted with the presented frame, so the average covers the same frames
+        auto latency = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(presented_at_ - frames_[presented_slot_]->acquired_at).count());
+        latency_ns_.fetch_add(latency, std::memory_order_relaxed);
+
+        if (latency > max_latency_ns_.load(std::memory_order_relaxed)) {
+            max_latency_ns_.store(latency, std::memory_order_relaxed);
+        }
+
+        frames_presented_.fetch_add(1, std::memory_order_relaxed);
+
+        free_.tryPush(presented_slot_);
+        presenting_ = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+
+        if (error_) {
+            auto error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    Backoff backoff;
+    size_t slot;
+
+    while (!processed_.tryPop(slot)) {
+        if (processing_done_.load(std::memory_order_acquire)) {
+            if (processed_.tryPop(slot)) {
+                break;
+            }
+
+            return nullptr;
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return nullptr;
+        }
+
+        backoff.pause();
+    }
+
+    presenting_ = true;
+    presented_slot_ = slot;
+    presented_at_ = std::chrono::steady_clock::now();
+
+    return frames_[slot].get();
+}
+
+bool Pipeline::finished() const {
+    return processing_done_.load(std::memory_order_acquire) && processed_.empty() && !presenting_;
+}
+
+void Pipeline::runBetweenFrames(Command command) {
+    std::lock_guard<std::mutex> lock(commands_mutex_);
+    commands_.push_back(std::move(command));
+    commands_pending_.store(true, std::memory_order_release);
+}
+
+void Pipeline::stop() {
+    stop_.store(true);
+
+    if (acquisition_thread_.joinable()) {
+        acquisition_thread_.join();
+    }
+
+    if (processing_thread_.joinable()) {
+        processing_thread_.join();
+    }
+
+    commands_pending_.store(true);
+    runCommands();
+}
+
+PipelineStats Pipeline::stats() const {
+    PipelineStats stats;
+    stats.frames_acquired = frames_acquired_.load(std::memory_order_relaxed);
+    stats.frames_processed = frames_processed_.load(std::memory_order_relaxed);
+    stats.frames_presented = frames_presented_.load(std::memory_order_relaxed);
+    stats.frames_dropped = frames_dropped_.load(std::memory_order_relaxed);
+    stats.acquired_queue_depth = policy_ == BackpressurePolicy::DROP_OLDEST ? latest_.load(std::memory_order_relaxed) != NO_SLOT : acquired_.size();
+    stats.processed_queue_depth = processed_.size();
+    stats.max_acquired_queue_depth = max_acquired_queue_depth_.load(std::memory_order_relaxed);
+    stats.latency_seconds = latency_ns_.load(std::memory_order_relaxed) * 1e-9;
+    stats.max_latency_seconds = max_latency_ns_.load(std::memory_order_relaxed) * 1e-9;
+    stats.acquisition_seconds = acquisition_ns_.load(std::memory_order_relaxed) * 1e-9;
+    stats.processing_seconds = processing_ns_.load(std::memory_order_relaxed) * 1e-9;
+    stats.presentation_seconds = presentation_ns_.load(std::memory_order_relaxed) * 1e-9;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+
+    return stats;
+}
@@ -0,0 +1,329 @@
+#include "recorder.hpp"
+
+#include "bitpacking.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Unbuffered I/O needs buffers, sizes and file offsets aligned to the sector / page size
+#define RECORDER_ALIGNMENT 4096
+#define RECORDER_CHUNK_SIZE (4 << 20)
+
+namespace {
+    char* alignedAlloc(size_t size) {
+#ifdef _WIN32
+        auto data = static_cast<char*>(_aligned_malloc(size, RECORDER_ALIGNMENT));
+#else
+        auto data = static_cast<char*>(std::aligned_alloc(RECORDER_ALIGNMENT, size));
+#endif
+
+        if (data == nullptr) {
+            throw std::runtime_error("Recorder failed to allocate " + std::to_string(size) + " bytes");
+        }
+
+        return data;
+    }
+
+    void alignedFree(char* data) {
+#ifdef _WIN32
+        _aligned_free(data);
+#else
+        std::free(data);
+#endif
+    }
+}
+
+Recorder::Recorder(const std::string& filename, size_t frame_size, size_t ring_size, unsigned int writes_in_flight, PixelFormat format)
+    : filename_(filename)
+    , format_(format)
+    , frame_samples_(frame_size / sizeof(uint16_t))
+    , frame_size_(format == PixelFormat::PACKED10 ? BitPacking::packedSize(frame_samples_) : frame_size)
+    , chunk_size_(RECORDER_CHUNK_SIZE)
+    , stop_(false)
+    , error_(false)
+    , current_chunk_(0)
+    , current_fill_(0)
+    , next_file_offset_(RECORDER_CHUNK_SIZE)
+    , recorded_size_(0) {
+    if (frame_size_ == 0 || writes_in_flight == 0) {
+        throw std::runtime_error("Recorder frame size and writes in flight must be at least 1");
+    }
+
+    auto number_of_chunks = (ring_size + chunk_size_ - 1) / chunk_size_;
+
+    // A frame may start at the end of one chunk and spans at most this many more
+    if (number_of_chunks < (2 * frame_size_ + chunk_size_ - 1) / chunk_size_ + 1) {
+        throw std::runtime_error("Recorder ring of " + std::to_string(ring_size) + " bytes cannot hold two frames of " + std::to_string(frame_size_) + " bytes");
+    }
+
+#ifdef _WIN32
+    file_ = CreateFileA(filename_.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, nullptr);
+
+    if (file_ == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Recorder failed to open file \"" + filename_ + "\"");
+    }
+#else
+    file_ = -1;
+
+#ifdef O_DIRECT
+    file_ = open(filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#endif
+
+    // File systems without direct I/O (e.g. tmpfs) still get large aligned writes
+    if (file_ < 0) {
+        file_ = open(filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    if (file_ < 0) {
+        throw std::runtime_error("Recorder failed to open file \"" + filename_ + "\"");
+    }
+#endif
+
+    // Whole ring is allocated up front, nothing is allocated while recording
+    if (format_ == PixelFormat::PACKED10) {
+        packed_frame_.resize(frame_size_);
+    }
+
+    chunks_.resize(number_of_chunks);
+
+    for (auto& chunk : chunks_) {
+        chunk = { alignedAlloc(chunk_size_), 0, 0, ChunkState::FREE };
+    }
+
+    chunks_[0].state = ChunkState::FILLING;
+
+    for (unsigned int i = 0; i < writes_in_flight; i++) {
+        writers_.emplace_back(&Recorder::runWriter, this);
+    }
+
+    start_ = std::chrono::steady_clock::now();
+}
+
+Recorder::~Recorder() {
+    try {
+        stop();
+    }
+    catch (const std::runtime_error&) {
+    }
+
+    for (auto& chunk : chunks_) {
+        alignedFree(chunk.data);
+    }
+}
+
+bool Recorder::record(const void* frame) {
+    return append(frame, frame_size_, format_ == PixelFormat::PACKED10);
+}
+
+bool Recorder::record(const void* data, size_t size) {
+    if (size > frame_size_) {
+        throw std::runtime_error("Recorder record of " + std::to_string(size) + " bytes exceeds the frame size of " + std::to_string(frame_size_) + " bytes");
+    }
+
+    return append(data, size, false);
+}
+
+bool Recorder::append(const void* frame, size_t size, bool pack) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (stop_) {
+        throw std::runtime_error("Recorder already stopped");
+    }
+
+    // Check that every chunk the frame spills into has been written already
+    auto remaining = chunk_size_ - current_fill_;
+    auto chunks_needed = size > remaining ? (size - remaining + chunk_size_ - 1) / chunk_size_ : 0;
+
+    for (size_t i = 1; i <= chunks_needed; i++) {
+        if (error_ || chunks_[(current_chunk_ + i) % chunks_.size()].state != ChunkState::FREE) {
+            stats_.frames_dropped++;
+            return false;
+        }
+    }
+
+    lock.unlock();
+
+    // Reserved chunks are only touched by this thread until they are queued, copy without the lock
+    auto source = static_cast<const char*>(frame);
+    auto left = size;
+
+    if (pack) {
+        BitPacking::pack10(static_cast<const uint16_t*>(frame), frame_samples_, packed_frame_.data());
+        source = reinterpret_cast<const char*>(packed_frame_.data());
+    }
+
+    while (left != 0) {
+        if (current_fill_ == chunk_size_) {
+            current_chunk_ = (current_chunk_ + 1) % chunks_.size();
+            current_fill_ = 0;
+
+            lock.lock();
+            chunks_[current_chunk_].state = ChunkState::FILLING;
+            chunks_[current_chunk_].file_offset = next_file_offset_;
+            lock.unlock();
+
+            next_file_offset_ += chunk_size_;
+        }
+
+        auto& chunk = chunks_[current_chunk_];
+        auto count = std::min(left, chunk_size_ - current_fill_);
+
+        std::memcpy(chunk.data + current_fill_, source, count);
+        current_fill_ += count;
+        source += count;
+        left -= count;
+
+        if (current_fill_ == chunk_size_) {
+            lock.lock();
+            chunk.size = chunk_size_;
+            queueChunk(current_chunk_);
+            lock.unlock();
+        }
+    }
+
+    lock.lock();
+    stats_.frames_recorded++;
+    recorded_size_ += size;
+
+    return true;
+}
+
+RecorderStats Recorder::stop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (stop_) {
+        return stats_;
+    }
+
+    // Last partially filled chunk, padded to the alignment and trimmed below
+    if (current_fill_ != 0 && current_fill_ != chunk_size_) {
+        auto& chunk = chunks_[current_chunk_];
+        chunk.size = (current_fill_ + RECORDER_ALIGNMENT - 1) / RECORDER_ALIGNMENT * RECORDER_ALIGNMENT;
+        std::memset(chunk.data + current_fill_, 0, chunk.size - current_fill_);
+        queueChunk(current_chunk_);
+    }
+
+    stop_ = true;
+    chunk_queued_.notify_all();
+    lock.unlock();
+
+    // Writers finish the queue before exiting
+    for (auto& writer : writers_) {
+        writer.join();
+    }
+
+    lock.lock();
+
+    stats_.bytes_written = std::min(stats_.bytes_written, recorded_size_);
+    stats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    size.QuadPart = static_cast<LONGLONG>(recorded_size_);
+    auto trimmed = SetFilePointerEx(file_, size, nullptr, FILE_BEGIN) && SetEndOfFile(file_);
+    CloseHandle(file_);
+#else
+    auto trimmed = ftruncate(file_, static_cast<off_t>(recorded_size_)) == 0;
+    close(file_);
+#endif
+
+    if (error_ || !trimmed) {
+        throw std::runtime_error("Recorder failed to write file \"" + filename_ + "\"");
+    }
+
+    return stats_;
+}
+
+RecorderStats Recorder::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto stats = stats_;
+
+    if (!stop_) {
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+    return stats;
+}
+
+bool Recorder::isRecording() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return !stop_;
+}
+
+void Recorder::queueChunk(size_t chunk_index) {
+    chunks_[chunk_index].state = ChunkState::QUEUED;
+    queue_.push_back(chunk_index);
+    chunk_queued_.notify_one();
+}
+
+void Recorder::runWriter() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        chunk_queued_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+
+        if (queue_.empty()) {
+            return;
+        }
+
+        auto chunk_index = queue_.front();
+        queue_.pop_front();
+        auto chunk = chunks_[chunk_index];
+
+        lock.unlock();
+        auto success = writeChunk(chunk);
+        lock.lock();
+
+        if (success) {
+            stats_.bytes_written += chunk.size;
+        }
+        else {
+            error_ = true;
+        }
+
+        chunks_[chunk_index].state = ChunkState::FREE;
+    }
+}
+
+bool Recorder::writeChunk(const Chunk& chunk) {
+#ifdef _WIN32
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(chunk.file_offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(chunk.file_offset >> 32);
+
+    DWORD written = 0;
+
+    return WriteFile(file_, chunk.data, static_cast<DWORD>(chunk.size), &written, &overlapped) && written == chunk.size;
+#else
+    size_t written = 0;
+
+    while (written < chunk.size) {
+        auto result = pwrite(file_, chunk.data + written, chunk.size - written, static_cast<off_t>(chunk.file_offset + written));
+
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (result <= 0) {
+            return false;
+        }
+
+        written += static_cast<size_t>(result);
+    }
+
+    return true;
+#endif
+}
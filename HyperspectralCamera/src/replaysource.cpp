@@ -0,0 +1,106 @@
+#include "replaysource.hpp"
+
+#include "bitpacking.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+
+ReplaySource::ReplaySource(const std::string& path, const Sensor& sensor, PixelFormat format, double frame_rate, bool loop)
+    : format_(format)
+    , frame_samples_(static_cast<size_t>(sensor.sensorWidth()) * sensor.sensorHeight())
+    , frame_size_(format == PixelFormat::PACKED10 ? BitPacking::packedSize(frame_samples_) : frame_samples_ * sizeof(uint16_t))
+    , frame_rate_(frame_rate)
+    , loop_(loop)
+    , file_index_(0)
+    , frame_index_(0)
+    , frames_in_file_(0)
+    , frames_delivered_(0) {
+    if (frame_samples_ == 0) {
+        throw std::runtime_error("ReplaySource sensor has no pixels");
+    }
+
+    if (std::filesystem::is_directory(path)) {
+        for (const auto& entry : std::filesystem::directory_iterator(path)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".raw") {
+                files_.push_back(entry.path().string());
+            }
+        }
+
+        std::sort(files_.begin(), files_.end());
+    }
+    else if (std::filesystem::is_regular_file(path)) {
+        files_.push_back(path);
+    }
+
+    if (files_.empty()) {
+        throw std::runtime_error("ReplaySource found no frames in \"" + path + "\"");
+    }
+
+    if (format_ == PixelFormat::PACKED10) {
+        unpacked_.resize(frame_samples_);
+    }
+
+    openFile(0);
+}
+
+void ReplaySource::openFile(size_t file_index) {
+    file_.reset();
+    file_ = std::make_unique<MappedFile>(files_[file_index]);
+
+    if (file_->size() == 0 || file_->size() % frame_size_ != 0) {
+        throw std::runtime_error("ReplaySource file \"" + files_[file_index] + "\" of " + std::to_string(file_->size()) + " bytes is not a whole number of " + std::to_string(frame_size_) + " byte frames");
+    }
+
+    file_index_ = file_index;
+    frame_index_ = 0;
+    frames_in_file_ = file_->size() / frame_size_;
+}
+
+const uint16_t* ReplaySource::next() {
+    if (frame_index_ == frames_in_file_) {
+        if (file_index_ + 1 < files_.size()) {
+            openFile(file_index_ + 1);
+        }
+        else if (loop_) {
+            openFile(0);
+        }
+        else {
+            return nullptr;
+        }
+    }
+
+    if (frames_delivered_ == 0) {
+        start_ = std::chrono::steady_clock::now();
+    }
+    else if (frame_rate_ > 0) {
+        // Due times are counted from the first frame, so sleeping late does not accumulate
+        std::this_thread::sleep_until(start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(frames_delivered_ / frame_rate_)));
+    }
+
+    auto frame = static_cast<const uint8_t*>(file_->data()) + frame_index_ * frame_size_;
+    frame_index_++;
+    frames_delivered_++;
+
+    if (format_ == PixelFormat::PACKED10) {
+        BitPacking::unpack10(frame, frame_samples_, unpacked_.data());
+        return unpacked_.data();
+    }
+
+    return reinterpret_cast<const uint16_t*>(frame);
+}
+
+double ReplaySource::seconds() const {
+    if (frames_delivered_ == 0) {
+        return 0;
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+}
+
+double ReplaySource::framesPerSecond() const {
+    auto elapsed = seconds();
+
+    return elapsed > 0 ? frames_delivered_ / elapsed : 0;
+}
@@ -1,5 +1,7 @@
 #include "sensor.hpp"
 
+#include <stdexcept>
+
 Sensor::Sensor()
     : layout_type_(LayoutType::NO_LAYOUT_TYPE)
     , bpp_(0)
@@ -13,4 +15,23 @@ Sensor::Sensor()
     , pattern_height_(0)
     , spatial_width_(0)
     , spatial_height_(0)
-    , number_of_bands_(0) {}
\ No newline at end of file
+    , number_of_bands_(0)
+    , default_correction_matrix_(0) {}
+
+const std::vector<float>& Sensor::correctionMatrix(size_t index) const {
+    if (index >= numberOfCorrectionMatrices()) {
+        throw std::runtime_error("Sensor::correctionMatrix index " + std::to_string(index) + " out of range");
+    }
+
+    return correction_matrices_.empty() ? coefficients_ : correction_matrices_[index].coefficients;
+}
+
+size_t Sensor::correctionMatrixIndex(const std::string& name) const {
+    for (size_t i = 0; i < correction_matrices_.size(); i++) {
+        if (correction_matrices_[i].name == name) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("Sensor has no correction matrix \"" + name + "\"");
+}
\ No newline at end of file
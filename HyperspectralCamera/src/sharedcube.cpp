@@ -0,0 +1,223 @@
+#include "sharedcube.hpp"
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SharedCube::SharedCube(const std::string& name, const Sensor& sensor)
+    : name_(name)
+    , owner_(true)
+    , header_(nullptr)
+    , cube_(nullptr)
+    , cube_size_(static_cast<size_t>(sensor.spatialWidth()) * sensor.spatialHeight() * sensor.numberOfBands())
+    , size_(sizeof(SharedCubeHeader) + cube_size_ * sizeof(uint16_t)) {
+    map(true);
+
+    header_ = new (header_) SharedCubeHeader();
+    header_->spatial_width = sensor.spatialWidth();
+    header_->spatial_height = sensor.spatialHeight();
+    header_->number_of_bands = sensor.numberOfBands();
+    header_->reserved = 0;
+    header_->sequence.store(0);
+    header_->frame_number = 0;
+    header_->version = SHARED_CUBE_VERSION;
+
+    // Readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = SHARED_CUBE_MAGIC;
+}
+
+SharedCube::SharedCube(const std::string& name)
+    : name_(name)
+    , owner_(false)
+    , header_(nullptr)
+    , cube_(nullptr)
+    , cube_size_(0)
+    , size_(0) {
+    map(false);
+
+    if (size_ < sizeof(SharedCubeHeader) || header_->magic != SHARED_CUBE_MAGIC || header_->version != SHARED_CUBE_VERSION) {
+        unmap();
+        throw std::runtime_error("SharedCube \"" + name + "\" is not a shared cube");
+    }
+
+    cube_size_ = static_cast<size_t>(header_->spatial_width) * header_->spatial_height * header_->number_of_bands;
+
+    if (size_ < sizeof(SharedCubeHeader) + cube_size_ * sizeof(uint16_t)) {
+        unmap();
+        throw std::runtime_error("SharedCube \"" + name + "\" is smaller than its cube");
+    }
+}
+
+void SharedCube::publish(const uint16_t* cube, uint64_t frame_number) {
+    if (!owner_) {
+        throw std::runtime_error("SharedCube \"" + name_ + "\" was opened read only");
+    }
+
+    auto sequence = header_->sequence.load(std::memory_order_relaxed);
+
+    // Odd tells readers the cube is changing
+    header_->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::memcpy(cube_, cube, cube_size_ * sizeof(uint16_t));
+    header_->frame_number = frame_number;
+
+    header_->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+SharedCube::~SharedCube() {
+    unmap();
+}
+
+bool SharedCube::read(std::vector<uint16_t>& cube, uint64_t* frame_number) const {
+    cube.resize(cube_size_);
+
+    while (true) {
+        auto before = header_->sequence.load(std::memory_order_acquire);
+
+        if (before == 0) {
+            return false;
+        }
+
+        if (before % 2 != 0) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::memcpy(cube.data(), cube_, cube_size_ * sizeof(uint16_t));
+        auto number = header_->frame_number;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // Unchanged sequence, so no publish overlapped the copy
+        if (header_->sequence.load(std::memory_order_relaxed) == before) {
+            if (frame_number) {
+                *frame_number = number;
+            }
+
+            return true;
+        }
+    }
+}
+
+#ifdef _WIN32
+
+void SharedCube::map(bool create) {
+    mapping_handle_ = nullptr;
+
+    if (create) {
+        auto size = static_cast<uint64_t>(size_);
+        mapping_handle_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), name_.c_str());
+
+        if (mapping_handle_ != nullptr && GetLastError() == ERROR_ALREADY_EXISTS) {
+            CloseHandle(mapping_handle_);
+            throw std::runtime_error("SharedCube \"" + name_ + "\" already exists");
+        }
+    }
+    else {
+        mapping_handle_ = OpenFileMappingA(FILE_MAP_READ, FALSE, name_.c_str());
+    }
+
+    if (mapping_handle_ == nullptr) {
+        throw std::runtime_error("SharedCube failed to " + std::string(create ? "create" : "open") + " \"" + name_ + "\"");
+    }
+
+    auto data = MapViewOfFile(mapping_handle_, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0);
+
+    if (data == nullptr) {
+        CloseHandle(mapping_handle_);
+        throw std::runtime_error("SharedCube failed to map \"" + name_ + "\"");
+    }
+
+    if (!create) {
+        MEMORY_BASIC_INFORMATION information;
+        VirtualQuery(data, &information, sizeof(information));
+        size_ = information.RegionSize;
+    }
+
+    header_ = static_cast<SharedCubeHeader*>(data);
+    cube_ = reinterpret_cast<uint16_t*>(header_ + 1);
+}
+
+void SharedCube::unmap() {
+    if (header_ != nullptr) {
+        UnmapViewOfFile(header_);
+        header_ = nullptr;
+    }
+
+    // The mapping is removed once every process closed it
+    if (mapping_handle_ != nullptr) {
+        CloseHandle(mapping_handle_);
+        mapping_handle_ = nullptr;
+    }
+}
+
+#else
+
+void SharedCube::map(bool create) {
+    auto path = "/" + name_;
+    auto file = create ? shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600) : shm_open(path.c_str(), O_RDONLY, 0);
+
+    if (file < 0) {
+        throw std::runtime_error("SharedCube failed to " + std::string(create ? "create" : "open") + " \"" + name_ + "\"");
+    }
+
+    if (create && ftruncate(file, static_cast<off_t>(size_)) != 0) {
+        close(file);
+        shm_unlink(path.c_str());
+        throw std::runtime_error("SharedCube failed to size \"" + name_ + "\"");
+    }
+
+    if (!create) {
+        struct stat status;
+
+        if (fstat(file, &status) != 0) {
+            close(file);
+            throw std::runtime_error("SharedCube failed to get size of \"" + name_ + "\"");
+        }
+
+        size_ = static_cast<size_t>(status.st_size);
+    }
+
+    auto data = size_ > 0 ? mmap(nullptr, size_, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+
+    // The mapping stays valid after closing the descriptor
+    close(file);
+
+    if (data == MAP_FAILED) {
+        if (create) {
+            shm_unlink(path.c_str());
+        }
+
+        throw std::runtime_error("SharedCube failed to map \"" + name_ + "\"");
+    }
+
+    header_ = static_cast<SharedCubeHeader*>(data);
+    cube_ = reinterpret_cast<uint16_t*>(header_ + 1);
+}
+
+void SharedCube::unmap() {
+    if (header_ != nullptr) {
+        munmap(header_, size_);
+        header_ = nullptr;
+    }
+
+    // Readers keep their mapping, new readers can no longer open it
+    if (owner_) {
+        shm_unlink(("/" + name_).c_str());
+        owner_ = false;
+    }
+}
+
+#endif
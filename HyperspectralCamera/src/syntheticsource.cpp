@@ -0,0 +1,165 @@
+#include "syntheticsource.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+SyntheticSource::SyntheticSource(const Sensor& sensor, const SyntheticOptions& options)
+    : sensor_(sensor)
+    , options_(options)
+    , frame_index_(0)
+    , frames_delivered_(0) {
+    if (sensor_.numberOfBands() == 0 || sensor_.numberOfBands() != sensor_.patternWidth() * sensor_.patternHeight()) {
+        throw std::runtime_error("SyntheticSource sensor must have one band per pattern pixel");
+    }
+
+    if (sensor_.activeAreaWidth() < sensor_.spatialWidth() * sensor_.patternWidth() || sensor_.activeAreaHeight() < sensor_.spatialHeight() * sensor_.patternHeight()) {
+        throw std::runtime_error("SyntheticSource spatial size does not fit the active area");
+    }
+
+    if (sensor_.offsetX() + sensor_.activeAreaWidth() > sensor_.sensorWidth() || sensor_.offsetY() + sensor_.activeAreaHeight() > sensor_.sensorHeight()) {
+        throw std::runtime_error("SyntheticSource active area does not fit the sensor");
+    }
+
+    if (options_.white_level <= options_.dark_level || options_.white_level > PIXEL_MAX) {
+        throw std::runtime_error("SyntheticSource white level must be above the dark level and at most " + std::to_string(PIXEL_MAX));
+    }
+
+    const auto pattern_width = sensor_.patternWidth();
+    const auto pattern_height = sensor_.patternHeight();
+    const auto sensor_width = static_cast<size_t>(sensor_.sensorWidth());
+
+    // Noise-free frame, pixels outside of the mosaic only see the dark level
+    std::vector<float> scene(frameSize(), options_.dark_level);
+    const float range = static_cast<float>(options_.white_level - options_.dark_level);
+
+    for (unsigned int y = 0; y < sensor_.spatialHeight(); y++) {
+        for (unsigned int x = 0; x < sensor_.spatialWidth(); x++) {
+            for (unsigned int band_y = 0; band_y < pattern_height; band_y++) {
+                for (unsigned int band_x = 0; band_x < pattern_width; band_x++) {
+                    // Same band order as the cube, see Handler::convertToCubeAndReflectionCorrection
+                    auto band = band_x + band_y * pattern_width;
+                    auto sensor_x = sensor_.offsetX() + x * pattern_width + band_x;
+                    auto sensor_y = sensor_.offsetY() + y * pattern_height + band_y;
+
+                    scene[sensor_x + sensor_width * sensor_y] += static_cast<float>(reflectance(x, y, band)) * range;
+                }
+            }
+        }
+    }
+
+    std::mt19937 generator(options_.seed);
+    std::normal_distribution<float> noise(0, static_cast<float>(options_.noise));
+
+    // Hot pixels are sensor defects, so every variant has them in the same place
+    std::vector<size_t> hot_pixels(static_cast<size_t>(options_.hot_pixel_fraction * scene.size()));
+    std::uniform_int_distribution<size_t> position(0, scene.size() - 1);
+
+    for (auto& hot_pixel : hot_pixels) {
+        hot_pixel = position(generator);
+    }
+
+    frames_.resize(std::max<size_t>(options_.variants, 1));
+
+    for (auto& frame : frames_) {
+        frame.resize(scene.size());
+
+        for (size_t i = 0; i < scene.size(); i++) {
+            auto value = options_.noise > 0 ? scene[i] + noise(generator) : scene[i];
+            frame[i] = static_cast<uint16_t>(std::clamp(std::lround(value), 0L, static_cast<long>(PIXEL_MAX)));
+        }
+
+        for (auto hot_pixel : hot_pixels) {
+            frame[hot_pixel] = PIXEL_MAX;
+        }
+    }
+}
+
+Sensor SyntheticSource::makeSensor(const SyntheticGeometry& geometry) {
+    Sensor sensor;
+    auto bands = geometry.pattern_width * geometry.pattern_height;
+
+    sensor.setLayoutType(LayoutType::MOSAIC);
+    sensor.setBpp(10);
+    sensor.setPatternWidth(geometry.pattern_width);
+    sensor.setPatternHeight(geometry.pattern_height);
+    sensor.setSpatialWidth(geometry.spatial_width);
+    sensor.setSpatialHeight(geometry.spatial_height);
+    sensor.setNumberOfBands(bands);
+    sensor.setActiveAreaWidth(geometry.spatial_width * geometry.pattern_width);
+    sensor.setActiveAreaHeight(geometry.spatial_height * geometry.pattern_height);
+    sensor.setOffsetX(geometry.offset_x);
+    sensor.setOffsetY(geometry.offset_y);
+    sensor.setSensorWidth(sensor.activeAreaWidth() + 2 * geometry.offset_x);
+    sensor.setSensorHeight(sensor.activeAreaHeight() + 2 * geometry.offset_y);
+
+    auto& coefficients = sensor.mutableCoefficients();
+    coefficients.assign(static_cast<size_t>(bands) * bands, 0);
+
+    for (size_t band = 0; band < bands; band++) {
+        coefficients[band * bands + band] = 1;
+    }
+
+    return sensor;
+}
+
+double SyntheticSource::reflectance(unsigned int x, unsigned int y, unsigned int band) const {
+    const double bands = sensor_.numberOfBands();
+
+    // Peak band moves from left to right, the peak is a quarter of the bands wide
+    auto peak = bands * (x + 0.5) / sensor_.spatialWidth();
+    auto width = std::max(bands / 4, 1.0);
+    auto spectrum = 0.1 + 0.8 * std::exp(-std::pow((band + 0.5 - peak) / width, 2) / 2);
+
+    auto brightness = 1 - 0.5 * y / sensor_.spatialHeight();
+
+    return spectrum * brightness;
+}
+
+Image SyntheticSource::darkReference() const {
+    return Image(sensor_, std::vector<uint16_t>(static_cast<size_t>(sensor_.activeAreaWidth()) * sensor_.activeAreaHeight(), options_.dark_level));
+}
+
+Image SyntheticSource::whiteReference() const {
+    return Image(sensor_, std::vector<uint16_t>(static_cast<size_t>(sensor_.activeAreaWidth()) * sensor_.activeAreaHeight(), options_.white_level));
+}
+
+size_t SyntheticSource::frameSize() const {
+    return static_cast<size_t>(sensor_.sensorWidth()) * sensor_.sensorHeight();
+}
+
+const uint16_t* SyntheticSource::next() {
+    if (options_.frames > 0 && frames_delivered_ == options_.frames) {
+        return nullptr;
+    }
+
+    if (frames_delivered_ == 0) {
+        start_ = std::chrono::steady_clock::now();
+    }
+    else if (options_.frame_rate > 0) {
+        // Due times are counted from the first frame, so sleeping late does not accumulate
+        std::this_thread::sleep_until(start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(frames_delivered_ / options_.frame_rate)));
+    }
+
+    auto frame = frames_[frame_index_].data();
+    frame_index_ = (frame_index_ + 1) % frames_.size();
+    frames_delivered_++;
+
+    return frame;
+}
+
+double SyntheticSource::seconds() const {
+    if (frames_delivered_ == 0) {
+        return 0;
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+}
+
+double SyntheticSource::framesPerSecond() const {
+    auto elapsed = seconds();
+
+    return elapsed > 0 ? frames_delivered_ / elapsed : 0;
+}
@@ -0,0 +1,319 @@
+#include "tilescheduler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+TileScheduler::TileScheduler(const Handler& handler, unsigned int workers, unsigned int tile_rows, size_t frames_in_flight)
+    : handler_(handler)
+    , sensor_(handler.getSensor())
+    , tile_rows_(tile_rows)
+    , tiles_(0)
+    , next_worker_(0)
+    , queued_(0)
+    , stop_(false)
+    , frames_done_(0)
+    , start_(std::chrono::steady_clock::now()) {
+    if (tile_rows == 0 || frames_in_flight == 0) {
+        throw std::runtime_error("TileScheduler tile_rows and frames_in_flight must not be 0");
+    }
+
+    if (workers == 0) {
+        workers = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    tiles_ = (sensor_.spatialHeight() + tile_rows - 1) / tile_rows;
+
+    for (size_t i = 0; i < frames_in_flight; i++) {
+        auto state = std::make_unique<FrameState>();
+        state->spectral = Image(sensor_);
+        frames_.push_back(std::move(state));
+        free_frames_.push_back(i);
+    }
+
+    for (unsigned int i = 0; i < workers; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->busy_ns = 0;
+        worker->tasks_run = 0;
+        worker->steals = 0;
+        workers_.push_back(std::move(worker));
+    }
+
+    // Started once every worker exists, as they steal from each other
+    for (size_t i = 0; i < workers_.size(); i++) {
+        workers_[i]->thread = std::thread(&TileScheduler::runWorker, this, i);
+    }
+}
+
+TileScheduler::~TileScheduler() {
+    try {
+        wait();
+    }
+    catch (...) {
+        // Errors are reported by submit and wait only
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+
+    work_available_.notify_all();
+
+    for (auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+void TileScheduler::submit(const void* input, PixelFormat format, Image& image, std::vector<uint16_t>* pixels, unsigned int band, DoneFunction done) {
+    rethrow();
+
+    if (pixels && band >= sensor_.numberOfBands()) {
+        throw std::runtime_error("TileScheduler::submit band outside of number of bands range");
+    }
+
+    size_t frame;
+    size_t first_worker;
+
+    {
+        std::unique_lock<std::mutex> lock(frames_mutex_);
+        frame_freed_.wait(lock, [this] { return !free_frames_.empty(); });
+
+        frame = free_frames_.back();
+        free_frames_.pop_back();
+
+        first_worker = next_worker_;
+        next_worker_ = (next_worker_ + tiles_) % workers_.size();
+    }
+
+    // Tasks only write rows of full sized outputs
+    auto& state = *frames_[frame];
+    image.mutableData().resize(state.spectral.size());
+    image.mutableCube().resize(state.spectral.cube().size());
+
+    if (pixels) {
+        pixels->resize(static_cast<size_t>(sensor_.spatialWidth()) * sensor_.spatialHeight() * COLOURS_PER_PIXEL);
+    }
+
+    state.input = input;
+    state.format = format;
+    state.image = &image;
+    state.pixels = pixels;
+    state.band = band;
+    state.calibration = handler_.calibration();
+    state.done = std::move(done);
+    state.remaining_tiles = tiles_;
+
+    // Neighbouring tiles go to different workers
+    for (size_t tile = 0; tile < tiles_; tile++) {
+        push((first_worker + tile) % workers_.size(), Task{ frame, tile, TileStage::OFFSET_CORRECTION }, false);
+    }
+}
+
+void TileScheduler::wait() {
+    {
+        std::unique_lock<std::mutex> lock(frames_mutex_);
+        frame_freed_.wait(lock, [this] { return free_frames_.size() == frames_.size(); });
+    }
+
+    rethrow();
+}
+
+void TileScheduler::push(size_t worker, const Task& task, bool next_stage) {
+    {
+        std::lock_guard<std::mutex> lock(workers_[worker]->mutex);
+
+        // The owner takes from the front, thieves from the back
+        if (next_stage) {
+            workers_[worker]->tasks.push_front(task);
+        }
+        else {
+            workers_[worker]->tasks.push_back(task);
+        }
+
+        queued_.fetch_add(1);
+    }
+
+    // The owner runs the next stage itself, new tiles wake a sleeping worker
+    if (!next_stage) {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+        }
+
+        work_available_.notify_one();
+    }
+}
+
+bool TileScheduler::takeTask(size_t index, Task& task) {
+    {
+        auto& own = *workers_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            queued_.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // The newest tiles of the others, i.e. tiles of the next frame
+    for (size_t i = 1; i < workers_.size(); i++) {
+        auto& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            queued_.fetch_sub(1);
+            workers_[index]->steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TileScheduler::runWorker(size_t index) {
+    auto& worker = *workers_[index];
+
+    while (true) {
+        Task task;
+
+        if (takeTask(index, task)) {
+            // Counted before the task runs, so the count is complete once wait returns
+            worker.tasks_run.fetch_add(1, std::memory_order_relaxed);
+
+            auto start = std::chrono::steady_clock::now();
+            run(index, task);
+            worker.busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        work_available_.wait(lock, [this] { return queued_.load() > 0 || stop_; });
+
+        if (stop_ && queued_.load() == 0) {
+            return;
+        }
+    }
+}
+
+void TileScheduler::run(size_t worker, const Task& task) {
+    auto& state = *frames_[task.frame];
+    auto first_row = task.tile * tile_rows_;
+    auto rows = std::min<size_t>(tile_rows_, sensor_.spatialHeight() - first_row);
+
+    try {
+        switch (task.stage) {
+        case TileStage::OFFSET_CORRECTION: {
+            // Active area rows of the tile's macro-pixels, the last tile also takes rows below the last macro-pixel
+            auto first_active_row = first_row * sensor_.patternHeight();
+            auto active_rows = task.tile + 1 == tiles_ ? sensor_.activeAreaHeight() - first_active_row : rows * sensor_.patternHeight();
+
+            if (state.format == PixelFormat::PACKED10) {
+                handler_.offsetPackedRows(static_cast<const uint8_t*>(state.input), *state.image, first_active_row, active_rows);
+            }
+            else {
+                handler_.offsetRows(static_cast<const uint16_t*>(state.input), *state.image, first_active_row, active_rows);
+            }
+
+            break;
+        }
+        case TileStage::CONVERT_TO_CUBE_AND_REFLECTION_CORRECTION:
+            handler_.convertToCubeAndReflectionCorrectionRows(*state.calibration, *state.image, first_row, rows);
+            break;
+        case TileStage::SPECTRAL_CORRECTION:
+            handler_.spectralCorrectionRows(*state.calibration, state.spectral, *state.image, first_row, rows);
+            break;
+        case TileStage::COLOURMAP:
+            handler_.getOneBandAndColourmapRows(*state.pixels, state.spectral, state.band, first_row, rows);
+            break;
+        }
+    }
+    catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex_);
+
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+
+        // The rest of the tile is skipped
+        finishTile(task.frame);
+        return;
+    }
+
+    auto last_stage = state.pixels ? TileStage::COLOURMAP : TileStage::SPECTRAL_CORRECTION;
+
+    if (task.stage == last_stage) {
+        finishTile(task.frame);
+        return;
+    }
+
+    push(worker, Task{ task.frame, task.tile, static_cast<TileStage>(static_cast<int>(task.stage) + 1) }, true);
+}
+
+void TileScheduler::finishTile(size_t frame) {
+    auto& state = *frames_[frame];
+
+    if (state.remaining_tiles.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    // Every tile is done, the corrected cube replaces the cube of the image without copying
+    state.image->mutableCube().swap(state.spectral.mutableCube());
+
+    auto done = std::move(state.done);
+    state.done = nullptr;
+    state.calibration.reset();
+    state.image = nullptr;
+    state.pixels = nullptr;
+
+    frames_done_.fetch_add(1, std::memory_order_relaxed);
+
+    if (done) {
+        try {
+            done();
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex_);
+
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(frames_mutex_);
+        free_frames_.push_back(frame);
+    }
+
+    frame_freed_.notify_all();
+}
+
+void TileScheduler::rethrow() {
+    std::lock_guard<std::mutex> lock(error_mutex_);
+
+    if (error_) {
+        auto error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+TileSchedulerStats TileScheduler::stats() const {
+    TileSchedulerStats stats;
+    stats.frames = frames_done_.load(std::memory_order_relaxed);
+    stats.workers = static_cast<unsigned int>(workers_.size());
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+
+    for (const auto& worker : workers_) {
+        stats.tasks += worker->tasks_run.load(std::memory_order_relaxed);
+        stats.steals += worker->steals.load(std::memory_order_relaxed);
+        stats.busy_seconds += worker->busy_ns.load(std::memory_order_relaxed) * 1e-9;
+    }
+
+    return stats;
+}
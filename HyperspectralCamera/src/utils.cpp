@@ -1,5 +1,6 @@
 #include "utils.hpp"
 
+#include <charconv>
 #include <chrono>
 #include <ctime>
 #include <iomanip>
@@ -23,6 +24,19 @@ LayoutType Utils::getLayoutType(const std::string& layout_type_text) {
     return LayoutType::NO_LAYOUT_TYPE;
 }
 
+std::string Utils::getLayoutTypeText(LayoutType layout_type) {
+    switch (layout_type) {
+    case LayoutType::MOSAIC:
+        return "MOSAIC";
+    case LayoutType::TILED:
+        return "TILED";
+    case LayoutType::WEDGE:
+        return "WEDGE";
+    default:
+        return "NO_LAYOUT_TYPE";
+    }
+}
+
 bool Utils::getBool(const std::string& bool_text) {
     if (bool_text == "true")
         return true;
@@ -33,43 +47,70 @@ bool Utils::getBool(const std::string& bool_text) {
     throw std::runtime_error("GetBool(" + bool_text + ") not valid bool text");
 }
 
-bool Utils::isCharValid(char c) {
-    return c == ' ' || c == ',' || c == '.' || c == '-' || c == 'e' || isdigit(c);
-}
+bool Utils::parseFloatArray(std::vector<float>& output, std::string_view array_text, size_t* error_offset) {
+    auto begin = array_text.data();
+    auto end = begin + array_text.size();
+    auto position = begin;
+
+    auto isWhitespace = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; };
 
-bool Utils::parseFloatArray(std::vector<float>& output, const std::string& array_text) {
-    auto parsing_state = ArrayParseState::WAITING_FOR_COMMA;
-    std::string float_text;
+    auto skipWhitespace = [&]() {
+        auto start = position;
 
-    for (char c : array_text) {
-        // check if char is valid
-        if (!isCharValid(c)) {
-            std::cerr << "ParseFloatArray invalid char \'" << c << "\' in \"" << array_text << "\"";
-            return false;
+        while (position != end && isWhitespace(*position)) {
+            position++;
         }
 
-        if (parsing_state == ArrayParseState::WAITING_FOR_COMMA && c == ',') {
-            parsing_state = ArrayParseState::WAITING_FOR_SPACE;
+        return position != start;
+    };
+
+    auto fail = [&](const char* message) {
+        auto offset = static_cast<size_t>(position - begin);
+
+        if (error_offset) {
+            *error_offset = offset;
+        }
+
+        std::cerr << "ParseFloatArray " << message << " at byte offset " << offset << '\n';
+        return false;
+    };
+
+    skipWhitespace();
+
+    while (position != end) {
+        // from_chars does not take a leading plus
+        if (*position == '+') {
+            position++;
         }
-        else if (parsing_state == ArrayParseState::WAITING_FOR_SPACE && c == ' ') {
-            output.emplace_back(std::stof(float_text));
-            float_text.clear();
 
-            parsing_state = ArrayParseState::WAITING_FOR_COMMA;
+        float value;
+        auto result = std::from_chars(position, end, value);
+
+        if (result.ec == std::errc::result_out_of_range) {
+            return fail("number out of range");
         }
-        else {
-            float_text += c;
+
+        if (result.ec != std::errc()) {
+            return fail("invalid number");
         }
-    }
 
-    // check if parsing ended in invalid state
-    if (parsing_state == ArrayParseState::WAITING_FOR_SPACE) {
-        std::cerr << "ParseFloatArray ended in invalid state \"" << array_text << "\"";
-        return false;
-    }
+        output.push_back(value);
+        position = result.ptr;
 
-    if (!float_text.empty())
-        output.emplace_back(std::stof(float_text));
+        auto separated = skipWhitespace();
+
+        if (position != end && (*position == ',' || *position == ';')) {
+            position++;
+            skipWhitespace();
+
+            if (position == end) {
+                return fail("missing number after separator");
+            }
+        }
+        else if (position != end && !separated) {
+            return fail("invalid character");
+        }
+    }
 
     return true;
 }
@@ -6,6 +6,7 @@
 #include "sensor.hpp"
 #include "utils.hpp"
 
+// Matrix used unless another one is selected at runtime
 #define CORRECTION_MATRIX_NAME "hsi_675-975"
 
 // ----- XmlParser -----
@@ -103,11 +104,21 @@ bool XmlParser::ParseVirtualBands(std::vector<float>& coefficients, pugi::xml_no
             return false;
         }
 
-        auto result = Utils::parseFloatArray(coefficients, data.child_value());
+        // Parsed in place in the document buffer
+        size_t error_offset = 0;
+        auto result = Utils::parseFloatArray(coefficients, data.child_value(), &error_offset);
 
         // Check if virtual band parse was successful
         if (!result) {
-            std::cerr << "XmlParser::ParseVirtualBands parsing virtual bands not successful.\n";
+            auto text_offset = data.first_child().offset_debug();
+
+            if (text_offset >= 0) {
+                std::cerr << "XmlParser::ParseVirtualBands parsing virtual bands not successful at byte offset " << text_offset + error_offset << " of the file.\n";
+            }
+            else {
+                std::cerr << "XmlParser::ParseVirtualBands parsing virtual bands not successful.\n";
+            }
+
             return false;
         }
     }
@@ -116,6 +127,11 @@ bool XmlParser::ParseVirtualBands(std::vector<float>& coefficients, pugi::xml_no
 }
 
 bool XmlParser::ParseCorrectionMatrices(Sensor& sensor, pugi::xml_node node) {
+    auto& correction_matrices = sensor.mutableCorrectionMatrices();
+    correction_matrices.clear();
+    sensor.setDefaultCorrectionMatrix(0);
+    auto found_default = false;
+
     for (auto correction_matrix : node.children("correction_matrix")) {
         if (!correction_matrix) {
             std::cerr << "XmlParser::ParseCorrectionMatrices correction_matrix not valid.\n";
@@ -130,31 +146,53 @@ bool XmlParser::ParseCorrectionMatrices(Sensor& sensor, pugi::xml_node node) {
             return false;
         }
 
-        std::string matrix_name = matrix_name_node.child_value();
+        CorrectionMatrix matrix;
+        matrix.name = matrix_name_node.child_value();
 
-        // check if correct matrix name
-        if (matrix_name != CORRECTION_MATRIX_NAME) {
-            continue;
-        }
+        // Only CORRECTION_MATRIX_NAME is required, other matrices the sensor cannot use are skipped
+        auto is_default = matrix.name == CORRECTION_MATRIX_NAME;
 
         auto virtual_bands = correction_matrix.child("virtual_bands");
 
-        if (!virtual_bands) {
-            std::cerr << "XmlParser::ParseCorrectionMatrices virtual_bands not valid.\n";
-            return false;
+        if (!virtual_bands || !ParseVirtualBands(matrix.coefficients, virtual_bands)) {
+            std::cerr << "XmlParser::ParseCorrectionMatrices virtual bands of " << matrix.name << " parsing failed" << (is_default ? ".\n" : ", skipped.\n");
+
+            if (is_default) {
+                return false;
+            }
+
+            continue;
         }
 
-        auto result = ParseVirtualBands(sensor.mutableCoefficients(), virtual_bands);
+        // Spectral correction reads numberOfBands * numberOfBands coefficients of every matrix
+        auto expected = sensor.numberOfBands() * sensor.numberOfBands();
 
-        if (!result) {
-            std::cerr << "XmlParser::ParseCorrectionMatrices virtual bands parsing failed.\n";
-            return false;
+        if (matrix.coefficients.size() != expected) {
+            std::cerr << "XmlParser::ParseCorrectionMatrices " << matrix.name << " has " << matrix.coefficients.size()
+                      << " coefficients, expected " << expected << (is_default ? ".\n" : ", skipped.\n");
+
+            if (is_default) {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (is_default) {
+            sensor.setDefaultCorrectionMatrix(correction_matrices.size());
+            found_default = true;
         }
 
-        break;
+        correction_matrices.push_back(std::move(matrix));
     }
 
-    // Check if coefficients are empty
+    if (!found_default) {
+        std::cerr << "XmlParser::ParseCorrectionMatrices " << CORRECTION_MATRIX_NAME << " not found.\n";
+        return false;
+    }
+
+    sensor.mutableCoefficients() = correction_matrices[sensor.defaultCorrectionMatrix()].coefficients;
+
     return sensor.coefficients().size() != 0;
 }
 
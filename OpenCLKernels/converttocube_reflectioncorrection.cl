@@ -49,4 +49,174 @@ kernel void ConvertToCubeAndReflectionCorrection(
             pixel_start++;
         }
     }
-}
\ No newline at end of file
+}
+
+// Each work-group converts a strip of get_local_size(0) macro-pixels from one macro-pixel row.
+// The raw rows of the strip are read contiguously and transposed to cube order in local memory,
+// the strip is contiguous in the cube so it is written back contiguously as well.
+// Input is read at (input_offset_x, input_offset_y) with row pitch input_width, so a full sensor
+// frame can be consumed directly without a separate offset correction.
+kernel void ConvertToCubeAndReflectionCorrectionLocal(
+    global const unsigned short* input,
+    global unsigned short* cube,
+    unsigned int input_width,
+    unsigned int input_offset_x,
+    unsigned int input_offset_y,
+    unsigned int width,
+    unsigned int spatial_width,
+    unsigned int pixel_width,
+    unsigned int pixel_height,
+    global const unsigned short* dark_ref_object,
+    global const unsigned short* dark_ref_white,
+    global const unsigned short* white_ref,
+    unsigned int exposure_time_white_ref,
+    unsigned int exposure_time_object,
+    local unsigned short* strip)
+{
+    unsigned int local_id = get_local_id(0);
+    unsigned int group_size = get_local_size(0);
+    unsigned int strip_x = get_group_id(0) * group_size;
+    unsigned int y = get_global_id(1);
+
+    // Last strip of a row may be narrower than the work-group
+    unsigned int strip_width = min(group_size, spatial_width - strip_x);
+    unsigned int number_of_bands = pixel_width * pixel_height;
+    unsigned int row_length = strip_width * pixel_width;
+    unsigned int strip_size = strip_width * number_of_bands;
+
+    const float time_ratio = (float) exposure_time_white_ref / exposure_time_object;
+
+    for (unsigned int k = local_id; k < strip_size; k += group_size) {
+        unsigned int band_y = k / row_length;
+        unsigned int column = k % row_length;
+        unsigned int area_x = strip_x * pixel_width + column;
+        unsigned int area_y = y * pixel_height + band_y;
+        size_t i = area_x + (size_t) width * area_y;
+        size_t input_index = (input_offset_x + area_x) + (size_t) input_width * (input_offset_y + area_y);
+
+        int object = input[input_index] - dark_ref_object[i];
+
+        if (object < 0) {
+            object = 0;
+        }
+
+        const int white = white_ref[i] - dark_ref_white[i];
+        const float object_time_ratio = (float) object / white;
+        const float v = object_time_ratio * time_ratio;
+
+        float result = PIXEL_MAX * v;
+
+        if (result > PIXEL_MAX) {
+            result = PIXEL_MAX;
+        }
+
+        unsigned int macro_pixel = column / pixel_width;
+        unsigned int band_x = column % pixel_width;
+
+        strip[macro_pixel * number_of_bands + band_y * pixel_width + band_x] = (unsigned short) result;
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    size_t cube_start = ((size_t) y * spatial_width + strip_x) * number_of_bands;
+
+    for (unsigned int k = local_id; k < strip_size; k += group_size) {
+        cube[cube_start + k] = strip[k];
+    }
+}
+
+#define VECTOR_WIDTH 8
+#define MAX_NUMBER_OF_BANDS 64
+
+// Variant for CPU runtimes, each work-item converts VECTOR_WIDTH macro-pixels of one macro-pixel row.
+// Raw rows are processed as ushort8 / float8, which maps directly to the host SIMD units.
+// The macro-pixels are contiguous in the cube, so they are staged in cube order and written with vstore8.
+// Input is read like in ConvertToCubeAndReflectionCorrectionLocal.
+kernel void ConvertToCubeAndReflectionCorrectionVector(
+    global const unsigned short* input,
+    global unsigned short* cube,
+    unsigned int input_width,
+    unsigned int input_offset_x,
+    unsigned int input_offset_y,
+    unsigned int width,
+    unsigned int spatial_width,
+    unsigned int pixel_width,
+    unsigned int pixel_height,
+    global const unsigned short* dark_ref_object,
+    global const unsigned short* dark_ref_white,
+    global const unsigned short* white_ref,
+    unsigned int exposure_time_white_ref,
+    unsigned int exposure_time_object)
+{
+    unsigned int x = get_global_id(0) * VECTOR_WIDTH;
+    unsigned int y = get_global_id(1);
+
+    if (x >= spatial_width) {
+        return;
+    }
+
+    unsigned int count = min((unsigned int) VECTOR_WIDTH, spatial_width - x);
+    unsigned int number_of_bands = pixel_width * pixel_height;
+    unsigned int row_length = count * pixel_width;
+    unsigned int strip_size = count * number_of_bands;
+    size_t cube_start = ((size_t) y * spatial_width + x) * number_of_bands;
+
+    const float time_ratio = (float) exposure_time_white_ref / exposure_time_object;
+
+    unsigned short strip[VECTOR_WIDTH * MAX_NUMBER_OF_BANDS];
+    unsigned short values[VECTOR_WIDTH];
+
+    for (unsigned int band_y = 0; band_y < pixel_height; band_y++) {
+        size_t row_start = x * pixel_width + (size_t) width * (y * pixel_height + band_y);
+        size_t input_row_start = input_offset_x + x * pixel_width + (size_t) input_width * (input_offset_y + y * pixel_height + band_y);
+        unsigned int column = 0;
+
+        for (; column + VECTOR_WIDTH <= row_length; column += VECTOR_WIDTH) {
+            size_t i = row_start + column;
+
+            float8 object = fmax(convert_float8(vload8(0, input + input_row_start + column)) - convert_float8(vload8(0, dark_ref_object + i)), (float8) 0);
+            float8 white = convert_float8(vload8(0, white_ref + i)) - convert_float8(vload8(0, dark_ref_white + i));
+            float8 result = fmin(PIXEL_MAX * (object / white * time_ratio), (float8) PIXEL_MAX);
+
+            vstore8(convert_ushort8(result), 0, values);
+
+            for (unsigned int k = 0; k < VECTOR_WIDTH; k++) {
+                unsigned int c = column + k;
+                strip[(c / pixel_width) * number_of_bands + band_y * pixel_width + c % pixel_width] = values[k];
+            }
+        }
+
+        // Remainder of a row narrower than a vector
+        for (; column < row_length; column++) {
+            size_t i = row_start + column;
+
+            int object = input[input_row_start + column] - dark_ref_object[i];
+
+            if (object < 0) {
+                object = 0;
+            }
+
+            const int white = white_ref[i] - dark_ref_white[i];
+            const float object_time_ratio = (float) object / white;
+            const float v = object_time_ratio * time_ratio;
+
+            float result = PIXEL_MAX * v;
+
+            if (result > PIXEL_MAX) {
+                result = PIXEL_MAX;
+            }
+
+            strip[(column / pixel_width) * number_of_bands + band_y * pixel_width + column % pixel_width] = (unsigned short) result;
+        }
+    }
+
+    unsigned int k = 0;
+
+    for (; k + VECTOR_WIDTH <= strip_size; k += VECTOR_WIDTH) {
+        vstore8(vload8(0, strip + k), 0, cube + cube_start + k);
+    }
+
+    for (; k < strip_size; k++) {
+        cube[cube_start + k] = strip[k];
+    }
+}
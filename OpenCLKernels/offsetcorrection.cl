@@ -17,4 +17,24 @@ kernel void OffsetCorrection(
         int i = (x - offset_x) + active_area_width * (y - offset_y);
         output[i] = input[x + sensor_width * y];
     }
-}
\ No newline at end of file
+}
+
+// Offset correction of a 10-bit packed frame fused with unpacking, one work-item per active area pixel
+// Samples are packed least significant bits first, so every sample spans two bytes
+kernel void OffsetCorrectionPacked(
+    global const uchar* input,
+    global unsigned short* output,
+    int sensor_width,
+    int offset_x,
+    int offset_y)
+{
+    int active_area_width = get_global_size(0);
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    long bit = ((long) (y + offset_y) * sensor_width + x + offset_x) * 10;
+    long byte = bit >> 3;
+    uint value = input[byte] | ((uint) input[byte + 1] << 8);
+
+    output[x + active_area_width * y] = (value >> (bit & 7)) & 0x3FF;
+}
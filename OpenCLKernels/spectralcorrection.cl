@@ -1,4 +1,6 @@
 #define PIXEL_MAX 1023
+#define VECTOR_WIDTH 8
+#define MAX_NUMBER_OF_BANDS 64
 
 kernel void SpectralCorrection(
     global unsigned short* output,
@@ -27,4 +29,124 @@ kernel void SpectralCorrection(
     else {
         output[output_index] = (unsigned short) result;
     }
-}
\ No newline at end of file
+}
+
+// Variant for CPU runtimes, each work-item corrects VECTOR_WIDTH macro-pixels at once, one macro-pixel per float8 lane,
+// so every coefficient is loaded once for VECTOR_WIDTH pixels and every multiply-add is a full SIMD operation.
+// Bands of all macro-pixels are read before any of them is written, so input and output may alias.
+kernel void SpectralCorrectionVector(
+    global unsigned short* output,
+    global const unsigned short* input,
+    global const float* coefficients,
+    unsigned int number_of_pixels,
+    unsigned int number_of_bands)
+{
+    unsigned int first_pixel = get_global_id(0) * VECTOR_WIDTH;
+
+    if (first_pixel >= number_of_pixels) {
+        return;
+    }
+
+    unsigned int count = min((unsigned int) VECTOR_WIDTH, number_of_pixels - first_pixel);
+    unsigned int strip_size = count * number_of_bands;
+    size_t strip_start = (size_t) first_pixel * number_of_bands;
+
+    // The macro-pixels of a work-item are contiguous in the cube, so they are read and written as one strip
+    unsigned short strip[VECTOR_WIDTH * MAX_NUMBER_OF_BANDS];
+    unsigned int k = 0;
+
+    for (; k + VECTOR_WIDTH <= strip_size; k += VECTOR_WIDTH) {
+        vstore8(vload8(0, input + strip_start + k), 0, strip + k);
+    }
+
+    for (; k < strip_size; k++) {
+        strip[k] = input[strip_start + k];
+    }
+
+    // pixels[i] holds band i of every macro-pixel, lanes past count are 0
+    float8 pixels[MAX_NUMBER_OF_BANDS];
+    float values[VECTOR_WIDTH];
+
+    for (unsigned int i = 0; i < number_of_bands; i++) {
+        for (unsigned int lane = 0; lane < VECTOR_WIDTH; lane++) {
+            values[lane] = lane < count ? strip[lane * number_of_bands + i] : 0;
+        }
+
+        pixels[i] = vload8(0, values);
+    }
+
+    unsigned short results[VECTOR_WIDTH];
+
+    for (unsigned int band = 0; band < number_of_bands; band++) {
+        global const float* row = coefficients + number_of_bands * band;
+        float8 sum = 0;
+
+        for (unsigned int i = 0; i < number_of_bands; i++) {
+            sum += row[i] * pixels[i];
+        }
+
+        vstore8(convert_ushort8(fmin(sum, (float8) PIXEL_MAX)), 0, results);
+
+        for (unsigned int lane = 0; lane < count; lane++) {
+            strip[lane * number_of_bands + band] = results[lane];
+        }
+    }
+
+    for (k = 0; k + VECTOR_WIDTH <= strip_size; k += VECTOR_WIDTH) {
+        vstore8(vload8(0, strip + k), 0, output + strip_start + k);
+    }
+
+    for (; k < strip_size; k++) {
+        output[strip_start + k] = strip[k];
+    }
+}
+
+// Corrects every pixel with several matrices in one pass, the bands of a pixel are read once for all of them.
+// correction_matrices holds all matrices of the sensor back to back, matrices selects number_of_matrices of them
+// and output holds one cube per selected matrix.
+kernel void SpectralCorrectionMultiple(
+    global unsigned short* output,
+    global const unsigned short* input,
+    global const float* correction_matrices,
+    global const unsigned int* matrices,
+    unsigned int number_of_matrices,
+    unsigned int number_of_pixels,
+    unsigned int number_of_bands)
+{
+    unsigned int p = get_global_id(0);
+
+    if (p >= number_of_pixels) {
+        return;
+    }
+
+    size_t pixel_start = (size_t) p * number_of_bands;
+    size_t cube_size = (size_t) number_of_pixels * number_of_bands;
+    size_t matrix_size = (size_t) number_of_bands * number_of_bands;
+
+    float pixel[MAX_NUMBER_OF_BANDS];
+
+    for (unsigned int i = 0; i < number_of_bands; i++) {
+        pixel[i] = input[pixel_start + i];
+    }
+
+    for (unsigned int m = 0; m < number_of_matrices; m++) {
+        global const float* coefficients = correction_matrices + matrices[m] * matrix_size;
+        global unsigned short* cube = output + m * cube_size;
+
+        for (unsigned int band = 0; band < number_of_bands; band++) {
+            global const float* row = coefficients + number_of_bands * band;
+            float result = 0;
+
+            for (unsigned int i = 0; i < number_of_bands; i++) {
+                result += row[i] * pixel[i];
+            }
+
+            if (result > PIXEL_MAX) {
+                cube[pixel_start + band] = PIXEL_MAX;
+            }
+            else {
+                cube[pixel_start + band] = (unsigned short) result;
+            }
+        }
+    }
+}
@@ -1,10 +1,35 @@
 #include "catch.hpp"
 
+#include "allocationcounter.hpp"
+#include "bitpacking.hpp"
+#include "calibrationcache.hpp"
+#include "cubecodec.hpp"
+#include "cubecontainer.hpp"
+#include "enviwriter.hpp"
 #include "filepaths.hpp"
+#include "framepool.hpp"
 #include "handler.hpp"
+#include "imagewriter.hpp"
+#include "mappedfile.hpp"
+#include "multicamera.hpp"
+#include "pipeline.hpp"
+#include "recorder.hpp"
+#include "replaysource.hpp"
+#include "sharedcube.hpp"
+#include "spscring.hpp"
+#include "syntheticsource.hpp"
+#include "tilescheduler.hpp"
 #include "utils.hpp"
 #include "xmlparser.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+
 bool checkEqualVectors(const std::vector<uint16_t>& result, const std::vector<uint16_t>& expected, bool must_be_precise = true) {
     // Check size
     if (result.size() != expected.size()) {
@@ -112,6 +137,34 @@ TEST_CASE("Handler + Image tests") {
         REQUIRE(checkEqualVectors(output.data(), data));
     }
 
+    SECTION("Offset correction packed") {
+        // Active lines start at samples that are not a multiple of 4
+        std::vector<uint8_t> packed(BitPacking::packedSize(data_no_offset.size()));
+        BitPacking::pack10(data_no_offset.data(), data_no_offset.size(), packed.data());
+
+        Image output(sensor);
+        REQUIRE_NOTHROW(handler.offsetPacked(packed.data(), output));
+
+        REQUIRE(checkEqualVectors(output.data(), data));
+    }
+
+    SECTION("Offset correction packed OpenCL") {
+        std::vector<uint8_t> packed(BitPacking::packedSize(data_no_offset.size()));
+        BitPacking::pack10(data_no_offset.data(), data_no_offset.size(), packed.data());
+
+        Image output(sensor);
+        REQUIRE_NOTHROW(handler.offsetPackedOpenCL(packed.data(), output));
+
+        REQUIRE(checkEqualVectors(output.data(), data));
+    }
+
+    SECTION("Offset correction OpenCL copy") {
+        Image output(sensor);
+        REQUIRE_NOTHROW(handler.offsetCopyOpenCL(data_no_offset.data(), output));
+
+        REQUIRE(checkEqualVectors(output.data(), data));
+    }
+
     SECTION("Convert to cube + reflection correction") {
         REQUIRE_NOTHROW(handler.convertToCubeAndReflectionCorrection(input));
 
@@ -123,6 +176,46 @@ TEST_CASE("Handler + Image tests") {
         REQUIRE(checkEqualVectors(input.cube(), expected, false));
     }
 
+    SECTION("Convert to cube + reflection correction mapped image") {
+        std::string filename = "test_mapped_image.raw";
+        input.saveWithoutChecking(filename);
+
+        {
+            Image mapped(sensor, std::make_shared<MappedFile>(filename));
+            REQUIRE(mapped.isMapped());
+            REQUIRE(mapped.size() == data.size());
+            REQUIRE(mapped.pixel(7) == data[7]);
+
+            REQUIRE_NOTHROW(handler.convertToCubeAndReflectionCorrection(mapped));
+
+            std::vector<uint16_t> expected{
+                0, 0, 679, 674, 0, 0, 683, 678, 0, 0, 687, 682,
+                1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023
+            };
+
+            REQUIRE(checkEqualVectors(mapped.cube(), expected, false));
+
+            // Writing copies the mapped data
+            mapped.mutablePixel(0) = 1;
+            REQUIRE_FALSE(mapped.isMapped());
+            REQUIRE(mapped.pixel(1) == data[1]);
+
+            // 10-bit packed files are loaded transparently
+            input.saveWithoutChecking(filename, PixelFormat::PACKED10);
+            Image packed(sensor, std::make_shared<MappedFile>(filename));
+            REQUIRE_FALSE(packed.isMapped());
+            REQUIRE(checkEqualVectors(packed.data(), data));
+            REQUIRE(checkEqualVectors(Image(sensor, filename).data(), data));
+
+            // Size is validated against the sensor geometry
+            Sensor other_sensor = sensor;
+            other_sensor.setActiveAreaWidth(4);
+            REQUIRE_THROWS(Image(other_sensor, std::make_shared<MappedFile>(filename)));
+        }
+
+        std::remove(filename.c_str());
+    }
+
     SECTION("Convert to cube + reflection correction OpenCL") {
         REQUIRE_NOTHROW(handler.convertToCubeAndReflectionCorrectionOpenCL(input));
 
@@ -134,6 +227,29 @@ TEST_CASE("Handler + Image tests") {
         REQUIRE(checkEqualVectors(input.cube(), expected, false));
     }
 
+    SECTION("Convert to cube + reflection correction OpenCL local memory") {
+        // Workgroup narrower than spatial width so the last strip is partial
+        REQUIRE_NOTHROW(handler.convertToCubeAndReflectionCorrectionLocalOpenCL(input, 2));
+
+        std::vector<uint16_t> expected{
+            0, 0, 679, 674, 0, 0, 683, 678, 0, 0, 687, 682,
+            1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023
+        };
+
+        REQUIRE(checkEqualVectors(input.cube(), expected, false));
+    }
+
+    SECTION("Convert to cube + reflection correction OpenCL local memory from sensor frame") {
+        REQUIRE_NOTHROW(handler.convertToCubeAndReflectionCorrectionLocalOpenCL(data_no_offset.data(), input, 2));
+
+        std::vector<uint16_t> expected{
+            0, 0, 679, 674, 0, 0, 683, 678, 0, 0, 687, 682,
+            1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023, 1023
+        };
+
+        REQUIRE(checkEqualVectors(input.cube(), expected, false));
+    }
+
     SECTION("Spectral correction") {
         Image output(sensor);
         REQUIRE_NOTHROW(handler.convertToCubeAndReflectionCorrection(input));
@@ -159,6 +275,53 @@ TEST_CASE("Handler + Image tests") {
         REQUIRE(checkEqualVectors(input.cube(), expected));
     }
 
+    SECTION("Correction matrices") {
+        std::vector<float> identity{
+            1, 0, 0, 0,
+            0, 1, 0, 0,
+            0, 0, 1, 0,
+            0, 0, 0, 1
+        };
+
+        Sensor matrices_sensor = sensor;
+        matrices_sensor.mutableCorrectionMatrices() = { { "identity", identity }, { "default", sensor.coefficients() } };
+        matrices_sensor.setDefaultCorrectionMatrix(1);
+
+        Handler matrices_handler(matrices_sensor, dark_ref_object, dark_ref_white, white_ref, exposure_time_object, exposure_time_white_ref);
+        REQUIRE(matrices_handler.correctionMatrix() == 1);
+        REQUIRE_NOTHROW(matrices_handler.convertToCubeAndReflectionCorrection(input));
+
+        std::vector<uint16_t> expected{
+            473, 1014, 155, 209, 476, 1020, 156, 210, 478, 1023, 157, 212,
+            1023, 1023, 1023, 593, 1023, 1023, 1023, 593, 1023, 1023, 1023, 593
+        };
+
+        Image output(sensor);
+        REQUIRE_NOTHROW(matrices_handler.setCorrectionMatrix("identity"));
+        REQUIRE_NOTHROW(matrices_handler.spectralCorrection(output, input));
+        CHECK(checkEqualVectors(output.cube(), input.cube()));
+
+        REQUIRE_NOTHROW(matrices_handler.setCorrectionMatrix(1));
+        REQUIRE_NOTHROW(matrices_handler.spectralCorrection(output, input));
+        CHECK(checkEqualVectors(output.cube(), expected));
+
+        CHECK_THROWS(matrices_handler.setCorrectionMatrix(2));
+        CHECK_THROWS(matrices_handler.setCorrectionMatrix("missing"));
+
+        Sensor short_sensor = matrices_sensor;
+        short_sensor.mutableCorrectionMatrices().push_back({ "short", { 1, 0, 0 } });
+
+        Handler short_handler(short_sensor, dark_ref_object, dark_ref_white, white_ref, exposure_time_object, exposure_time_white_ref);
+        CHECK_THROWS(short_handler.setCorrectionMatrix("short"));
+        CHECK(short_handler.correctionMatrix() == 1);
+
+        std::vector<Image> outputs;
+        REQUIRE_NOTHROW(matrices_handler.spectralCorrectionMultiple(outputs, input, { 1, 0 }));
+        REQUIRE(outputs.size() == 2);
+        CHECK(checkEqualVectors(outputs[0].cube(), expected));
+        CHECK(checkEqualVectors(outputs[1].cube(), input.cube()));
+    }
+
     SECTION("GetOneBand and colourmap") {
         REQUIRE_NOTHROW(handler.convertToCubeAndReflectionCorrection(input));
 
@@ -214,65 +377,1741 @@ TEST_CASE("Handler + Image tests") {
     }
 }
 
-TEST_CASE("Utils") {
-    SECTION("ParseFloatArray") {
-        auto array_text = "-0.016232591, 0.062453916, 6.7129e-005, -3.5533e-005, -0.000382194";
-        std::vector<float> result;
-        REQUIRE(Utils::parseFloatArray(result, array_text));
+TEST_CASE("ImageWriter") {
+    std::string filename = "test_image_writer.raw";
+    std::vector<uint16_t> data{ 0, 1, 2, 3, 1020, 1021, 1022, 1023 };
+    auto expected = data;
 
-        REQUIRE(result.size() == 5);
-        CHECK(result[0] == std::stof("-0.016232591"));
-        CHECK(result[1] == std::stof("0.062453916"));
-        CHECK(result[2] == std::stof("6.7129e-005"));
-        CHECK(result[3] == std::stof("-3.5533e-005"));
-        CHECK(result[4] == std::stof("-0.000382194"));
+    {
+        ImageWriter writer(1);
+
+        REQUIRE(writer.write(filename, std::move(data)));
+        REQUIRE(data.empty());
+        writer.flush();
+
+        WriteResult result;
+        REQUIRE(writer.pollResult(result));
+        REQUIRE(result.success);
+        REQUIRE(result.filename == filename);
+        REQUIRE_FALSE(writer.pollResult(result));
+
+        // Existing files are kept unless overwrite is set
+        std::vector<uint16_t> other{ 5, 5 };
+        REQUIRE(writer.write(filename, std::move(other), false));
+        writer.flush();
+        REQUIRE(writer.pollResult(result));
+        REQUIRE_FALSE(result.success);
     }
+
+    std::ifstream file(filename, std::ios::binary);
+    std::vector<uint16_t> result(expected.size());
+    file.read(reinterpret_cast<char*>(result.data()), result.size() * sizeof(uint16_t));
+    file.close();
+
+    REQUIRE(checkEqualVectors(result, expected));
+
+    SECTION("Mapped file is replaced, not overwritten") {
+        MappedFile mapped(filename);
+
+        {
+            ImageWriter writer(1);
+            REQUIRE(writer.write(filename, std::vector<uint16_t>(expected.size(), 7)));
+        }
+
+        // The mapping keeps the contents it was created with
+        auto mapped_data = static_cast<const uint16_t*>(mapped.data());
+        REQUIRE(checkEqualVectors(std::vector<uint16_t>(mapped_data, mapped_data + expected.size()), expected));
+
+        MappedFile replaced(filename);
+        auto replaced_data = static_cast<const uint16_t*>(replaced.data());
+        REQUIRE(checkEqualVectors(std::vector<uint16_t>(replaced_data, replaced_data + expected.size()), std::vector<uint16_t>(expected.size(), 7)));
+    }
+
+    std::remove(filename.c_str());
 }
 
-TEST_CASE("XmlParser") {
+TEST_CASE("FramePool") {
+    FramePool pool(16, 1);
+
+    SECTION("Buffers are recycled") {
+        const uint16_t* first_data;
+
+        {
+            auto first = pool.acquire();
+            REQUIRE(first.size() == 16);
+            REQUIRE(first.pooled());
+            first_data = first.data();
+
+            auto second = pool.acquire();
+            CHECK(pool.stats().allocations == 2);
+            CHECK(pool.stats().outstanding == 2);
+        }
+
+        CHECK(pool.stats().outstanding == 0);
+
+        // Returned buffers are handed out again without allocating
+        auto allocations = heapAllocations();
+
+        for (int i = 0; i < 10; i++) {
+            auto first = pool.acquire();
+            auto second = pool.acquire();
+            auto moved = std::move(second);
+        }
+
+        CHECK(heapAllocations() == allocations);
+        CHECK(pool.stats().allocations == 2);
+        CHECK(pool.stats().acquisitions == 22);
+        CHECK(pool.acquire().data() == first_data);
+    }
+
+    SECTION("Buffers outlive the pool") {
+        FrameBuffer buffer;
+
+        {
+            FramePool temporary(8);
+            buffer = temporary.acquire();
+        }
+
+        REQUIRE(buffer.size() == 8);
+        buffer.release();
+        CHECK(buffer.size() == 0);
+    }
+
+    SECTION("Written buffers return to the pool") {
+        std::string filename = "test_frame_pool.raw";
+
+        {
+            ImageWriter writer(1);
+            auto buffer = pool.acquire();
+            std::fill(buffer.data(), buffer.data() + buffer.size(), 7);
+
+            REQUIRE(writer.write(filename, std::move(buffer)));
+            writer.flush();
+        }
+
+        CHECK(pool.stats().outstanding == 0);
+        CHECK(pool.stats().allocations == 1);
+        CHECK(std::filesystem::file_size(filename) == 16 * sizeof(uint16_t));
+
+        std::remove(filename.c_str());
+    }
+}
+
+TEST_CASE("Steady state allocations") {
     Sensor sensor;
 
-    REQUIRE(XmlParser::ParseSensorCalibrationFileCamera(sensor, CALIBRATION_FILE));
+    sensor.setSensorWidth(6);
+    sensor.setSensorHeight(4);
+    sensor.setActiveAreaWidth(6);
+    sensor.setActiveAreaHeight(4);
+    sensor.setPatternWidth(2);
+    sensor.setPatternHeight(2);
+    sensor.setSpatialWidth(3);
+    sensor.setSpatialHeight(2);
+    sensor.setNumberOfBands(4);
+    sensor.mutableCoefficients() = {
+        1, 0, 0, 0,
+        0, 1, 0, 0,
+        0, 0, 1, 0,
+        0, 0, 0, 1
+    };
 
-    CHECK(sensor.layoutType() == LayoutType::MOSAIC);
-    CHECK(sensor.bpp() == 10);
-    CHECK(sensor.sensorWidth() == 2048);
-    CHECK(sensor.sensorHeight() == 1088);
-    CHECK(sensor.offsetX() == 0);
-    CHECK(sensor.offsetY() == 3);
-    CHECK(sensor.activeAreaWidth() == 2045);
-    CHECK(sensor.activeAreaHeight() == 1080);
-    CHECK(sensor.patternWidth() == 5);
-    CHECK(sensor.patternHeight() == 5);
-    CHECK(sensor.spatialWidth() == 409);
-    CHECK(sensor.spatialHeight() == 216);
-    CHECK(sensor.numberOfBands() == 25);
-    
-    const auto& coefficients = sensor.coefficients();
-    REQUIRE(coefficients.size() == 625);
-    CHECK(coefficients[0] == -0.0854386f);
-    CHECK(coefficients[1] == -0.0225897f);
-    CHECK(coefficients[2] == -0.00577639f);
-    CHECK(coefficients[3] == -0.128251f);
-    CHECK(coefficients[4] == -0.933499f);
-    CHECK(coefficients[5] == -0.718447f);
-    CHECK(coefficients[6] == -0.0804905f);
-    CHECK(coefficients[7] == 0.00325381f);
-    CHECK(coefficients[8] == -0.805999f);
-    CHECK(coefficients[9] == 5.32515f);
-    CHECK(coefficients[10] == -0.157854f);
-    CHECK(coefficients[11] == -0.0495194f);
-    CHECK(coefficients[12] == -0.0555022f);
-    CHECK(coefficients[13] == -0.169307f);
-    CHECK(coefficients[14] == -0.490573f);
-    CHECK(coefficients[15] == -0.18886f);
-    CHECK(coefficients[16] == 0.153923f);
-    CHECK(coefficients[17] == 0.0115126f);
-    CHECK(coefficients[18] == -0.111428f);
-    CHECK(coefficients[19] == 0.109541f);
-    CHECK(coefficients[20] == 0.00240896f);
-    CHECK(coefficients[21] == -0.0748289f);
-    CHECK(coefficients[22] == -0.0245523f);
-    CHECK(coefficients[23] == -0.0170335f);
-    CHECK(coefficients[24] == -0.440674f);
+    std::vector<uint16_t> frame(24, 500);
+    Image white_reference(sensor, std::vector<uint16_t>(24, 1000));
+    Image dark_reference(sensor, std::vector<uint16_t>(24, 0));
+    Handler handler(sensor, dark_reference, dark_reference, white_reference, 1000, 1000);
+
+    auto before = heapAllocations();
+    Image image(sensor);
+    std::vector<uint16_t> pixels;
+
+    // The first frame sizes every buffer
+    handler.process(frame.data(), image);
+    handler.getOneBandAndColourmap(pixels, image, 0);
+    CHECK(heapAllocations() > before);
+
+    auto allocations = heapAllocations();
+
+    for (int i = 0; i < 5; i++) {
+        handler.process(frame.data(), image);
+        handler.getOneBandAndColourmap(pixels, image, 0);
+    }
+
+    CHECK(heapAllocations() == allocations);
+}
+
+TEST_CASE("EnviWriter") {
+    Sensor sensor;
+
+    sensor.setPatternWidth(2);
+    sensor.setPatternHeight(1);
+    sensor.setSpatialWidth(3);
+    sensor.setSpatialHeight(2);
+    sensor.setNumberOfBands(2);
+
+    // Band interleaved by pixel as produced by Handler, value = line * 100 + sample * 10 + band
+    std::vector<uint16_t> cube{
+          0,   1,  10,  11,  20,  21,
+        100, 101, 110, 111, 120, 121
+    };
+
+    std::string filename = "test_envi_writer.img";
+
+    auto writeAndRead = [&](Interleave interleave) {
+        EnviWriter writer(filename, sensor, interleave);
+
+        // Streamed line by line
+        writer.writeLine(cube.data());
+        writer.writeLine(cube.data() + 6);
+        writer.close();
+
+        std::ifstream file(filename, std::ios::binary);
+        std::vector<uint16_t> result(cube.size());
+        file.read(reinterpret_cast<char*>(result.data()), result.size() * sizeof(uint16_t));
+
+        return result;
+    };
+
+    SECTION("BIP") {
+        REQUIRE(checkEqualVectors(writeAndRead(Interleave::BIP), cube));
+    }
+
+    SECTION("BIL") {
+        std::vector<uint16_t> expected{
+              0,  10,  20,   1,  11,  21,
+            100, 110, 120, 101, 111, 121
+        };
+
+        REQUIRE(checkEqualVectors(writeAndRead(Interleave::BIL), expected));
+    }
+
+    SECTION("BSQ") {
+        std::vector<uint16_t> expected{
+              0,  10,  20, 100, 110, 120,
+              1,  11,  21, 101, 111, 121
+        };
+
+        REQUIRE(checkEqualVectors(writeAndRead(Interleave::BSQ), expected));
+
+        std::ifstream header(EnviWriter::headerFilename(filename));
+        std::string header_text{ std::istreambuf_iterator<char>(header), std::istreambuf_iterator<char>() };
+
+        REQUIRE(header_text.find("samples = 3\n") != std::string::npos);
+        REQUIRE(header_text.find("lines = 2\n") != std::string::npos);
+        REQUIRE(header_text.find("bands = 2\n") != std::string::npos);
+        REQUIRE(header_text.find("interleave = bsq\n") != std::string::npos);
+        REQUIRE(header_text.find("data type = 12\n") != std::string::npos);
+    }
+
+    SECTION("Missing lines") {
+        EnviWriter writer(filename, sensor, Interleave::BIP);
+        writer.writeLine(cube.data());
+
+        REQUIRE_THROWS(writer.close());
+    }
+
+    std::remove(filename.c_str());
+    std::remove(EnviWriter::headerFilename(filename).c_str());
+}
+
+TEST_CASE("CubeContainer") {
+    Sensor sensor;
+
+    sensor.setSpatialWidth(10);
+    sensor.setSpatialHeight(7);
+    sensor.setNumberOfBands(5);
+
+    std::string filename = "test_cube_container.hsc";
+
+    // Tiles and band groups not dividing the cube, value = frame * 10000 + (y * 10 + x) * 10 + band
+    auto makeCube = [&sensor](unsigned int frame) {
+        std::vector<uint16_t> cube(sensor.spatialWidth() * sensor.spatialHeight() * sensor.numberOfBands());
+
+        for (size_t i = 0; i < cube.size(); i++) {
+            cube[i] = static_cast<uint16_t>(frame * 10000 + i / 5 * 10 + i % 5);
+        }
+
+        return cube;
+    };
+
+    auto check = [&](bool compressed) {
+        CubeContainerLayout layout;
+        layout.tile_width = 4;
+        layout.tile_height = 3;
+        layout.band_group = 2;
+        layout.compressed = compressed;
+
+        {
+            CubeContainerWriter writer(filename, sensor, layout);
+
+            for (unsigned int frame = 0; frame < 3; frame++) {
+                writer.writeFrame(makeCube(frame).data());
+            }
+        }
+
+        CubeContainerReader reader(filename);
+        REQUIRE(reader.numberOfFrames() == 3);
+        REQUIRE(reader.numberOfBands() == 5);
+
+        std::vector<uint16_t> result;
+
+        reader.readFrame(1, result);
+        REQUIRE(checkEqualVectors(result, makeCube(1)));
+
+        reader.readBand(2, 3, result);
+        REQUIRE(result.size() == 70);
+        CHECK(result[0] == 20003);
+        CHECK(result[69] == 20693);
+
+        // Region spanning four tiles
+        reader.readSpectra(0, 3, 2, 2, 2, result);
+        std::vector<uint16_t> expected{
+            230, 231, 232, 233, 234, 240, 241, 242, 243, 244,
+            330, 331, 332, 333, 334, 340, 341, 342, 343, 344
+        };
+        REQUIRE(checkEqualVectors(result, expected));
+
+        REQUIRE_THROWS(reader.readFrame(3, result));
+        REQUIRE_THROWS(reader.readSpectra(0, 9, 0, 2, 1, result));
+    };
+
+    SECTION("Raw chunks") {
+        check(false);
+    }
+
+    SECTION("Compressed chunks") {
+        check(true);
+    }
+
+    SECTION("Not closed") {
+        {
+            std::ofstream file(filename, std::ios::binary);
+            file << "HSCC not a closed container";
+        }
+
+        REQUIRE_THROWS(CubeContainerReader(filename));
+    }
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("Recorder") {
+    std::string filename = "test_recorder.raw";
+
+    auto readFile = [&filename]() {
+        std::ifstream file(filename, std::ios::binary);
+        return std::vector<char>{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+    };
+
+    SECTION("Small frames") {
+        std::vector<char> expected;
+
+        {
+            Recorder recorder(filename, 100, 8 << 20, 2);
+
+            for (int i = 0; i < 10; i++) {
+                std::vector<char> frame(100, static_cast<char>(i));
+                REQUIRE(recorder.record(frame.data()));
+                expected.insert(expected.end(), frame.begin(), frame.end());
+            }
+
+            auto stats = recorder.stop();
+            REQUIRE(stats.frames_recorded == 10);
+            REQUIRE(stats.frames_dropped == 0);
+            REQUIRE(stats.bytes_written == 1000);
+        }
+
+        // Padding of the last unbuffered write is trimmed
+        REQUIRE(readFile() == expected);
+    }
+
+    SECTION("Frames spanning chunks") {
+        size_t frame_size = 3 << 20;
+        RecorderStats stats;
+        std::vector<char> expected;
+
+        {
+            Recorder recorder(filename, frame_size, 16 << 20, 4);
+
+            for (int i = 0; i < 8; i++) {
+                std::vector<char> frame(frame_size, static_cast<char>(i));
+
+                if (recorder.record(frame.data())) {
+                    expected.insert(expected.end(), frame.begin(), frame.end());
+                }
+            }
+
+            stats = recorder.stop();
+        }
+
+        REQUIRE(stats.frames_recorded + stats.frames_dropped == 8);
+        REQUIRE(readFile() == expected);
+    }
+
+    SECTION("Packed frames") {
+        std::vector<uint16_t> frame{ 0, 1, 2, 3, 1020, 1021, 1022, 1023 };
+
+        {
+            Recorder recorder(filename, frame.size() * sizeof(uint16_t), 8 << 20, 1, PixelFormat::PACKED10);
+
+            for (int i = 0; i < 3; i++) {
+                REQUIRE(recorder.record(frame.data()));
+            }
+
+            REQUIRE(recorder.stop().bytes_written == 30);
+        }
+
+        auto packed = readFile();
+        REQUIRE(packed.size() == 30);
+
+        std::vector<uint16_t> result(frame.size());
+        BitPacking::unpack10(reinterpret_cast<const uint8_t*>(packed.data()) + 20, frame.size(), result.data());
+        REQUIRE(checkEqualVectors(result, frame));
+    }
+
+    SECTION("Variable sized frames") {
+        std::vector<char> expected;
+
+        {
+            Recorder recorder(filename, 100, 8 << 20, 1);
+
+            for (int i = 1; i <= 10; i++) {
+                std::vector<char> frame(i * 10, static_cast<char>(i));
+                REQUIRE(recorder.record(frame.data(), frame.size()));
+                expected.insert(expected.end(), frame.begin(), frame.end());
+            }
+
+            REQUIRE_THROWS(recorder.record(expected.data(), 101));
+            REQUIRE(recorder.stop().bytes_written == 550);
+        }
+
+        REQUIRE(readFile() == expected);
+    }
+
+    SECTION("Ring too small") {
+        REQUIRE_THROWS(Recorder(filename, 8 << 20, 8 << 20, 1));
+    }
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("ReplaySource") {
+    Sensor sensor;
+
+    sensor.setSensorWidth(4);
+    sensor.setSensorHeight(2);
+
+    std::string directory = "test_replay";
+    std::filesystem::create_directory(directory);
+
+    // Frame i holds i * 8 + pixel
+    auto writeFrames = [](const std::string& filename, uint16_t first, uint16_t count, PixelFormat format) {
+        std::vector<uint16_t> frames(count * 8);
+
+        for (size_t i = 0; i < frames.size(); i++) {
+            frames[i] = static_cast<uint16_t>(first * 8 + i);
+        }
+
+        std::ofstream file(filename, std::ios::binary);
+
+        if (format == PixelFormat::PACKED10) {
+            std::vector<uint8_t> packed(BitPacking::packedSize(frames.size()));
+            BitPacking::pack10(frames.data(), frames.size(), packed.data());
+            file.write(reinterpret_cast<const char*>(packed.data()), packed.size());
+        }
+        else {
+            file.write(reinterpret_cast<const char*>(frames.data()), frames.size() * sizeof(uint16_t));
+        }
+    };
+
+    auto checkFrame = [](const uint16_t* frame, uint16_t index) {
+        REQUIRE(frame != nullptr);
+
+        for (uint16_t i = 0; i < 8; i++) {
+            REQUIRE(frame[i] == index * 8 + i);
+        }
+    };
+
+    SECTION("File") {
+        writeFrames(directory + "/frames.raw", 0, 3, PixelFormat::RAW16);
+        ReplaySource source(directory + "/frames.raw", sensor);
+
+        for (uint16_t i = 0; i < 3; i++) {
+            checkFrame(source.next(), i);
+        }
+
+        REQUIRE(source.next() == nullptr);
+        REQUIRE(source.framesDelivered() == 3);
+    }
+
+    SECTION("Directory of packed frames in name order") {
+        writeFrames(directory + "/b.raw", 2, 1, PixelFormat::PACKED10);
+        writeFrames(directory + "/a.raw", 0, 2, PixelFormat::PACKED10);
+
+        {
+            // Not replayed
+            std::ofstream file(directory + "/a.hdr");
+            file << "ENVI";
+        }
+
+        ReplaySource source(directory, sensor, PixelFormat::PACKED10, 0, true);
+
+        // Loops back to the first frame
+        for (uint16_t i = 0; i < 7; i++) {
+            checkFrame(source.next(), i % 3);
+        }
+    }
+
+    SECTION("Frame rate") {
+        writeFrames(directory + "/frames.raw", 0, 1, PixelFormat::RAW16);
+        ReplaySource source(directory + "/frames.raw", sensor, PixelFormat::RAW16, 100, true);
+
+        for (int i = 0; i < 6; i++) {
+            source.next();
+        }
+
+        REQUIRE(source.seconds() >= 0.05);
+    }
+
+    SECTION("Partial frame") {
+        {
+            std::ofstream file(directory + "/frames.raw", std::ios::binary);
+            file << "odd";
+        }
+
+        REQUIRE_THROWS(ReplaySource(directory + "/frames.raw", sensor));
+        REQUIRE_THROWS(ReplaySource(directory + "/missing.raw", sensor));
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("SharedCube") {
+    Sensor sensor;
+    sensor.setSpatialWidth(4);
+    sensor.setSpatialHeight(3);
+    sensor.setNumberOfBands(5);
+
+    std::string name = "test_shared_cube";
+    SharedCube publisher(name, sensor);
+    SharedCube reader(name);
+
+    REQUIRE(reader.cubeSize() == 60);
+    REQUIRE(reader.numberOfBands() == 5);
+
+    std::vector<uint16_t> cube(60);
+    std::vector<uint16_t> read;
+    uint64_t frame_number;
+
+    SECTION("Publish and read") {
+        REQUIRE(!reader.read(read));
+
+        std::iota(cube.begin(), cube.end(), static_cast<uint16_t>(0));
+        publisher.publish(cube.data(), 7);
+
+        REQUIRE(reader.read(read, &frame_number));
+        REQUIRE(frame_number == 7);
+        REQUIRE(read == cube);
+        REQUIRE(reader.framesPublished() == 1);
+
+        REQUIRE_THROWS(reader.publish(cube.data(), 8));
+        REQUIRE_THROWS(SharedCube(name, sensor));
+        REQUIRE_THROWS(SharedCube("test_shared_cube_missing"));
+    }
+
+    SECTION("Reads are never torn") {
+        std::thread thread([&publisher, &cube] {
+            for (uint16_t i = 1; i <= 2000; i++) {
+                std::fill(cube.begin(), cube.end(), i);
+                publisher.publish(cube.data(), i);
+            }
+        });
+
+        auto consistent = true;
+
+        while (reader.framesPublished() < 2000) {
+            if (reader.read(read, &frame_number)) {
+                consistent = consistent && std::all_of(read.begin(), read.end(), [frame_number](uint16_t value) { return value == frame_number; });
+            }
+
+            std::this_thread::yield();
+        }
+
+        thread.join();
+
+        REQUIRE(consistent);
+    }
+}
+
+TEST_CASE("SyntheticSource") {
+    SyntheticGeometry geometry;
+    geometry.pattern_width = 3;
+    geometry.pattern_height = 2;
+    geometry.spatial_width = 5;
+    geometry.spatial_height = 4;
+    geometry.offset_x = 2;
+    geometry.offset_y = 1;
+
+    auto sensor = SyntheticSource::makeSensor(geometry);
+
+    REQUIRE(sensor.numberOfBands() == 6);
+    REQUIRE(sensor.activeAreaWidth() == 15);
+    REQUIRE(sensor.sensorWidth() == 19);
+    REQUIRE(sensor.sensorHeight() == 10);
+
+    SyntheticOptions options;
+    options.frames = 3;
+
+    SECTION("Corrected frames match the reflectance") {
+        options.noise = 0;
+        options.hot_pixel_fraction = 0;
+
+        SyntheticSource source(sensor, options);
+        Handler handler(sensor, source.darkReference(), source.darkReference(), source.whiteReference(), 1000, 1000);
+        Image image(sensor);
+
+        handler.process(source.next(), image);
+
+        for (unsigned int y = 0; y < sensor.spatialHeight(); y++) {
+            for (unsigned int x = 0; x < sensor.spatialWidth(); x++) {
+                for (unsigned int band = 0; band < sensor.numberOfBands(); band++) {
+                    auto expected = source.reflectance(x, y, band) * PIXEL_MAX;
+                    auto actual = image.pixelCube((x + y * sensor.spatialWidth()) * sensor.numberOfBands() + band);
+
+                    REQUIRE(std::abs(actual - expected) <= 2);
+                }
+            }
+        }
+    }
+
+    SECTION("Noise and hot pixels") {
+        options.hot_pixel_fraction = 0.05;
+        options.variants = 2;
+
+        SyntheticSource source(sensor, options);
+        auto first = source.next();
+        auto second = source.next();
+
+        REQUIRE(first != second);
+        REQUIRE(source.next() == first);
+        REQUIRE(source.next() == nullptr);
+        REQUIRE(source.framesDelivered() == 3);
+
+        // Hot pixels are in the same place in every frame
+        auto size = source.frameSize();
+        auto hot = 0;
+
+        for (size_t i = 0; i < size; i++) {
+            if (first[i] == PIXEL_MAX) {
+                REQUIRE(second[i] == PIXEL_MAX);
+                hot++;
+            }
+        }
+
+        REQUIRE(hot > 0);
+        REQUIRE(!std::equal(first, first + size, second));
+    }
+
+    SECTION("Invalid sensors") {
+        auto narrow = sensor;
+        narrow.setSensorWidth(10);
+        REQUIRE_THROWS(SyntheticSource(narrow));
+
+        auto bands = sensor;
+        bands.setNumberOfBands(5);
+        REQUIRE_THROWS(SyntheticSource(bands));
+
+        options.white_level = options.dark_level;
+        REQUIRE_THROWS(SyntheticSource(sensor, options));
+    }
+}
+
+TEST_CASE("Handler threads") {
+    SyntheticGeometry geometry;
+    geometry.pattern_width = 3;
+    geometry.pattern_height = 3;
+    geometry.spatial_width = 6;
+    geometry.spatial_height = 5;
+
+    auto sensor = SyntheticSource::makeSensor(geometry);
+
+    SyntheticOptions options;
+    options.frames = 4;
+    options.variants = 4;
+
+    SyntheticSource source(sensor, options);
+    Handler handler(sensor, source.darkReference(), source.darkReference(), source.whiteReference(), 1000, 1000);
+
+    std::vector<const uint16_t*> inputs;
+
+    while (auto input = source.next()) {
+        inputs.push_back(input);
+    }
+
+    // A dimmer white reference gives different results
+    auto dim_white = source.whiteReference();
+
+    for (auto& value : dim_white.mutableData()) {
+        value -= 200;
+    }
+
+    auto expectedCubes = [&handler, &inputs, &sensor]() {
+        std::vector<std::vector<uint16_t>> cubes;
+
+        for (auto input : inputs) {
+            Image image(sensor);
+            handler.process(input, image);
+            cubes.push_back(image.cube());
+        }
+
+        return cubes;
+    };
+
+    auto bright = expectedCubes();
+    handler.setWhiteReference(dim_white);
+    auto dim = expectedCubes();
+    handler.setWhiteReference(source.whiteReference());
+
+    REQUIRE(bright != dim);
+
+    const int threads = 4;
+    const int rounds = 20;
+    std::atomic<int> mismatches(0);
+    std::atomic<bool> processing(true);
+
+    auto processFrames = [&](bool toggled) {
+        std::vector<std::thread> workers;
+
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                Image image(sensor);
+
+                for (int round = 0; round < rounds; round++) {
+                    auto i = (t + round) % inputs.size();
+                    handler.process(inputs[i], image);
+
+                    if (image.cube() != bright[i] && !(toggled && image.cube() == dim[i])) {
+                        mismatches++;
+                    }
+                }
+            });
+        }
+
+        return workers;
+    };
+
+    SECTION("One calibration") {
+        auto workers = processFrames(false);
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        CHECK(mismatches == 0);
+    }
+
+    SECTION("Calibration changed while processing") {
+        // Every frame is processed with one whole calibration, never a mix of both
+        std::thread changer([&] {
+            auto use_dim = true;
+
+            while (processing) {
+                handler.setWhiteReference(use_dim ? dim_white : source.whiteReference());
+                use_dim = !use_dim;
+                std::this_thread::yield();
+            }
+        });
+
+        auto workers = processFrames(true);
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        processing = false;
+        changer.join();
+
+        CHECK(mismatches == 0);
+    }
+
+    SECTION("Handler destroyed before the thread ends") {
+        // The thread releases its context only in the Handler still alive
+        std::thread worker([&] {
+            Image image(sensor);
+
+            {
+                Handler destroyed(sensor, source.darkReference(), source.darkReference(), source.whiteReference(), 1000, 1000);
+                destroyed.process(inputs[0], image);
+            }
+
+            handler.process(inputs[1], image);
+
+            if (image.cube() != bright[1]) {
+                mismatches++;
+            }
+        });
+
+        worker.join();
+
+        CHECK(mismatches == 0);
+    }
+}
+
+TEST_CASE("SpscRing") {
+    SpscRing<int> ring(3);
+    REQUIRE(ring.capacity() == 4);
+
+    SECTION("Full and empty") {
+        int value;
+        CHECK_FALSE(ring.tryPop(value));
+
+        for (int i = 0; i < 4; i++) {
+            REQUIRE(ring.tryPush(i));
+        }
+
+        CHECK_FALSE(ring.tryPush(4));
+        CHECK(ring.size() == 4);
+
+        // Wraps around the end of the slots
+        for (int i = 0; i < 10; i++) {
+            REQUIRE(ring.tryPop(value));
+            CHECK(value == i);
+            REQUIRE(ring.tryPush(i + 4));
+        }
+
+        CHECK(ring.size() == 4);
+    }
+
+    SECTION("Two threads") {
+        const int count = 100000;
+        std::vector<int> received;
+
+        std::thread consumer([&ring, &received, count] {
+            int value;
+
+            while (static_cast<int>(received.size()) < count) {
+                if (ring.tryPop(value)) {
+                    received.push_back(value);
+                }
+                else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        for (int i = 0; i < count; i++) {
+            while (!ring.tryPush(i)) {
+                std::this_thread::yield();
+            }
+        }
+
+        consumer.join();
+
+        std::vector<int> expected(count);
+        std::iota(expected.begin(), expected.end(), 0);
+
+        REQUIRE(received == expected);
+    }
+}
+
+TEST_CASE("Pipeline") {
+    Sensor sensor;
+
+    sensor.setSensorWidth(4);
+    sensor.setSensorHeight(2);
+    sensor.setActiveAreaWidth(4);
+    sensor.setActiveAreaHeight(2);
+    sensor.setPatternWidth(2);
+    sensor.setPatternHeight(2);
+    sensor.setSpatialWidth(2);
+    sensor.setSpatialHeight(1);
+    sensor.setNumberOfBands(4);
+
+    const uint8_t frames = 50;
+    uint8_t next_frame = 0;
+
+    auto acquire = [&next_frame, frames](PipelineFrame& frame) {
+        if (next_frame == frames) {
+            return false;
+        }
+
+        std::fill(frame.raw.begin(), frame.raw.end(), next_frame++);
+        return true;
+    };
+
+    SECTION("Frames in order") {
+        auto process = [](PipelineFrame& frame) {
+            for (size_t i = 0; i < frame.image.size(); i++) {
+                frame.image.mutablePixelCube(i) = frame.raw[0] * 2;
+            }
+        };
+
+        Pipeline pipeline(sensor, 16, 3, acquire, process);
+        uint64_t presented = 0;
+
+        while (!pipeline.finished()) {
+            auto frame = pipeline.present(std::chrono::milliseconds(1000));
+
+            if (frame) {
+                CHECK(frame->sequence == presented);
+                CHECK(frame->raw.size() == 16);
+                CHECK(frame->image.pixelCube(7) == presented * 2);
+                presented++;
+            }
+        }
+
+        CHECK(presented == frames);
+
+        auto stats = pipeline.stats();
+        CHECK(stats.frames_acquired == frames);
+        CHECK(stats.frames_processed == frames);
+        CHECK(stats.frames_presented == frames);
+    }
+
+    SECTION("Commands run between frames") {
+        std::thread::id processing_thread;
+        std::thread::id command_thread;
+
+        auto process = [&processing_thread](PipelineFrame&) { processing_thread = std::this_thread::get_id(); };
+
+        Pipeline pipeline(sensor, 16, 2, acquire, process);
+        REQUIRE(pipeline.present(std::chrono::milliseconds(1000)) != nullptr);
+
+        pipeline.runBetweenFrames([&command_thread] { command_thread = std::this_thread::get_id(); });
+
+        while (pipeline.present(std::chrono::milliseconds(1000))) {}
+
+        CHECK(command_thread == processing_thread);
+    }
+
+    SECTION("Stage exception") {
+        auto process = [](PipelineFrame& frame) {
+            if (frame.sequence == 3) {
+                throw std::runtime_error("processing failed");
+            }
+        };
+
+        Pipeline pipeline(sensor, 16, 2, acquire, process);
+
+        auto presentAll = [&pipeline] {
+            while (!pipeline.finished()) {
+                pipeline.present(std::chrono::milliseconds(1000));
+            }
+        };
+
+        CHECK_THROWS_WITH(presentAll(), "processing failed");
+    }
+
+    SECTION("Too few slots") {
+        CHECK_THROWS(Pipeline(sensor, 16, 1, acquire, [](PipelineFrame&) {}));
+        CHECK_THROWS(Pipeline(sensor, 16, 2, acquire, [](PipelineFrame&) {}, BackpressurePolicy::EVERY_NTH, 0));
+    }
+
+    SECTION("Backpressure") {
+        // Correction of the first frame only ends once every frame was acquired
+        std::atomic<bool> acquired_all(false);
+        std::atomic<bool> hold_first(true);
+
+        auto acquireAll = [&acquire, &acquired_all](PipelineFrame& frame) {
+            auto more = acquire(frame);
+            acquired_all = !more;
+            return more;
+        };
+
+        auto process = [&acquired_all, &hold_first](PipelineFrame&) {
+            if (hold_first.exchange(false)) {
+                while (!acquired_all) {
+                    std::this_thread::yield();
+                }
+            }
+        };
+
+        auto presentedSequences = [&sensor, &acquireAll, &process](BackpressurePolicy policy, unsigned int every_nth, PipelineStats& stats) {
+            Pipeline pipeline(sensor, 16, 3, acquireAll, process, policy, every_nth);
+            std::vector<uint64_t> sequences;
+
+            while (!pipeline.finished()) {
+                auto frame = pipeline.present(std::chrono::milliseconds(1000));
+
+                if (frame) {
+                    CHECK(frame->raw[0] == frame->sequence);
+                    sequences.push_back(frame->sequence);
+                }
+            }
+
+            stats = pipeline.stats();
+            return sequences;
+        };
+
+        PipelineStats stats;
+
+        SECTION("Drop newest") {
+            // Frames acquired while the 2 other slots wait are discarded
+            CHECK(presentedSequences(BackpressurePolicy::DROP_NEWEST, 1, stats) == std::vector<uint64_t>{ 0, 1, 2 });
+            CHECK(stats.frames_dropped == frames - 3);
+        }
+
+        SECTION("Drop oldest") {
+            // Acquisition may already be done when correction starts, so only the last frame is certain
+            auto sequences = presentedSequences(BackpressurePolicy::DROP_OLDEST, 1, stats);
+
+            REQUIRE(!sequences.empty());
+            CHECK(sequences.size() <= 2);
+            CHECK(sequences.back() == frames - 1);
+            CHECK(stats.max_acquired_queue_depth == 1);
+        }
+
+        SECTION("Every nth") {
+            // Corrected frames wait for a slot, so holding the first one would stall acquisition
+            hold_first = false;
+            auto sequences = presentedSequences(BackpressurePolicy::EVERY_NTH, 3, stats);
+
+            REQUIRE(sequences.size() == 17);
+
+            for (size_t i = 0; i < sequences.size(); i++) {
+                CHECK(sequences[i] == i * 3);
+            }
+
+            CHECK(stats.frames_dropped == frames - 17);
+        }
+
+        CHECK(stats.frames_acquired == frames);
+        CHECK(stats.frames_presented + stats.frames_dropped == frames);
+        CHECK(stats.max_latency_seconds >= stats.averageLatency());
+    }
+
+    SECTION("Frames in flight") {
+        // Frames finish out of order, later frames first
+        std::vector<std::thread> threads;
+
+        auto process = [&threads](PipelineFrame& frame) {
+            threads.emplace_back([&frame] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(frame.sequence % 3 == 0 ? 3 : 0));
+                frame.image.mutablePixelCube(0) = frame.raw[0];
+                frame.processed.store(true, std::memory_order_release);
+            });
+        };
+
+        {
+            Pipeline pipeline(sensor, 16, 5, acquire, process, BackpressurePolicy::BLOCK, 1, 3);
+            uint64_t presented = 0;
+
+            while (!pipeline.finished()) {
+                auto frame = pipeline.present(std::chrono::milliseconds(1000));
+
+                if (frame) {
+                    CHECK(frame->sequence == presented);
+                    CHECK(frame->image.pixelCube(0) == presented);
+                    presented++;
+                }
+            }
+
+            CHECK(presented == frames);
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        CHECK_THROWS(Pipeline(sensor, 16, 2, acquire, process, BackpressurePolicy::BLOCK, 1, 0));
+    }
+}
+
+TEST_CASE("TileScheduler") {
+    // 7 rows do not split evenly into tiles of 2 rows
+    SyntheticGeometry geometry;
+    geometry.pattern_width = 3;
+    geometry.pattern_height = 2;
+    geometry.spatial_width = 5;
+    geometry.spatial_height = 7;
+    geometry.offset_x = 1;
+    geometry.offset_y = 2;
+
+    auto sensor = SyntheticSource::makeSensor(geometry);
+
+    SyntheticOptions options;
+    options.frames = 6;
+    options.variants = 3;
+
+    SyntheticSource source(sensor, options);
+    Handler handler(sensor, source.darkReference(), source.darkReference(), source.whiteReference(), 1000, 1000);
+
+    std::vector<const uint16_t*> inputs;
+
+    while (auto input = source.next()) {
+        inputs.push_back(input);
+    }
+
+    // Reference results of Handler
+    std::vector<Image> expected_images;
+    std::vector<std::vector<uint16_t>> expected_pixels(inputs.size());
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        expected_images.emplace_back(sensor);
+        handler.process(inputs[i], expected_images[i]);
+        handler.getOneBandAndColourmap(expected_pixels[i], expected_images[i], 4);
+    }
+
+    SECTION("Frames match Handler") {
+        std::vector<Image> images(inputs.size(), Image(sensor));
+        std::vector<std::vector<uint16_t>> pixels(inputs.size());
+        std::atomic<size_t> done(0);
+
+        {
+            TileScheduler scheduler(handler, 3, 2, 2);
+            REQUIRE(scheduler.tiles() == 4);
+
+            for (size_t i = 0; i < inputs.size(); i++) {
+                scheduler.submit(inputs[i], PixelFormat::RAW16, images[i], &pixels[i], 4, [&done] { done++; });
+            }
+
+            scheduler.wait();
+            CHECK(done == inputs.size());
+
+            auto stats = scheduler.stats();
+            CHECK(stats.workers == 3);
+            CHECK(stats.frames == inputs.size());
+            CHECK(stats.tasks == inputs.size() * scheduler.tiles() * 4);
+            CHECK(stats.utilization() <= 1);
+        }
+
+        for (size_t i = 0; i < inputs.size(); i++) {
+            for (size_t j = 0; j < images[i].size(); j++) {
+                REQUIRE(images[i].pixelCube(j) == expected_images[i].pixelCube(j));
+            }
+
+            REQUIRE(pixels[i] == expected_pixels[i]);
+        }
+    }
+
+    SECTION("Without colourmap") {
+        Image image(sensor);
+
+        TileScheduler scheduler(handler, 1, 100, 1);
+        REQUIRE(scheduler.tiles() == 1);
+
+        scheduler.submit(inputs[0], PixelFormat::RAW16, image, nullptr, 0, [] {});
+        scheduler.wait();
+
+        for (size_t j = 0; j < image.size(); j++) {
+            REQUIRE(image.pixelCube(j) == expected_images[0].pixelCube(j));
+        }
+
+        CHECK(scheduler.stats().tasks == 3);
+    }
+
+    SECTION("Invalid arguments") {
+        CHECK_THROWS(TileScheduler(handler, 1, 0, 1));
+        CHECK_THROWS(TileScheduler(handler, 1, 1, 0));
+    }
+}
+
+TEST_CASE("MultiCamera") {
+    SyntheticGeometry geometry;
+    geometry.pattern_width = 3;
+    geometry.pattern_height = 2;
+    geometry.spatial_width = 4;
+    geometry.spatial_height = 3;
+
+    auto sensor = SyntheticSource::makeSensor(geometry);
+    auto frame_size = static_cast<size_t>(sensor.sensorWidth()) * sensor.sensorHeight() * PIXEL_BYTE_SIZE;
+
+    // Cameras differ in their references and frames
+    const size_t cameras = 3;
+    std::vector<SyntheticOptions> options(cameras);
+    std::vector<std::unique_ptr<SyntheticSource>> sources;
+
+    for (size_t camera = 0; camera < cameras; camera++) {
+        options[camera].frames = 8;
+        options[camera].white_level = 960 - 100 * static_cast<unsigned int>(camera);
+        options[camera].seed = static_cast<unsigned int>(camera + 1);
+
+        sources.push_back(std::make_unique<SyntheticSource>(sensor, options[camera]));
+    }
+
+    Handler handler(sensor, sources[0]->darkReference(), sources[0]->darkReference(), sources[0]->whiteReference(), 1000, 1000);
+
+    std::vector<CameraInput> inputs;
+    std::vector<std::vector<std::vector<uint16_t>>> expected(cameras);
+
+    for (size_t camera = 0; camera < cameras; camera++) {
+        auto& source = *sources[camera];
+
+        CameraInput input;
+        input.name = "camera " + std::to_string(camera);
+        input.calibration = handler.makeCalibration(source.darkReference(), source.darkReference(), source.whiteReference(), 1000, 1000);
+        input.acquire = [&source](PipelineFrame& frame) {
+            auto data = source.next();
+
+            if (!data) {
+                return false;
+            }
+
+            std::memcpy(frame.raw.data(), data, frame.raw.size());
+            return true;
+        };
+
+        // Every frame of a camera is corrected with that camera's references
+        SyntheticSource reference(sensor, options[camera]);
+        Image image(sensor);
+
+        while (auto data = reference.next()) {
+            handler.process(*input.calibration, data, image);
+            expected[camera].push_back(image.cube());
+        }
+
+        inputs.push_back(std::move(input));
+    }
+
+    REQUIRE(expected[0] != expected[1]);
+
+    SECTION("Frames of every camera in order") {
+        std::vector<std::vector<uint64_t>> sequences(cameras);
+        std::atomic<int> mismatches(0);
+
+        MultiCamera multi_camera(handler, frame_size, inputs, [&](size_t camera, PipelineFrame& frame) {
+            sequences[camera].push_back(frame.sequence);
+
+            if (frame.image.cube() != expected[camera][frame.sequence]) {
+                mismatches++;
+            }
+        }, 2, 2);
+
+        multi_camera.wait();
+
+        CHECK(mismatches == 0);
+
+        auto stats = multi_camera.stats();
+        REQUIRE(stats.cameras.size() == cameras);
+        CHECK(stats.workers == 2);
+        CHECK(stats.framesProcessed() == cameras * 8);
+
+        for (size_t camera = 0; camera < cameras; camera++) {
+            CHECK(sequences[camera] == std::vector<uint64_t>{ 0, 1, 2, 3, 4, 5, 6, 7 });
+            CHECK(stats.cameras[camera].frames_acquired == 8);
+            CHECK(stats.cameras[camera].frames_dropped == 0);
+        }
+
+        // The handler's own calibration is untouched
+        CHECK(handler.calibration()->white_reference.rawData()[0] == sources[0]->whiteReference().rawData()[0]);
+    }
+
+    SECTION("Cameras are served in turn") {
+        // The first frame is held until every camera acquired all of its frames,
+        // from then on a single worker always finds every camera ready
+        std::atomic<size_t> cameras_done(0);
+        std::vector<size_t> order;
+
+        for (auto& input : inputs) {
+            auto acquire = input.acquire;
+            input.acquire = [acquire, &cameras_done](PipelineFrame& frame) {
+                auto more = acquire(frame);
+
+                if (!more) {
+                    cameras_done++;
+                }
+
+                return more;
+            };
+        }
+
+        auto on_frame = [&order, &cameras_done, cameras](size_t camera, PipelineFrame&) {
+            while (order.empty() && cameras_done < cameras) {
+                std::this_thread::yield();
+            }
+
+            order.push_back(camera);
+        };
+
+        // Acquisition takes a slot before it finds there are no more frames, so 8 frames need 9 slots
+        MultiCamera multi_camera(handler, frame_size, inputs, on_frame, 1, 9);
+        multi_camera.wait();
+
+        REQUIRE(order.size() == cameras * 8);
+
+        for (size_t i = 1; i < order.size(); i++) {
+            CHECK(order[i] == (order[i - 1] + 1) % cameras);
+        }
+    }
+
+    SECTION("Errors") {
+        CHECK_THROWS(MultiCamera(handler, frame_size, {}, nullptr));
+        CHECK_THROWS(MultiCamera(handler, frame_size, { CameraInput() }, nullptr));
+
+        inputs[1].acquire = [](PipelineFrame&) -> bool { throw std::runtime_error("camera lost"); };
+
+        MultiCamera multi_camera(handler, frame_size, inputs, nullptr, 2, 2);
+        CHECK_THROWS_WITH(multi_camera.wait(), "camera lost");
+    }
+}
+
+TEST_CASE("BitPacking") {
+    SECTION("Layout") {
+        std::vector<uint16_t> samples{ 1023, 0, 1, 512 };
+        std::vector<uint8_t> packed(BitPacking::packedSize(samples.size()));
+        std::vector<uint8_t> expected{ 0xFF, 0x03, 0x10, 0x00, 0x80 };
+
+        BitPacking::pack10(samples.data(), samples.size(), packed.data());
+
+        REQUIRE(packed == expected);
+    }
+
+    SECTION("Pack and unpack") {
+        // Not a multiple of the SIMD width
+        std::vector<uint16_t> samples(1001);
+
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i] = static_cast<uint16_t>((i * 337) % (PIXEL_MAX + 1));
+        }
+
+        std::vector<uint8_t> packed(BitPacking::packedSize(samples.size()));
+        std::vector<uint16_t> result(samples.size());
+
+        BitPacking::pack10(samples.data(), samples.size(), packed.data());
+        BitPacking::unpack10(packed.data(), samples.size(), result.data());
+
+        REQUIRE(packed.size() == 1252);
+        REQUIRE(checkEqualVectors(result, samples));
+    }
+
+    SECTION("Unpack range") {
+        std::vector<uint16_t> samples(100);
+
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i] = static_cast<uint16_t>((i * 337) % (PIXEL_MAX + 1));
+        }
+
+        std::vector<uint8_t> packed(BitPacking::packedSize(samples.size()));
+        BitPacking::pack10(samples.data(), samples.size(), packed.data());
+
+        // Every alignment of the first sample
+        for (size_t first = 0; first < 4; first++) {
+            std::vector<uint16_t> result(samples.size() - 10 - first);
+            BitPacking::unpack10(packed.data(), first + 3, result.size(), result.data());
+
+            REQUIRE(checkEqualVectors(result, std::vector<uint16_t>(samples.begin() + first + 3, samples.begin() + first + 3 + result.size())));
+        }
+    }
+}
+
+TEST_CASE("CubeCodec") {
+    Sensor sensor;
+
+    sensor.setSpatialWidth(409);
+    sensor.setSpatialHeight(216);
+    sensor.setNumberOfBands(25);
+
+    // Tile height not dividing the spatial height
+    CubeCodec codec(sensor, 20, 3);
+    auto cube_size = static_cast<size_t>(sensor.spatialWidth()) * sensor.spatialHeight() * sensor.numberOfBands();
+
+    auto roundtrip = [&codec, cube_size](const std::vector<uint16_t>& cube) {
+        std::vector<uint8_t> encoded;
+        codec.encode(cube.data(), encoded);
+        REQUIRE(encoded.size() <= codec.maxEncodedSize());
+
+        std::vector<uint16_t> result(cube_size);
+        REQUIRE(codec.decode(encoded.data(), encoded.size(), result.data()) == encoded.size());
+        REQUIRE(checkEqualVectors(result, cube));
+
+        return encoded;
+    };
+
+    SECTION("Smooth cube") {
+        std::vector<uint16_t> cube(cube_size);
+
+        for (size_t i = 0; i < cube.size(); i++) {
+            auto pixel = i / sensor.numberOfBands();
+            auto band = i % sensor.numberOfBands();
+            cube[i] = static_cast<uint16_t>(20000 + 300 * band + pixel % 409 + (i * 7919) % 5);
+        }
+
+        auto encoded = roundtrip(cube);
+        REQUIRE(encoded.size() < cube.size() * sizeof(uint16_t) / 3);
+    }
+
+    SECTION("Full range noise") {
+        std::vector<uint16_t> cube(cube_size);
+
+        for (size_t i = 0; i < cube.size(); i++) {
+            cube[i] = static_cast<uint16_t>((i * 2654435761u) >> 7);
+        }
+
+        roundtrip(cube);
+    }
+
+    SECTION("Corrupted data") {
+        std::vector<uint16_t> cube(cube_size, 1000);
+        std::vector<uint8_t> encoded;
+        codec.encode(cube.data(), encoded);
+
+        REQUIRE_THROWS(codec.decode(encoded.data(), encoded.size() - 1, cube.data()));
+        REQUIRE_THROWS(codec.decode(encoded.data(), 4, cube.data()));
+    }
+}
+
+TEST_CASE("CalibrationCache") {
+    std::string xml_file = "test_calibration.xml";
+
+    auto writeXml = [&xml_file](const std::string& text) {
+        std::ofstream file(xml_file, std::ios::binary);
+        file << text;
+    };
+
+    Sensor sensor;
+    sensor.setLayoutType(LayoutType::MOSAIC);
+    sensor.setBpp(10);
+    sensor.setSensorWidth(2048);
+    sensor.setSensorHeight(1088);
+    sensor.setOffsetY(3);
+    sensor.setActiveAreaWidth(2045);
+    sensor.setActiveAreaHeight(1080);
+    sensor.setPatternWidth(5);
+    sensor.setPatternHeight(5);
+    sensor.setSpatialWidth(409);
+    sensor.setSpatialHeight(216);
+    sensor.setNumberOfBands(25);
+    sensor.mutableCoefficients() = { -0.016232591f, 0.062453916f, 6.7129e-005f };
+    sensor.mutableCorrectionMatrices() = { { "hsi_600-875", { 1.0f, 2.0f } }, { "hsi_675-975", sensor.coefficients() } };
+    sensor.setDefaultCorrectionMatrix(1);
+
+    writeXml("<sensor_calibration/>");
+    REQUIRE_FALSE(CalibrationCache::load(sensor, xml_file));
+
+    CalibrationCache::save(sensor, xml_file);
+
+    SECTION("Load") {
+        Sensor result;
+        REQUIRE(CalibrationCache::load(result, xml_file));
+
+        CHECK(result.layoutType() == LayoutType::MOSAIC);
+        CHECK(result.bpp() == 10);
+        CHECK(result.sensorWidth() == 2048);
+        CHECK(result.sensorHeight() == 1088);
+        CHECK(result.offsetX() == 0);
+        CHECK(result.offsetY() == 3);
+        CHECK(result.activeAreaWidth() == 2045);
+        CHECK(result.activeAreaHeight() == 1080);
+        CHECK(result.patternWidth() == 5);
+        CHECK(result.patternHeight() == 5);
+        CHECK(result.spatialWidth() == 409);
+        CHECK(result.spatialHeight() == 216);
+        CHECK(result.numberOfBands() == 25);
+        CHECK(result.coefficients() == sensor.coefficients());
+
+        REQUIRE(result.correctionMatrices().size() == 2);
+        CHECK(result.correctionMatrices()[0].name == "hsi_600-875");
+        CHECK(result.correctionMatrices()[0].coefficients == std::vector<float>{ 1.0f, 2.0f });
+        CHECK(result.correctionMatrices()[1].name == "hsi_675-975");
+        CHECK(result.correctionMatrices()[1].coefficients == sensor.coefficients());
+        CHECK(result.defaultCorrectionMatrix() == 1);
+    }
+
+    SECTION("Touched XML") {
+        // Same contents with another modification time, the hash keeps the cache and the new time is stored
+        auto modification_time = std::filesystem::last_write_time(xml_file) - std::chrono::hours(1);
+        std::filesystem::last_write_time(xml_file, modification_time);
+
+        Sensor result;
+        REQUIRE(CalibrationCache::load(result, xml_file));
+        CHECK(result.coefficients() == sensor.coefficients());
+        REQUIRE(CalibrationCache::load(result, xml_file));
+    }
+
+    SECTION("Changed XML") {
+        writeXml("<sensor_calibration></sensor_calibration>");
+
+        Sensor result;
+        REQUIRE_FALSE(CalibrationCache::load(result, xml_file));
+        CHECK(result.coefficients().empty());
+    }
+
+    std::remove(xml_file.c_str());
+    std::remove(CalibrationCache::cacheFilename(xml_file).c_str());
+}
+
+TEST_CASE("Utils") {
+    SECTION("ParseFloatArray") {
+        auto array_text = "-0.016232591, 0.062453916, 6.7129e-005, -3.5533e-005, -0.000382194";
+        std::vector<float> result;
+        REQUIRE(Utils::parseFloatArray(result, array_text));
+
+        REQUIRE(result.size() == 5);
+        CHECK(result[0] == std::stof("-0.016232591"));
+        CHECK(result[1] == std::stof("0.062453916"));
+        CHECK(result[2] == std::stof("6.7129e-005"));
+        CHECK(result[3] == std::stof("-3.5533e-005"));
+        CHECK(result[4] == std::stof("-0.000382194"));
+    }
+
+    SECTION("ParseFloatArray separators") {
+        std::vector<float> result;
+        REQUIRE(Utils::parseFloatArray(result, "\n\t1.5,2.5;3e2\r\n  -4  +5 ,6\n"));
+
+        std::vector<float> expected{ 1.5f, 2.5f, 300.0f, -4.0f, 5.0f, 6.0f };
+        REQUIRE(result == expected);
+    }
+
+    SECTION("ParseFloatArray errors") {
+        std::vector<float> result;
+        size_t error_offset = 0;
+
+        REQUIRE_FALSE(Utils::parseFloatArray(result, "1.0, 2.0,, 3.0", &error_offset));
+        CHECK(error_offset == 9);
+
+        REQUIRE_FALSE(Utils::parseFloatArray(result, "1.0, 2.0x", &error_offset));
+        CHECK(error_offset == 8);
+
+        REQUIRE_FALSE(Utils::parseFloatArray(result, "1.0, 2.0, ", &error_offset));
+        CHECK(error_offset == 10);
+    }
+}
+
+// Previous character by character parser, kept as the baseline of the benchmark below
+bool parseFloatArrayStof(std::vector<float>& output, const std::string& array_text) {
+    auto waiting_for_space = false;
+    std::string float_text;
+
+    for (char c : array_text) {
+        if (!(c == ' ' || c == ',' || c == '.' || c == '-' || c == 'e' || isdigit(c))) {
+            return false;
+        }
+
+        if (!waiting_for_space && c == ',') {
+            waiting_for_space = true;
+        }
+        else if (waiting_for_space && c == ' ') {
+            output.emplace_back(std::stof(float_text));
+            float_text.clear();
+            waiting_for_space = false;
+        }
+        else {
+            float_text += c;
+        }
+    }
+
+    if (waiting_for_space) {
+        return false;
+    }
+
+    if (!float_text.empty())
+        output.emplace_back(std::stof(float_text));
+
+    return true;
+}
+
+// Run with "[!benchmark]"
+TEST_CASE("ParseFloatArray benchmark", "[!benchmark]") {
+    // Correction matrix sized text, 625 coefficients as in the calibration file
+    std::string array_text;
+
+    for (int i = 0; i < 625; i++) {
+        array_text += (i == 0 ? "" : ", ") + std::to_string((i * 7919 % 2000 - 1000) * 1.2345e-5);
+    }
+
+    std::vector<float> result;
+    std::vector<float> expected;
+    REQUIRE(parseFloatArrayStof(expected, array_text));
+
+    BENCHMARK("std::stof parser") {
+        for (int i = 0; i < 100; i++) {
+            result.clear();
+            parseFloatArrayStof(result, array_text);
+        }
+    }
+
+    BENCHMARK("std::from_chars parser") {
+        for (int i = 0; i < 100; i++) {
+            result.clear();
+            Utils::parseFloatArray(result, array_text);
+        }
+    }
+
+    REQUIRE(result == expected);
+}
+
+TEST_CASE("Handler OpenCL backend") {
+    SyntheticGeometry geometry;
+    geometry.pattern_width = 3;
+    geometry.pattern_height = 3;
+    geometry.spatial_width = 6;
+    geometry.spatial_height = 5;
+    geometry.offset_x = 2;
+    geometry.offset_y = 1;
+
+    auto sensor = SyntheticSource::makeSensor(geometry);
+    SyntheticSource source(sensor);
+    Handler cpu_handler(sensor, source.darkReference(), source.darkReference(), source.whiteReference(), 1000, 1000);
+    Handler opencl_handler(sensor, source.darkReference(), source.darkReference(), source.whiteReference(), 1000, 1000, Backend::OPENCL_CPU);
+
+    auto input = source.next();
+    Image expected(sensor);
+    cpu_handler.process(input, expected);
+
+    SECTION("Raw frame") {
+        Image image(sensor);
+        REQUIRE_NOTHROW(opencl_handler.process(input, image));
+
+        CHECK(checkEqualVectors(image.data(), expected.data()));
+        CHECK(checkEqualVectors(image.cube(), expected.cube(), false));
+    }
+
+    SECTION("Packed frame") {
+        auto samples = static_cast<size_t>(sensor.sensorWidth()) * sensor.sensorHeight();
+        std::vector<uint8_t> packed(BitPacking::packedSize(samples));
+        BitPacking::pack10(input, samples, packed.data());
+
+        Image image(sensor);
+        REQUIRE_NOTHROW(opencl_handler.processPacked(packed.data(), image));
+
+        CHECK(checkEqualVectors(image.data(), expected.data()));
+        CHECK(checkEqualVectors(image.cube(), expected.cube(), false));
+    }
+}
+
+// Run with "[!benchmark]" on a host with a CPU OpenCL runtime
+TEST_CASE("OpenCL CPU kernels benchmark", "[!benchmark]") {
+    // 5x5 mosaic of the size of the camera's active area
+    SyntheticGeometry geometry;
+    geometry.pattern_width = 5;
+    geometry.pattern_height = 5;
+    geometry.spatial_width = 409;
+    geometry.spatial_height = 216;
+    geometry.offset_x = 3;
+    geometry.offset_y = 4;
+
+    auto sensor = SyntheticSource::makeSensor(geometry);
+    SyntheticSource source(sensor);
+    Handler handler(sensor, source.darkReference(), source.darkReference(), source.whiteReference(), 1000, 1000, Backend::OPENCL_CPU);
+
+    auto input = source.next();
+    Image scalar_image(sensor);
+    Image vector_image(sensor);
+
+    // Best of several runs, the first one also builds the kernels and buffers of the thread
+    auto bestTime = [&handler, input](Image& image) {
+        auto best = std::chrono::duration<double>::max();
+
+        for (int i = 0; i < 20; i++) {
+            auto start = std::chrono::steady_clock::now();
+            handler.process(input, image);
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start));
+        }
+
+        return best.count();
+    };
+
+    handler.setVectorKernels(false);
+    auto scalar_time = bestTime(scalar_image);
+
+    handler.setVectorKernels(true);
+    auto vector_time = bestTime(vector_image);
+
+    std::cout << "Scalar kernels: " << scalar_time << "s, vector kernels: " << vector_time << "s per frame\n";
+
+    REQUIRE(checkEqualVectors(vector_image.cube(), scalar_image.cube(), false));
+    CHECK(vector_time < scalar_time);
+}
+
+TEST_CASE("XmlParser") {
+    Sensor sensor;
+
+    REQUIRE(XmlParser::ParseSensorCalibrationFileCamera(sensor, CALIBRATION_FILE));
+
+    CHECK(sensor.layoutType() == LayoutType::MOSAIC);
+    CHECK(sensor.bpp() == 10);
+    CHECK(sensor.sensorWidth() == 2048);
+    CHECK(sensor.sensorHeight() == 1088);
+    CHECK(sensor.offsetX() == 0);
+    CHECK(sensor.offsetY() == 3);
+    CHECK(sensor.activeAreaWidth() == 2045);
+    CHECK(sensor.activeAreaHeight() == 1080);
+    CHECK(sensor.patternWidth() == 5);
+    CHECK(sensor.patternHeight() == 5);
+    CHECK(sensor.spatialWidth() == 409);
+    CHECK(sensor.spatialHeight() == 216);
+    CHECK(sensor.numberOfBands() == 25);
+    
+    const auto& coefficients = sensor.coefficients();
+    REQUIRE(coefficients.size() == 625);
+    CHECK(coefficients[0] == -0.0854386f);
+    CHECK(coefficients[1] == -0.0225897f);
+    CHECK(coefficients[2] == -0.00577639f);
+    CHECK(coefficients[3] == -0.128251f);
+    CHECK(coefficients[4] == -0.933499f);
+    CHECK(coefficients[5] == -0.718447f);
+    CHECK(coefficients[6] == -0.0804905f);
+    CHECK(coefficients[7] == 0.00325381f);
+    CHECK(coefficients[8] == -0.805999f);
+    CHECK(coefficients[9] == 5.32515f);
+    CHECK(coefficients[10] == -0.157854f);
+    CHECK(coefficients[11] == -0.0495194f);
+    CHECK(coefficients[12] == -0.0555022f);
+    CHECK(coefficients[13] == -0.169307f);
+    CHECK(coefficients[14] == -0.490573f);
+    CHECK(coefficients[15] == -0.18886f);
+    CHECK(coefficients[16] == 0.153923f);
+    CHECK(coefficients[17] == 0.0115126f);
+    CHECK(coefficients[18] == -0.111428f);
+    CHECK(coefficients[19] == 0.109541f);
+    CHECK(coefficients[20] == 0.00240896f);
+    CHECK(coefficients[21] == -0.0748289f);
+    CHECK(coefficients[22] == -0.0245523f);
+    CHECK(coefficients[23] == -0.0170335f);
+    CHECK(coefficients[24] == -0.440674f);
+}
+
+TEST_CASE("XmlParser correction matrices") {
+    std::string xml_file = "test_correction_matrices.xml";
+
+    // 2x2 mosaic, so every usable matrix has 16 coefficients
+    auto writeXml = [&xml_file](const std::string& matrices) {
+        std::ofstream file(xml_file, std::ios::binary);
+        file << "<sensor_calibration>"
+                "<sensor_info><width>6</width><height>4</height><input_bpp>10</input_bpp></sensor_info>"
+                "<filter_info><filter_zones><filter_zone layout=\"MOSAIC\">"
+                "<pattern_width>2</pattern_width><pattern_height>2</pattern_height>"
+                "<filter_area><offset_x>1</offset_x><offset_y>0</offset_y><width>4</width><height>4</height></filter_area>"
+                "</filter_zone></filter_zones></filter_info>"
+                "<system_info><spectral_correction_info><correction_matrices>"
+             << matrices
+             << "</correction_matrices></spectral_correction_info></system_info>"
+                "</sensor_calibration>";
+    };
+
+    auto matrix = [](const std::string& name, int bands) {
+        std::string text = "<correction_matrix><name>" + name + "</name><virtual_bands>";
+
+        for (int i = 0; i < bands; i++) {
+            text += "<virtual_band><coefficients>1, 0, 0, 0</coefficients></virtual_band>";
+        }
+
+        return text + "</virtual_bands></correction_matrix>";
+    };
+
+    Sensor sensor;
+
+    SECTION("Matrices of another size are skipped") {
+        writeXml(matrix("hsi_600-875", 3) + matrix("hsi_675-975", 4) + matrix("hsi_600-1000", 4));
+
+        REQUIRE(XmlParser::ParseSensorCalibrationFileCamera(sensor, xml_file));
+        REQUIRE(sensor.correctionMatrices().size() == 2);
+        CHECK(sensor.correctionMatrices()[0].name == "hsi_675-975");
+        CHECK(sensor.defaultCorrectionMatrix() == 0);
+        CHECK(sensor.coefficients().size() == 16);
+    }
+
+    SECTION("Default matrix of another size") {
+        writeXml(matrix("hsi_600-875", 4) + matrix("hsi_675-975", 3));
+
+        CHECK_FALSE(XmlParser::ParseSensorCalibrationFileCamera(sensor, xml_file));
+    }
+
+    SECTION("Default matrix missing") {
+        writeXml(matrix("hsi_600-875", 4));
+
+        CHECK_FALSE(XmlParser::ParseSensorCalibrationFileCamera(sensor, xml_file));
+    }
+
+    std::remove(xml_file.c_str());
 }